@@ -51,26 +51,63 @@ struct AprilASRSession_i;
 typedef struct AprilASRModel_i * AprilASRModel;
 typedef struct AprilASRSession_i * AprilASRSession;
 
-#define APRIL_VERSION 1
+#define APRIL_VERSION 2
 
 /* Must be called once before calling any other functions */
 /* Version must be set to APRIL_VERSION like so: aam_api_init(APRIL_VERSION) */
 APRIL_EXPORT void aam_api_init(int version);
 
-/* Creates a model given a path. Returns NULL if loading failed. */
+/* Creates a model given a path. Returns NULL if loading failed. The caller
+   holds one reference to the model, see aam_release. */
 APRIL_EXPORT AprilASRModel aam_create_model(const char *model_path);
 
+/* Like aam_create_model, but returns the same model to every caller in the
+   process that asks for the same file, loading it only once. Paths are
+   compared after resolving them to absolute paths. Every call returns a new
+   reference, which must be released with aam_release or aam_free. Release
+   only the references you were given: the model is freed when the last
+   holder releases it, not when any one caller does. */
+APRIL_EXPORT AprilASRModel aam_get_shared_model(const char *model_path);
+
+/* Adds a reference to the model and returns it. */
+APRIL_EXPORT AprilASRModel aam_retain(AprilASRModel model);
+
+/* Releases a reference to the model. Every session holds its own reference,
+   so the model is only freed once it has been released by every holder and
+   all of its sessions have been freed. */
+APRIL_EXPORT void aam_release(AprilASRModel model);
+
 /* Get the name/desc/lang of the model. The pointers are valid for the
-   lifetime of the model (i.e. until aam_free is called on the model) */
+   lifetime of the model (i.e. until its last reference is released) */
 APRIL_EXPORT const char *aam_get_name(AprilASRModel model);
 APRIL_EXPORT const char *aam_get_description(AprilASRModel model);
 APRIL_EXPORT const char *aam_get_language(AprilASRModel model);
 
+/* Limits how many sessions may run the neural network at once, across the
+   whole process. Sessions waiting for their turn go in order of deadline,
+   see AprilPriorityClass. If 0 (the default), there is no limit. Only
+   encoder runs are limited, decoding and calls to the result handler
+   happen outside of it. */
+APRIL_EXPORT void aam_set_max_concurrent_inference(size_t count);
+
 /* Get the sample rate of model in Hz. For example, may return 16000 */
 APRIL_EXPORT size_t aam_get_sample_rate(AprilASRModel model);
 
-/* Caller must ensure all sessions backed by model are freed before model
-   is freed */
+typedef enum AprilModelPrecision {
+    /* All networks use 32-bit floating point weights */
+    APRIL_MODEL_PRECISION_FP32 = 0,
+
+    /* The encoder and joiner weights are dynamically quantized to 8-bit
+       integers. Inputs and outputs remain 32-bit floats. Faster on CPU at
+       a small cost to accuracy. */
+    APRIL_MODEL_PRECISION_INT8 = 1
+} AprilModelPrecision;
+
+/* Get the weight precision declared by the model */
+APRIL_EXPORT AprilModelPrecision aam_get_precision(AprilASRModel model);
+
+/* Same as aam_release. Sessions keep the model alive, so it may be called
+   before the sessions backed by the model are freed. */
 APRIL_EXPORT void aam_free(AprilASRModel model);
 
 
@@ -122,7 +159,8 @@ typedef struct AprilToken {
        The pointer will remain valid for the lifetime of the model. */
     const char *token;
 
-    /* Log probability of this being the correct token */
+    /* Log probability of this being the correct token, i.e. the log-softmax
+       of the joiner output */
     float logprob;
 
     /* See AprilTokenFlagBits */
@@ -159,8 +197,60 @@ typedef enum AprilConfigFlagBits {
        the background thread will fall behind, results may become unusable,
        and the handler will be called with APRIL_RESULT_ERROR_CANT_KEEP_UP. */
     APRIL_CONFIG_FLAG_ASYNC_NO_RT_BIT = 0x00000002,
+
+    /* May be combined with ASYNC_RT or ASYNC_NO_RT, has no effect otherwise.
+       Audio features are computed on a separate thread, overlapping with
+       the neural network inference. This may lower latency on systems with
+       several cores, at the cost of one more thread per session. */
+    APRIL_CONFIG_FLAG_PIPELINED_BIT = 0x00000004,
 } AprilConfigFlagBits;
 
+typedef enum AprilDecodingMode {
+    /* Picks the most likely token at every step. Fastest. */
+    APRIL_DECODING_GREEDY = 0,
+
+    /* Keeps the `beam_width` most likely hypotheses, emitting at most one
+       token per encoder frame. More accurate, but costs more CPU as the
+       beam width increases. Models exported with a dynamic batch axis on the
+       decoder and joiner run the whole beam in a single call. */
+    APRIL_DECODING_MODIFIED_BEAM_SEARCH = 1
+} AprilDecodingMode;
+
+typedef enum AprilSpeedupMethod {
+    /* Time-stretches the audio with Sonic before computing features. Keeps
+       the most information, but costs extra CPU when it is needed. */
+    APRIL_SPEEDUP_SONIC = 0,
+
+    /* Skips computing some of the audio features instead, which is much
+       cheaper. Accuracy drops faster as the speedup grows. */
+    APRIL_SPEEDUP_DROP_FRAMES = 1
+} AprilSpeedupMethod;
+
+typedef enum AprilPriorityClass {
+    /* The deadline of queued audio is one segment after it was received.
+       Sessions that have fallen further behind go first. */
+    APRIL_PRIORITY_REALTIME = 0,
+
+    /* Runs when no realtime session is waiting, although work that has
+       waited very long eventually goes first. Meant for transcribing files
+       alongside live sessions. */
+    APRIL_PRIORITY_BEST_EFFORT = 1
+} AprilPriorityClass;
+
+typedef enum AprilThreadPriority {
+    /* Leaves the session's threads at the default priority */
+    APRIL_THREAD_PRIORITY_NORMAL = 0,
+
+    /* Raises the priority of the session's threads. On Linux this lowers
+       the nice level, which usually needs CAP_SYS_NICE. */
+    APRIL_THREAD_PRIORITY_HIGH = 1,
+
+    /* Uses the SCHED_FIFO realtime policy on Linux, falling back to HIGH if
+       not permitted. A session that can't keep up at this priority may
+       starve the rest of the system. */
+    APRIL_THREAD_PRIORITY_REALTIME = 2
+} AprilThreadPriority;
+
 typedef struct AprilConfig {
     AprilSpeakerID speaker;
 
@@ -171,6 +261,62 @@ typedef struct AprilConfig {
 
     /* See AprilConfigFlagBits */
     AprilConfigFlagBits flags;
+
+    /* The fields below require APRIL_VERSION >= 2, and are ignored if
+       aam_api_init was called with an older version. Zero-initializing
+       gives the defaults. */
+
+    /* See AprilDecodingMode */
+    AprilDecodingMode decoding_mode;
+
+    /* Beam width for APRIL_DECODING_MODIFIED_BEAM_SEARCH. If 0, a default
+       of 4 is used. Values above 16 are clamped. */
+    size_t beam_width;
+
+    /* How audio is sped up when APRIL_CONFIG_FLAG_ASYNC_RT_BIT is set and
+       the system can't keep up. See AprilSpeedupMethod */
+    AprilSpeedupMethod speedup_method;
+
+    /* Optional smaller model to fall back to under load. It must use the
+       same tokens and audio features as the main model. When the session
+       can't keep up, it switches to the fallback model at the next pause
+       in speech, and switches back once there is enough headroom.
+       Not combined with APRIL_CONFIG_FLAG_PIPELINED_BIT, which is ignored
+       if this is set. The session holds its own reference to the fallback
+       model, so the caller may release theirs right after creating it. */
+    AprilASRModel fallback_model;
+
+    /* Processing speed, relative to realtime, above which the session
+       switches to the fallback model. If 0, a default of 0.9 is used. */
+    float fallback_threshold;
+
+    /* Only matters if aam_set_max_concurrent_inference was given a limit.
+       See AprilPriorityClass */
+    AprilPriorityClass priority_class;
+
+    /* If set, the session's background threads only run on these CPUs. The
+       neural networks run on the same threads. The session's buffers are
+       allocated from its thread, so that they are placed on the NUMA node
+       of these CPUs. The array is copied, it need not outlive
+       aas_create_session. */
+    const int *affinity_cpus;
+    size_t affinity_cpu_count;
+
+    /* Priority of the session's background threads, see
+       AprilThreadPriority */
+    AprilThreadPriority thread_priority;
+
+    /* If set, the fbank features and/or the encoder outputs of everything
+       this session processes are written to these files, to be decoded
+       again later with aas_replay_dump. */
+    const char *feature_dump_path;
+    const char *encoder_dump_path;
+
+    /* If set, every call to feed audio or flush this session is recorded
+       to this file along with its timing, to be replayed later with the
+       april_replay tool. Setting the APRIL_RECORD_DIR environment variable
+       records every session to a new file in that directory instead. */
+    const char *recording_path;
 } AprilConfig;
 
 /* Creates a session with a given model. A model may have many sessions
@@ -182,6 +328,39 @@ APRIL_EXPORT AprilASRSession aas_create_session(AprilASRModel model, AprilConfig
    Note `short_count` is the number of shorts, not bytes! */
 APRIL_EXPORT void aas_feed_pcm16(AprilASRSession session, short *pcm16, size_t short_count);
 
+/* Like aas_feed_pcm16, but takes float samples in the range [-1, 1].
+   Samples outside of the range are clipped, and NaN is treated as 0.
+   Synchronous sessions use the samples at full precision. Asynchronous
+   sessions buffer them as PCM16, and drop the whole call (reporting
+   APRIL_RESULT_ERROR_CANT_KEEP_UP once) if it doesn't fit. */
+APRIL_EXPORT void aas_feed_float32(AprilASRSession session, const float *samples, size_t count);
+
+/* Like aas_feed_pcm16, but returns the number of samples accepted instead
+   of dropping audio when the internal buffer is full. In async mode, if
+   timeout_ms is above 0, waits up to that long for room. Pass SIZE_MAX to
+   wait until all of it is accepted. Audio that was
+   not accepted is not reported through APRIL_RESULT_ERROR_CANT_KEEP_UP,
+   the caller should slow down and feed it again. In synchronous mode, all
+   audio is processed before returning. */
+APRIL_EXPORT size_t aas_feed_pcm16_ex(AprilASRSession session, short *pcm16, size_t short_count, size_t timeout_ms);
+
+/* Milliseconds of audio fed to an async session but not yet processed.
+   Always 0 in synchronous mode. */
+APRIL_EXPORT size_t aas_get_queued_ms(AprilASRSession session);
+
+/* Estimated milliseconds needed to process the queued audio, at the
+   recent processing speed. If this keeps growing, the session can't keep
+   up. Always 0 in synchronous mode. */
+APRIL_EXPORT size_t aas_get_processing_lag_ms(AprilASRSession session);
+
+/* Feeds a dump written through AprilConfig.feature_dump_path or
+   encoder_dump_path, skipping the stages before it. The session must be
+   synchronous, and its model must match the one the dump was made with,
+   at least up to the dumped stage. Flushes happen where they happened when
+   the dump was made. Returns 0 if the dump can't be used with this
+   session. */
+APRIL_EXPORT int aas_replay_dump(AprilASRSession session, const char *dump_path);
+
 /* Processes any unprocessed samples and produces a final result. */
 APRIL_EXPORT void aas_flush(AprilASRSession session);
 
@@ -191,10 +370,73 @@ APRIL_EXPORT void aas_flush(AprilASRSession session);
    being sped up and the accuracy may be reduced. */
 APRIL_EXPORT float aas_realtime_get_speedup(AprilASRSession session);
 
-/* Frees the session, this must be called for all sessions before freeing
-   the model. Saves state to a file if AprilSpeakerID was supplied. */
+/* If a fallback model was given, gets how many milliseconds of audio have
+   been processed by the main model and by the fallback model. Either
+   pointer may be NULL. */
+APRIL_EXPORT void aas_get_model_usage_ms(AprilASRSession session, size_t *primary_ms, size_t *fallback_ms);
+
+typedef struct AprilLatencyStats {
+    /* Number of tokens measured */
+    size_t count;
+
+    uint64_t min_us;
+    uint64_t max_us;
+    uint64_t mean_us;
+
+    uint64_t p50_us;
+    uint64_t p90_us;
+    uint64_t p99_us;
+    uint64_t p999_us;
+} AprilLatencyStats;
+
+/* Every session measures, for each newly emitted token, the time from when
+   the audio containing it was fed to when the handler is called with it.
+   This includes time spent in the async buffer. Percentiles come from a
+   log-bucketed histogram and are accurate to about 3%. Tentative tokens
+   that are replaced in the next result are not counted. */
+APRIL_EXPORT void aas_get_emission_latency(AprilASRSession session, AprilLatencyStats *stats);
+
+/* Gets one percentile (0 to 100) of the emission latency in microseconds,
+   or 0 if no tokens have been emitted. */
+APRIL_EXPORT uint64_t aas_get_emission_latency_percentile_us(AprilASRSession session, double percentile);
+
+/* Clears the emission latency measurements, for example to report them
+   per interval. */
+APRIL_EXPORT void aas_reset_emission_latency(AprilASRSession session);
+
+/* Frees the session and releases its reference to the model. Saves state
+   to a file if AprilSpeakerID was supplied. */
 APRIL_EXPORT void aas_free(AprilASRSession session);
 
+
+/* A result queue lets an event loop receive results without running any of
+   its code on the session's thread. Pass aaq_handler as the handler in
+   AprilConfig and the queue as the userdata. Each result is copied into the
+   queue, and the file descriptor from aaq_get_fd is readable while the queue
+   is not empty. A partial result that has not been popped yet is replaced by
+   the next partial result, so a slow reader only sees the latest one. */
+typedef struct AprilResultQueue_i * AprilResultQueue;
+
+APRIL_EXPORT AprilResultQueue aaq_create(void);
+
+/* The AprilRecognitionResultHandler of the queue, `userdata` must be the
+   AprilResultQueue. */
+APRIL_EXPORT void aaq_handler(void *userdata, AprilResultType result, size_t count, const AprilToken *tokens);
+
+/* Gets the file descriptor for polling, it only needs to be watched for
+   reading and should not be read from or closed. Returns -1 on platforms
+   without one (Windows). */
+APRIL_EXPORT int aaq_get_fd(AprilResultQueue queue);
+
+/* Pops the oldest result, copying up to max_tokens tokens. Returns 1 if a
+   result was popped and 0 otherwise. If the result has more than max_tokens
+   tokens, it is not popped and 0 is returned, with `count` set to the number
+   of tokens needed. If the queue is empty, `count` is set to 0. */
+APRIL_EXPORT int aaq_pop(AprilResultQueue queue, AprilResultType *result, AprilToken *tokens, size_t max_tokens, size_t *count);
+
+/* Frees the queue, the sessions using it must be freed first. */
+APRIL_EXPORT void aaq_free(AprilResultQueue queue);
+
 #ifdef __cplusplus
 }
 #endif
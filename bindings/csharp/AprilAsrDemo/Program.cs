@@ -2,6 +2,41 @@
 
 
 internal class Program {
+    // Reads the file data (assumes wav file is 16-bit PCM wav)
+    private static short[] ReadSamples(string wavFilePath) {
+        var fileData = File.ReadAllBytes(wavFilePath);
+        short[] shorts = new short[fileData.Length / 2];
+        Buffer.BlockCopy(fileData, 0, shorts, 0, fileData.Length);
+        return shorts;
+    }
+
+    // Transcribes the file a few times with a span callback, and prints how
+    // much was allocated on this thread while doing so. The session is
+    // synchronous, so the callbacks run here too. The first pass fills the
+    // token string cache and is not counted, after it this should print 0
+    private static void CheckAllocations(string modelPath, string wavFilePath) {
+        var model = new AprilModel(modelPath);
+        var shorts = ReadSamples(wavFilePath);
+
+        long results = 0;
+        var session = AprilSession.CreateWithSpanCallback(model, (result, tokens) => {
+            results++;
+        });
+
+        session.Feed(shorts);
+        session.Flush();
+        results = 0;
+
+        long before = GC.GetAllocatedBytesForCurrentThread();
+        for(int i=0; i<3; i++) {
+            session.Feed(shorts);
+            session.Flush();
+        }
+        long allocated = GC.GetAllocatedBytesForCurrentThread() - before;
+
+        Console.WriteLine(allocated + " bytes allocated over " + results + " results");
+    }
+
     private static void Run(string modelPath, string wavFilePath) {
         // Load the model and print metadata
         var model = new AprilModel(modelPath);
@@ -27,10 +62,7 @@ internal class Program {
             Console.WriteLine(s);
         });
 
-        // Read the file data (assumes wav file is 16-bit PCM wav)
-        var fileData = File.ReadAllBytes(wavFilePath);
-        short[] shorts = new short[fileData.Length / 2];
-        Buffer.BlockCopy(fileData, 0, shorts, 0, fileData.Length);
+        var shorts = ReadSamples(wavFilePath);
 
         // Feed the data and flush
         session.FeedPCM16(shorts, shorts.Length);
@@ -53,6 +85,10 @@ internal class Program {
             wavFilePath = Console.ReadLine() ?? "";
         }
 
-        Run(modelPath, wavFilePath);
+        if (args.Length >= 3 && args[2] == "--alloc-check") {
+            CheckAllocations(modelPath, wavFilePath);
+        } else {
+            Run(modelPath, wavFilePath);
+        }
     }
 }
\ No newline at end of file
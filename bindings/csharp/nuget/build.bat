@@ -1,4 +1,4 @@
 cp ..\..\..\build\Release\libaprilasr.dll .\build\lib\win-x64\
 cp ..\..\..\lib\lib\onnxruntime.dll .\build\lib\win-x64\
-csc /t:library /out:lib/netstandard2.0/AprilAsr.dll src/*.cs 
+csc /unsafe /r:System.Memory.dll /t:library /out:lib/netstandard2.0/AprilAsr.dll src/*.cs 
 nuget pack
@@ -21,5 +21,5 @@ else
   cp ../../../build/libaprilasr.so ./build/lib/linux-x64/
   cp ../../../lib/lib/*.so ./build/lib/linux-x64/
 fi
-mcs -out:lib/netstandard2.0/AprilAsr.dll -target:library src/*.cs
+mcs -unsafe -r:System.Memory.dll -out:lib/netstandard2.0/AprilAsr.dll -target:library src/*.cs
 nuget pack
\ No newline at end of file
@@ -11,14 +11,24 @@ namespace AprilAsr.PINVOKE {
     }
 
 
+    [StructLayout(LayoutKind.Sequential)]
+    internal struct NativeAprilToken
+    {
+        public IntPtr token;
+        public float logProb;
+        public int flags;
+        public UIntPtr timeMs;
+        public IntPtr reserved;
+    }
+
+    // The tokens are read in place rather than marshalled, which would
+    // allocate a new array for every result
     [UnmanagedFunctionPointer(CallingConvention.Cdecl)]
     internal delegate void AprilRecognitionResultHandler(
         IntPtr userdata,
         int resultType,
-        ulong numTokens,
-
-        [MarshalAs(UnmanagedType.LPArray, SizeParamIndex = 2)]
-        AprilToken[] tokens
+        UIntPtr numTokens,
+        IntPtr tokens
     );
 
     [StructLayout(LayoutKind.Sequential)]
@@ -59,8 +69,10 @@ namespace AprilAsr.PINVOKE {
         [DllImport("libaprilasr", EntryPoint="aas_create_session", CallingConvention = CallingConvention.Cdecl)]
         internal static extern IntPtr aas_create_session(IntPtr model, AprilConfig config);
 
+        // Passing the first sample by reference pins it for the call. The
+        // count is a size_t, so it is passed as a UIntPtr
         [DllImport("libaprilasr", EntryPoint="aas_feed_pcm16", CallingConvention = CallingConvention.Cdecl)]
-        internal static extern void aas_feed_pcm16(IntPtr session, short[] samples, int num_samples);
+        internal static extern void aas_feed_pcm16(IntPtr session, ref short samples, UIntPtr num_samples);
 
         [DllImport("libaprilasr", EntryPoint="aas_flush", CallingConvention = CallingConvention.Cdecl)]
         internal static extern void aas_flush(IntPtr session);
@@ -1,4 +1,5 @@
 using System;
+using System.Collections.Concurrent;
 using System.Runtime.InteropServices;
 using AprilAsr.PINVOKE;
 
@@ -20,6 +21,21 @@ namespace AprilAsr
     {
         internal IntPtr handle;
 
+        // Token strings by address. The addresses stay the same for the
+        // lifetime of the model, so each string is decoded once and shared
+        // by all sessions
+        private readonly ConcurrentDictionary<IntPtr, string> tokenStrings = new ConcurrentDictionary<IntPtr, string>();
+
+        internal string GetTokenString(IntPtr token)
+        {
+            string value;
+            if(tokenStrings.TryGetValue(token, out value)) return value;
+
+            value = AprilAsrPINVOKE.PtrToStringUTF8(token) ?? "";
+            tokenStrings.TryAdd(token, value);
+            return value;
+        }
+
         /// <summary>
         /// Loads an april model given a path to a model file.
         /// May throw an exception if the file is invalid.
@@ -1,4 +1,5 @@
 using System;
+using System.Runtime.InteropServices;
 using AprilAsr.PINVOKE;
 
 namespace AprilAsr
@@ -38,6 +39,13 @@ namespace AprilAsr
     /// </summary>
     public delegate void SessionCallback(AprilResultKind kind, AprilToken[] tokens);
 
+    /// <summary>
+    /// Session callback type that receives the tokens as a span. The span is
+    /// backed by a buffer that is reused for every result, so it's only valid
+    /// until the callback returns. See <see cref="AprilSession.CreateWithSpanCallback"/>
+    /// </summary>
+    public delegate void SessionSpanCallback(AprilResultKind kind, ReadOnlySpan<AprilToken> tokens);
+
     /// <summary>
     /// The session is what performs the actual speech recognition. It has
     /// methods to input audio, and it calls your given handler with decoded
@@ -50,25 +58,42 @@ namespace AprilAsr
         private IntPtr handle;
         private AprilModel model;
         private SessionCallback callback;
+        private SessionSpanCallback spanCallback;
         private AprilRecognitionResultHandler handler;
 
-        private void handleAprilCallback(
+        // Grows to the longest result, and is reused for every result
+        private AprilToken[] tokenBuffer = new AprilToken[0];
+
+        private unsafe void handleAprilCallback(
             IntPtr userdata,
             int resultType,
-            ulong numTokens,
-            AprilToken[] o_tokens
+            UIntPtr numTokens,
+            IntPtr nativeTokens
         )
         {
-            if(o_tokens == null) numTokens = 0;
-            
-            var tokens = new AprilToken[numTokens];
-            if(o_tokens != null){
-                for(ulong i=0; i<numTokens; i++){
-                    tokens[i] = o_tokens[i];
-                }
+            int count = (nativeTokens == IntPtr.Zero) ? 0 : (int)numTokens.ToUInt64();
+
+            if(count > tokenBuffer.Length){
+                tokenBuffer = new AprilToken[Math.Max(count, tokenBuffer.Length * 2)];
+            }
+
+            NativeAprilToken* tokens = (NativeAprilToken*)nativeTokens;
+            for(int i=0; i<count; i++){
+                tokenBuffer[i] = new AprilToken(
+                    model.GetTokenString(tokens[i].token),
+                    tokens[i].logProb,
+                    tokens[i].flags,
+                    tokens[i].timeMs.ToUInt64()
+                );
+            }
+
+            var span = new ReadOnlySpan<AprilToken>(tokenBuffer, 0, count);
+            if(spanCallback != null){
+                spanCallback((AprilResultKind)resultType, span);
+            }else{
+                // The array is the caller's to keep
+                this.callback((AprilResultKind)resultType, span.ToArray());
             }
-            
-            this.callback((AprilResultKind)resultType, tokens);
         }
 
         /// <summary>
@@ -79,9 +104,24 @@ namespace AprilAsr
         /// <param name="async">Whether or not to run the session asynchronously (perform calculations in background thread)</param>
         /// <param name="noRT">Whether or not to run the session non-realtime if async is true. Has no effect if async is false.</param>
         /// <param name="speakerName">Unique name if there is one specific speaker. This is not yet implemented and has no effect.</param>
-        public AprilSession(AprilModel model, SessionCallback callback, bool async = false, bool noRT = false, string speakerName = "") {
+        public AprilSession(AprilModel model, SessionCallback callback, bool async = false, bool noRT = false, string speakerName = "")
+            : this(model, callback, null, async, noRT, speakerName) {
+        }
+
+        /// <summary>
+        /// Construct a session whose callback receives the tokens as a span
+        /// instead of a new array. Token strings are cached per model, so in
+        /// the steady state results are delivered without allocating. The
+        /// options are the same as in the constructor.
+        /// </summary>
+        public static AprilSession CreateWithSpanCallback(AprilModel model, SessionSpanCallback callback, bool async = false, bool noRT = false, string speakerName = "") {
+            return new AprilSession(model, null, callback, async, noRT, speakerName);
+        }
+
+        private AprilSession(AprilModel model, SessionCallback callback, SessionSpanCallback spanCallback, bool async, bool noRT, string speakerName) {
             this.model = model;
             this.callback = callback;
+            this.spanCallback = spanCallback;
             this.handler = new AprilRecognitionResultHandler(this.handleAprilCallback);
 
             AprilConfig config = new AprilConfig();
@@ -121,7 +161,33 @@ namespace AprilAsr
         /// </summary>
         public void FeedPCM16(short[] samples, int num_samples)
         {
-            AprilAsrPINVOKE.aas_feed_pcm16(handle, samples, num_samples);
+            Feed(new ReadOnlySpan<short>(samples, 0, num_samples));
+        }
+
+        /// <summary>
+        /// Feed the given pcm16 samples to the session, otherwise the same as
+        /// FeedPCM16. The samples are pinned for the duration of the call
+        /// rather than copied, so they may come from a slice of a larger
+        /// buffer, stackalloc or native memory.
+        /// </summary>
+        public void Feed(ReadOnlySpan<short> samples)
+        {
+            if(samples.IsEmpty) return;
+
+            AprilAsrPINVOKE.aas_feed_pcm16(handle, ref MemoryMarshal.GetReference(samples), (UIntPtr)samples.Length);
+        }
+
+        /// <summary>
+        /// Feed the given pcm16 samples in bytes, in the platform's byte order
+        /// (little endian on x86 and ARM), without copying them.
+        /// </summary>
+        public void Feed(ReadOnlySpan<byte> pcm16)
+        {
+            if((pcm16.Length % 2) != 0){
+                throw new ArgumentException("PCM16 data must have an even number of bytes", nameof(pcm16));
+            }
+
+            Feed(MemoryMarshal.Cast<byte, short>(pcm16));
         }
 
         /// <summary>
@@ -1,6 +1,4 @@
-using AprilAsr.PINVOKE;
 using System;
-using System.Runtime.InteropServices;
 
 namespace AprilAsr
 {
@@ -16,19 +14,25 @@ namespace AprilAsr
     /// not it's a word boundary. In English, the word boundary value is equivalent
     /// to checking if the first character is a space.
     /// </summary>
-    [StructLayout(LayoutKind.Sequential, CharSet = CharSet.Ansi)]
     public struct AprilToken
     {
-        private IntPtr _token;
+        private string _token;
         private float _logProb;
         private int _flags;
-        private UIntPtr _timeMs;
-        private IntPtr _reserved;
+        private ulong _timeMs;
+
+        internal AprilToken(string token, float logProb, int flags, ulong timeMs)
+        {
+            _token = token;
+            _logProb = logProb;
+            _flags = flags;
+            _timeMs = timeMs;
+        }
 
         /// <value>The token as a string</value>
         public string Token
         {
-            get { return AprilAsrPINVOKE.PtrToStringUTF8(_token) ?? ""; }
+            get { return _token ?? ""; }
         }
 
         /// <value>The probability this is a correct token</value>
@@ -56,7 +60,7 @@ namespace AprilAsr
         /// </value>
         public float Time
         {
-            get { return (float)(((double)_timeMs.ToUInt64()) / 1000.0); }
+            get { return (float)(((double)_timeMs) / 1000.0); }
         }
     }
 }
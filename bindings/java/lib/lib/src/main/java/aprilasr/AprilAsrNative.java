@@ -30,6 +30,20 @@ public class AprilAsrNative {
         }
     };
 
+    // Layout of AprilToken, to read tokens in place without creating a
+    // Structure for each one. This follows the C alignment rules, giving
+    // 8/12/16 and a size of 32 on 64-bit targets (Windows included, as
+    // size_t is 8 bytes there too), and 4/8/12 and 20 on 32-bit ones
+    static final int TOKEN_OFFSET_LOGPROB = Native.POINTER_SIZE;
+    static final int TOKEN_OFFSET_FLAGS = TOKEN_OFFSET_LOGPROB + 4;
+    static final int TOKEN_OFFSET_TIME_MS = align(TOKEN_OFFSET_FLAGS + 4, Native.SIZE_T_SIZE);
+    static final int TOKEN_SIZE = align(align(TOKEN_OFFSET_TIME_MS + Native.SIZE_T_SIZE, Native.POINTER_SIZE) + Native.POINTER_SIZE,
+            Math.max(Native.POINTER_SIZE, Native.SIZE_T_SIZE));
+
+    private static int align(int offset, int alignment) {
+        return (offset + alignment - 1) / alignment * alignment;
+    }
+
     public static interface AprilRecognitionResultHandler extends Callback {
         void invoke(Pointer userdata, int result, NativeLong count, Pointer tokens);
     }
@@ -91,6 +105,7 @@ public class AprilAsrNative {
 
     public static native Pointer aas_create_session(Pointer model, AprilConfig.ByValue config);
     public static native void aas_feed_pcm16(Pointer session, short[] pcm16, long short_count);
+    public static native void aas_feed_pcm16(Pointer session, Pointer pcm16, long short_count);
     public static native void aas_flush(Pointer session);
 
     public static native float aas_realtime_get_speedup(Pointer session);
@@ -1,9 +1,16 @@
 package aprilasr;
 
+import com.sun.jna.Native;
 import com.sun.jna.Pointer;
 import com.sun.jna.NativeLong;
 import com.sun.jna.CallbackReference;
 
+import java.lang.ref.Reference;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.ShortBuffer;
+import java.util.Arrays;
+
 class NativeHandler implements AprilAsrNative.AprilRecognitionResultHandler {
     Session.CallbackHandler userHandler;
 
@@ -41,6 +48,110 @@ class NativeHandler implements AprilAsrNative.AprilRecognitionResultHandler {
     }
 }
 
+// Reads the tokens in place and refills the same Token objects for every
+// result, so that steady-state results don't allocate
+class ReusingNativeHandler implements AprilAsrNative.AprilRecognitionResultHandler {
+    Session.ReusingCallbackHandler userHandler;
+
+    private Token[] tokens = new Token[0];
+
+    // Token strings by address, which stays the same for the lifetime of the
+    // model. Open addressing, so lookups don't box the address
+    private long[] stringKeys = new long[512];
+    private String[] stringValues = new String[512];
+    private int stringCount = 0;
+
+    private static long readSizeOrPointer(Pointer ptr, long offset, int size) {
+        return (size == 8) ? ptr.getLong(offset) : (ptr.getInt(offset) & 0xFFFFFFFFL);
+    }
+
+    private static int slotOf(long address, int mask) {
+        return (int)((address * 0x9E3779B97F4A7C15L) >>> 32) & mask;
+    }
+
+    private void growStrings() {
+        long[] oldKeys = stringKeys;
+        String[] oldValues = stringValues;
+
+        stringKeys = new long[oldKeys.length * 2];
+        stringValues = new String[oldValues.length * 2];
+
+        int mask = stringKeys.length - 1;
+        for(int i = 0; i < oldKeys.length; i++) {
+            if(oldValues[i] == null) continue;
+
+            int slot = slotOf(oldKeys[i], mask);
+            while(stringValues[slot] != null) slot = (slot + 1) & mask;
+
+            stringKeys[slot] = oldKeys[i];
+            stringValues[slot] = oldValues[i];
+        }
+    }
+
+    private String getString(long address) {
+        if(address == 0) return "";
+
+        int mask = stringKeys.length - 1;
+        int slot = slotOf(address, mask);
+        while(stringValues[slot] != null) {
+            if(stringKeys[slot] == address) return stringValues[slot];
+            slot = (slot + 1) & mask;
+        }
+
+        String value = new Pointer(address).getString(0, "UTF-8");
+        stringKeys[slot] = address;
+        stringValues[slot] = value;
+
+        stringCount++;
+        if(stringCount * 2 > stringKeys.length) growStrings();
+
+        return value;
+    }
+
+    @Override
+    public void invoke(Pointer userdata, int result, NativeLong count, Pointer ptr) {
+        if(result == 3) {
+            userHandler.onErrorCantKeepUp();
+            return;
+        } else if(result == 4) {
+            userHandler.onSilence();
+            return;
+        }
+
+        int size = (ptr == null) ? 0 : count.intValue();
+
+        if(size > tokens.length) {
+            int oldLength = tokens.length;
+            tokens = Arrays.copyOf(tokens, size);
+            for(int i = oldLength; i < size; i++) tokens[i] = new Token();
+        }
+
+        for(int i = 0; i < size; i++) {
+            long base = (long)i * AprilAsrNative.TOKEN_SIZE;
+
+            long address = readSizeOrPointer(ptr, base, Native.POINTER_SIZE);
+            long timeMs = readSizeOrPointer(ptr, base + AprilAsrNative.TOKEN_OFFSET_TIME_MS, Native.SIZE_T_SIZE);
+
+            tokens[i].set(
+                getString(address),
+                ptr.getFloat(base + AprilAsrNative.TOKEN_OFFSET_LOGPROB),
+                ptr.getInt(base + AprilAsrNative.TOKEN_OFFSET_FLAGS),
+                (double)timeMs / 1000.0
+            );
+        }
+
+        if(result == 1){
+            userHandler.onPartialResult(tokens, size);
+        }else if(result == 2){
+            userHandler.onFinalResult(tokens, size);
+        }
+    }
+
+    public ReusingNativeHandler(Session.ReusingCallbackHandler userHandler) {
+        this.userHandler = userHandler;
+    }
+}
+
 public class Session {
     public interface CallbackHandler {
         void onPartialResult(Token[] tokens);
@@ -51,15 +162,27 @@ public class Session {
     }
 
 
-    private NativeHandler nativeHandler;
+    // Like CallbackHandler, but the array and the Token objects in it are
+    // reused for every result. Only the first `count` tokens belong to the
+    // result, and they are only valid until the callback returns
+    public interface ReusingCallbackHandler {
+        void onPartialResult(Token[] tokens, int count);
+        void onFinalResult(Token[] tokens, int count);
+
+        void onSilence();
+        void onErrorCantKeepUp();
+    }
+
+
+    private AprilAsrNative.AprilRecognitionResultHandler nativeHandler;
 
     private Model model;
 
     private Pointer handle;
 
-    public Session(Model model, CallbackHandler handler, boolean async, boolean noRT, String speakerName) {
+    private Session(Model model, AprilAsrNative.AprilRecognitionResultHandler nativeHandler, boolean async, boolean noRT, String speakerName) {
         this.model = model;
-        this.nativeHandler = new NativeHandler(handler);
+        this.nativeHandler = nativeHandler;
 
         AprilAsrNative.AprilConfig.ByValue config = new AprilAsrNative.AprilConfig.ByValue();
         config.handler = CallbackReference.getFunctionPointer(this.nativeHandler);
@@ -82,6 +205,10 @@ public class Session {
         this.handle = session;
     }
 
+    public Session(Model model, CallbackHandler handler, boolean async, boolean noRT, String speakerName) {
+        this(model, new NativeHandler(handler), async, noRT, speakerName);
+    }
+
     public Session(Model model, CallbackHandler handler, boolean async, String speakerName) {
         this(model, handler, async, false, speakerName);
     }
@@ -94,10 +221,67 @@ public class Session {
         this(model, handler, false, false, null);
     }
 
+    public Session(Model model, ReusingCallbackHandler handler, boolean async, boolean noRT, String speakerName) {
+        this(model, new ReusingNativeHandler(handler), async, noRT, speakerName);
+    }
+
+    public Session(Model model, ReusingCallbackHandler handler, boolean async) {
+        this(model, handler, async, false, null);
+    }
+
+    public Session(Model model, ReusingCallbackHandler handler) {
+        this(model, handler, false, false, null);
+    }
+
     public void feedPCM16(short[] data, int length) {
         AprilAsrNative.aas_feed_pcm16(this.handle, data, (long)length);
     }
 
+    // Feeds the samples from the position to the limit, and advances the
+    // position to the limit. A direct buffer is passed to the library by
+    // address without copying, and must be in the native byte order, for
+    // example ByteBuffer.allocateDirect(n).order(ByteOrder.nativeOrder()).asShortBuffer()
+    public void feedPCM16(ShortBuffer data) {
+        int count = data.remaining();
+
+        if(data.isDirect()) {
+            if(data.order() != ByteOrder.nativeOrder()) {
+                throw new IllegalArgumentException("Direct ShortBuffer must be in the native byte order");
+            }
+
+            Pointer samples = Native.getDirectBufferPointer(data).share((long)data.position() * 2);
+            AprilAsrNative.aas_feed_pcm16(this.handle, samples, (long)count);
+
+            // The buffer owns the memory, it must not be collected mid-call
+            Reference.reachabilityFence(data);
+        } else {
+            short[] copy = new short[count];
+            data.duplicate().get(copy);
+            feedPCM16(copy, count);
+        }
+
+        data.position(data.limit());
+    }
+
+    // Same as feedPCM16(ShortBuffer), for PCM16 bytes in the native byte
+    // order (little endian on x86 and ARM), such as a Netty direct buffer
+    public void feedPCM16(ByteBuffer data) {
+        if((data.remaining() % 2) != 0) {
+            throw new IllegalArgumentException("ByteBuffer must hold a whole number of samples");
+        }
+
+        if(data.isDirect()) {
+            Pointer samples = Native.getDirectBufferPointer(data).share(data.position());
+            AprilAsrNative.aas_feed_pcm16(this.handle, samples, (long)(data.remaining() / 2));
+
+            Reference.reachabilityFence(data);
+        } else {
+            feedPCM16(data.duplicate().order(ByteOrder.nativeOrder()).asShortBuffer());
+        }
+
+        data.position(data.limit());
+    }
+
     public float getRTSpeedup() {
         return AprilAsrNative.aas_realtime_get_speedup(this.handle);
     }
@@ -23,12 +23,16 @@ public class Token {
     }
 
     public static String concat(Token[] tokens){
-        String s = "";
-        for(Token token : tokens){
-            s += token.getValue();
+        return concat(tokens, tokens.length);
+    }
+
+    public static String concat(Token[] tokens, int count){
+        StringBuilder s = new StringBuilder();
+        for(int i = 0; i < count; i++){
+            s.append(tokens[i].getValue());
         }
 
-        return s.stripLeading();
+        return s.toString().stripLeading();
     }
 
     Token(AprilAsrNative.AprilToken token){
@@ -37,4 +41,13 @@ public class Token {
         this.value = new String(token.token);
         this.logprob = token.logprob;
     }
+
+    Token(){}
+
+    void set(String value, float logprob, int flags, double time){
+        this.value = value;
+        this.logprob = logprob;
+        this.flags = flags;
+        this.time = time;
+    }
 }
@@ -16,6 +16,9 @@ import java.net.HttpURLConnection;
 import java.net.MalformedURLException;
 import java.net.ProtocolException;
 import java.net.URL;
+import java.nio.ByteBuffer;
+import java.nio.ByteOrder;
+import java.nio.ShortBuffer;
 
 import static org.junit.jupiter.api.Assertions.*;
 
@@ -176,4 +179,62 @@ class LibraryTest {
         assertTrue(text[0].contains("ELEPHANT"));
         assertTrue(text[0].contains("COOL"));
     }
+
+    @Test void directBufferReusingTest() throws IOException {
+        URL url = new URL("https://april.sapples.net/zoo.wav");
+        HttpURLConnection con = (HttpURLConnection) url.openConnection();
+        con.setRequestMethod("GET");
+        int status = con.getResponseCode();
+        assertEquals(status, 200);
+
+        InputStream in = con.getInputStream();
+
+        byte[] data = in.readAllBytes();
+
+        // The whole file is PCM16 little endian, as in testZoo
+        ByteBuffer bytes = ByteBuffer.allocateDirect(data.length & ~1).order(ByteOrder.nativeOrder());
+        ByteBuffer little = ByteBuffer.wrap(data, 0, data.length & ~1).order(ByteOrder.LITTLE_ENDIAN);
+        while(little.remaining() >= 2) bytes.putShort(little.getShort());
+        bytes.flip();
+
+        Model wrapped_model = new Model("/home/hp/Downloads/aprilv0_en-us.april");
+
+        final String[] text = {""};
+        final Token[][] seen = {null};
+        Session.ReusingCallbackHandler handler = new Session.ReusingCallbackHandler() {
+            @Override
+            public void onPartialResult(Token[] tokens, int count) {
+                if(seen[0] == null) seen[0] = tokens;
+                assertSame(seen[0], tokens);
+            }
+
+            @Override
+            public void onFinalResult(Token[] tokens, int count) {
+                text[0] += Token.concat(tokens, count) + "\n";
+            }
+
+            @Override
+            public void onSilence() { }
+
+            @Override
+            public void onErrorCantKeepUp() { }
+        };
+
+        Session wrapped_session = new Session(wrapped_model, handler);
+
+        // First half as a direct ShortBuffer view, the rest as direct bytes
+        int half = (bytes.remaining() / 4) * 2;
+        ShortBuffer shorts = ((ByteBuffer)bytes.duplicate().limit(half)).slice().order(ByteOrder.nativeOrder()).asShortBuffer();
+        wrapped_session.feedPCM16(shorts);
+        assertEquals(0, shorts.remaining());
+
+        bytes.position(half);
+        wrapped_session.feedPCM16(bytes);
+        assertEquals(0, bytes.remaining());
+
+        wrapped_session.flush();
+
+        assertTrue(text[0].contains("ELEPHANT"));
+        assertTrue(text[0].contains("COOL"));
+    }
 }
@@ -6,6 +6,6 @@ enables low-latency on-device realtime speech recognition for live captioning
 or other speech recognition use cases.
 """
 
-__all__ = ["Token", "Result", "Model", "Session"]
+__all__ = ["Token", "Result", "Model", "Session", "AsyncSession"]
 
-from ._april import Token, Result, Model, Session
+from ._april import Token, Result, Model, Session, AsyncSession
@@ -2,9 +2,12 @@
 Public interface for april_asr
 """
 
-from typing import Callable, List
+from typing import Callable, List, Tuple
+import asyncio
+import collections
 import ctypes
 import struct
+import sys
 from enum import IntEnum
 from . import _april_c_ffi as _c
 
@@ -107,6 +110,35 @@ def _handle_result(userdata, result_type, num_tokens, tokens):
 
 _HANDLER = _c.AprilRecognitionResultHandler(_handle_result)
 
+_NATIVE = "<" if sys.byteorder == "little" else ">"
+_PCM16_FORMATS = ("B", "b", "c", "h", "=h", _NATIVE + "h")
+_FLOAT32_FORMATS = ("f", "=f", _NATIVE + "f")
+
+def _check_format(data, formats, name: str):
+    if isinstance(data, bytes):
+        return
+
+    view_format = memoryview(data).format
+    if view_format not in formats:
+        raise TypeError(f"Expected {name} audio, got a buffer of format '{view_format}'")
+
+def _make_config(asynchronous: bool, no_rt: bool, speaker_name: str):
+    config = _c.AprilConfig()
+    config.flags = _c.AprilConfigFlagBits()
+
+    if asynchronous and no_rt:
+        config.flags.value = 2
+    elif asynchronous:
+        config.flags.value = 1
+    else:
+        config.flags.value = 0
+
+    if speaker_name != "":
+        spkr_data = struct.pack("@q", hash(speaker_name)) * 2
+        config.speaker = _c.AprilSpeakerID.from_buffer_copy(spkr_data)
+
+    return config
+
 class Session:
     """
     The session is what performs the actual speech recognition. It has
@@ -122,20 +154,7 @@ class Session:
             no_rt: bool = False,
             speaker_name: str = ""
         ):
-        config = _c.AprilConfig()
-        config.flags = _c.AprilConfigFlagBits()
-
-        if asynchronous and no_rt:
-            config.flags.value = 2
-        elif asynchronous:
-            config.flags.value = 1
-        else:
-            config.flags.value = 0
-
-        if speaker_name != "":
-            spkr_data = struct.pack("@q", hash(speaker_name)) * 2
-            config.speaker = _c.AprilSpeakerID.from_buffer_copy(spkr_data)
-
+        config = _make_config(asynchronous, no_rt, speaker_name)
         config.handler = _HANDLER
         config.userdata = id(self)
 
@@ -156,16 +175,31 @@ class Session:
         """
         return _c.ffi.aas_realtime_get_speedup(self._handle)
 
-    def feed_pcm16(self, data: bytes) -> None:
+    def feed_pcm16(self, data) -> None:
         """
-        Feed the given pcm16 samples in bytes to the session. If the session is
-        asynchronous, this will return immediately and queue the data for the
-        background thread to process. If the session is not asynchronous, this
-        will block your thread and potentially call the handler before
-        returning.
+        Feed the given pcm16 samples to the session. The data may be bytes or
+        any other object supporting the buffer protocol, such as a bytearray,
+        a memoryview or a numpy int16 array, and is not copied.
+
+        If the session is asynchronous, this will return immediately and queue
+        the data for the background thread to process. If the session is not
+        asynchronous, this will block your thread and potentially call the
+        handler before returning. The GIL is released while the audio is
+        processed, so synchronous sessions fed from different threads run in
+        parallel.
         """
+        _check_format(data, _PCM16_FORMATS, "int16")
         _c.ffi.aas_feed_pcm16(self._handle, data)
 
+    def feed_float32(self, data) -> None:
+        """
+        Feed the given float32 samples in the range [-1, 1] to the session,
+        such as a numpy float32 array loaded with librosa. Otherwise this
+        behaves the same as `feed_pcm16`.
+        """
+        _check_format(data, _FLOAT32_FORMATS, "float32")
+        _c.ffi.aas_feed_float32(self._handle, data)
+
     def flush(self) -> None:
         """
         Flush any remaining samples and force the session to produce a final
@@ -177,3 +211,143 @@ class Session:
         _c.ffi.aas_free(self._handle)
         self.model = None
         self._handle = None
+
+
+class AsyncSession:
+    """
+    An asynchronous session for asyncio. Instead of calling a handler, results
+    are read by iterating over the session:
+
+        session = AsyncSession(model)
+        async for result_type, tokens in session:
+            ...
+
+    Results are queued by the C library and the event loop is woken through a
+    file descriptor, so no Python code runs on the session's thread. Feeding
+    and flushing never block. If results are read slower than they arrive,
+    only the latest partial result is kept.
+
+    It must be created while the event loop is running. The loop must support
+    `add_reader`, which the default loop on Windows does not.
+    """
+    def __init__(self,
+            model: Model,
+            no_rt: bool = False,
+            speaker_name: str = ""
+        ):
+        self._loop = asyncio.get_running_loop()
+        self._results = collections.deque()
+        self._waiter = None
+        self._closed = True
+
+        self._queue = _c.ffi.aaq_create()
+        if self._queue is None:
+            raise Exception("Failed to create result queue")
+
+        self._fd = _c.ffi.aaq_get_fd(self._queue)
+        if self._fd < 0:
+            _c.ffi.aaq_free(self._queue)
+            raise NotImplementedError("AsyncSession is not supported on this platform")
+
+        config = _make_config(True, no_rt, speaker_name)
+        config.handler = _c.ffi.aaq_handler
+        config.userdata = self._queue
+
+        self.model = model
+        self._handle = _c.ffi.aas_create_session(model._handle, config)
+        if self._handle is None:
+            _c.ffi.aaq_free(self._queue)
+            raise Exception()
+
+        self._tokens = (_c.AprilToken * 64)()
+        self._closed = False
+        self._loop.add_reader(self._fd, self._on_readable)
+
+    def _pop_results(self) -> None:
+        while True:
+            popped, result_type, count = _c.ffi.aaq_pop(self._queue, self._tokens)
+            if not popped:
+                if count == 0:
+                    break
+
+                self._tokens = (_c.AprilToken * count)()
+                continue
+
+            tokens = [Token(self._tokens[i]) for i in range(count)]
+            self._results.append((Result(result_type), tokens))
+
+    def _wake(self) -> None:
+        if self._waiter is not None and not self._waiter.done():
+            self._waiter.set_result(None)
+
+    def _on_readable(self) -> None:
+        self._pop_results()
+        self._wake()
+
+    def __aiter__(self):
+        return self
+
+    async def __anext__(self) -> Tuple[Result, List[Token]]:
+        while not self._results:
+            if self._closed:
+                raise StopAsyncIteration
+
+            self._waiter = self._loop.create_future()
+            try:
+                await self._waiter
+            finally:
+                self._waiter = None
+
+        return self._results.popleft()
+
+    def get_rt_speedup(self) -> float:
+        """See `Session.get_rt_speedup`"""
+        return _c.ffi.aas_realtime_get_speedup(self._handle)
+
+    def feed_pcm16(self, data) -> None:
+        """
+        Queue the given pcm16 samples for the session's thread, see
+        `Session.feed_pcm16` for the accepted types. This returns immediately.
+        If the session can't keep up, the audio is dropped and
+        `Result.ERROR_CANT_KEEP_UP` is queued.
+        """
+        _check_format(data, _PCM16_FORMATS, "int16")
+        _c.ffi.aas_feed_pcm16(self._handle, data)
+
+    def feed_float32(self, data) -> None:
+        """Like `feed_pcm16`, but for float32 samples in the range [-1, 1]"""
+        _check_format(data, _FLOAT32_FORMATS, "float32")
+        _c.ffi.aas_feed_float32(self._handle, data)
+
+    def flush(self) -> None:
+        """
+        Ask the session to process any remaining samples and produce a final
+        result, which arrives through the iterator. This returns immediately.
+        """
+        _c.ffi.aas_flush(self._handle)
+
+    def close(self) -> None:
+        """
+        Stop the session. Results that were already produced are still
+        returned by the iterator, after which the iteration ends.
+        """
+        if self._closed:
+            return
+
+        self._closed = True
+        if not self._loop.is_closed():
+            self._loop.remove_reader(self._fd)
+
+        # Waits for the session thread, nothing is queued after this
+        _c.ffi.aas_free(self._handle)
+        self._handle = None
+
+        self._pop_results()
+        _c.ffi.aaq_free(self._queue)
+        self._queue = None
+        self.model = None
+
+        self._wake()
+
+    def __del__(self):
+        self.close()
@@ -64,6 +64,9 @@ def _init_library_functions(lib):
     lib.aas_feed_pcm16.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_short), ctypes.c_size_t]
     lib.aas_feed_pcm16.restype = None
 
+    lib.aas_feed_float32.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_float), ctypes.c_size_t]
+    lib.aas_feed_float32.restype = None
+
     lib.aas_flush.argtypes = [ctypes.c_void_p]
     lib.aas_flush.restype = None
 
@@ -73,6 +76,46 @@ def _init_library_functions(lib):
     lib.aas_free.argtypes = [ctypes.c_void_p]
     lib.aas_free.restype = None
 
+    lib.aaq_create.argtypes = []
+    lib.aaq_create.restype = ctypes.c_void_p
+
+    lib.aaq_get_fd.argtypes = [ctypes.c_void_p]
+    lib.aaq_get_fd.restype = ctypes.c_int
+
+    lib.aaq_pop.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_int),
+        ctypes.POINTER(AprilToken), ctypes.c_size_t, ctypes.POINTER(ctypes.c_size_t)]
+    lib.aaq_pop.restype = ctypes.c_int
+
+    lib.aaq_free.argtypes = [ctypes.c_void_p]
+    lib.aaq_free.restype = None
+
+
+def _buffer_pointer(data, ctype):
+    """
+    Returns a pointer to the contents of a buffer-protocol object, the number
+    of `ctype` items in it, and an object that must be kept alive for as long
+    as the pointer is used. The contents are only copied if the buffer is
+    read-only and is neither bytes nor a numpy array.
+    """
+    if isinstance(data, bytes):
+        return ctypes.cast(data, ctypes.POINTER(ctype)), len(data) // ctypes.sizeof(ctype), data
+
+    view = memoryview(data)
+    if not view.c_contiguous:
+        raise ValueError("Audio buffer must be C-contiguous")
+
+    count = view.nbytes // ctypes.sizeof(ctype)
+    if not view.readonly:
+        array = (ctypes.c_char * view.nbytes).from_buffer(view)
+    elif hasattr(data, "__array_interface__"):
+        # Read-only numpy arrays can't be exported as writable, but their
+        # address is available
+        return ctypes.cast(data.__array_interface__["data"][0], ctypes.POINTER(ctype)), count, data
+    else:
+        array = (ctypes.c_char * view.nbytes).from_buffer_copy(view)
+
+    return ctypes.cast(array, ctypes.POINTER(ctype)), count, array
+
 
 class AprilFFI:
     """Provides all of the C functions to interact with the nativel ibrary"""
@@ -92,6 +135,13 @@ class AprilFFI:
         self.aas_flush                 = self.lib.aas_flush
         self.aas_realtime_get_speedup  = self.lib.aas_realtime_get_speedup
         self.aas_free                  = self.lib.aas_free
+        self.aaq_create                = self.lib.aaq_create
+        self.aaq_get_fd                = self.lib.aaq_get_fd
+        self.aaq_free                  = self.lib.aaq_free
+
+        # Passed to the session as its handler, so results never call into
+        # Python from the session thread
+        self.aaq_handler = ctypes.cast(self.lib.aaq_handler, AprilRecognitionResultHandler)
 
     def aam_create_model(self, path):
         """Equivalent to aam_create_model in the C header"""
@@ -109,10 +159,31 @@ class AprilFFI:
         """Equivalent to aam_get_language in the C header"""
         return self.lib.aam_get_language(model).decode("utf-8")
 
+    # Functions called through ctypes.CDLL release the GIL until they return,
+    # so other Python threads keep running while the audio is processed
+
     def aas_feed_pcm16(self, session, data):
         """Equivalent to aas_feed_pcm16 in the C header"""
-        return self.lib.aas_feed_pcm16(session,
-            ctypes.cast(data, ctypes.POINTER(ctypes.c_short)), len(data) // 2)
+        pointer, count, _keepalive = _buffer_pointer(data, ctypes.c_short)
+        return self.lib.aas_feed_pcm16(session, pointer, count)
+
+    def aas_feed_float32(self, session, data):
+        """Equivalent to aas_feed_float32 in the C header"""
+        pointer, count, _keepalive = _buffer_pointer(data, ctypes.c_float)
+        return self.lib.aas_feed_float32(session, pointer, count)
+
+    def aaq_pop(self, queue, tokens):
+        """
+        Equivalent to aaq_pop in the C header, `tokens` is an array of
+        AprilToken. Returns whether a result was popped, its type and the
+        number of tokens
+        """
+        result = ctypes.c_int()
+        count = ctypes.c_size_t()
+        popped = self.lib.aaq_pop(queue, ctypes.byref(result), tokens, len(tokens),
+            ctypes.byref(count))
+
+        return popped != 0, result.value, count.value
 
 
 def _load_library():
@@ -0,0 +1,84 @@
+"""
+Benchmark that runs one synchronous session per thread on the same file, to
+show how throughput scales with threads. The GIL is released while audio is
+processed, so the sessions run in parallel:
+
+$ python -m april_asr.benchmark /path/to/model.april /path/to/file.wav 1,2,4
+"""
+
+from typing import List
+import os
+import sys
+import threading
+import time
+import librosa
+import april_asr as april
+
+CHUNK_SECONDS = 1.0
+
+def _discard_handler(_result_type: april.Result, _tokens: List[april.Token]):
+    pass
+
+def _transcribe(session: april.Session, data, chunk: int) -> None:
+    """Feeds the audio in chunks, slicing a numpy array doesn't copy"""
+    for head in range(0, len(data), chunk):
+        session.feed_float32(data[head:head + chunk])
+    session.flush()
+
+def run_threads(model: april.Model, data, num_threads: int) -> float:
+    """Transcribes the data once on each thread, returns the wall time"""
+    sessions = [april.Session(model, _discard_handler) for _ in range(num_threads)]
+    chunk = int(model.get_sample_rate() * CHUNK_SECONDS)
+
+    threads = [
+        threading.Thread(target=_transcribe, args=(session, data, chunk))
+        for session in sessions
+    ]
+
+    start = time.perf_counter()
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    return time.perf_counter() - start
+
+def run(model_path: str, wav_file_path: str, thread_counts: List[int]) -> None:
+    """Loads the model and file, and prints the throughput at each thread count"""
+    model = april.Model(model_path)
+
+    data, _ = librosa.load(wav_file_path, sr=model.get_sample_rate(), mono=True)
+    audio_seconds = len(data) / model.get_sample_rate()
+
+    # Warm up so that the first measurement isn't penalized
+    run_threads(model, data[:model.get_sample_rate()], 1)
+
+    print(f"{audio_seconds:.1f}s of audio per thread, {os.cpu_count()} CPUs")
+    print(f"{'threads':>8} {'wall (s)':>10} {'audio s/s':>10} {'scaling':>8}")
+
+    baseline = None
+    for num_threads in thread_counts:
+        wall = run_threads(model, data, num_threads)
+        throughput = audio_seconds * num_threads / wall
+        if baseline is None:
+            baseline = throughput / num_threads
+
+        print(f"{num_threads:>8} {wall:>10.2f} {throughput:>10.1f} {throughput / baseline:>7.2f}x")
+
+def main():
+    """Checks the given arguments and prints usage or calls the run function"""
+    args = sys.argv
+    if len(args) not in (3, 4):
+        print("Usage: " + args[0] + " /path/to/model.april /path/to/file.wav [1,2,4]")
+        return
+
+    if len(args) == 4:
+        thread_counts = [int(n) for n in args[3].split(",")]
+    else:
+        thread_counts = [1, 2, 4, os.cpu_count() or 1]
+        thread_counts = sorted(set(thread_counts))
+
+    run(args[1], args[2], thread_counts)
+
+if __name__ == "__main__":
+    main()
@@ -37,10 +37,9 @@ def run(model_path: str, wav_file_path: str) -> None:
 
     # Read the audio file, works with any audio filetype librosa supports
     data, _ = librosa.load(wav_file_path, sr=model.get_sample_rate(), mono=True)
-    data = (data * 32767).astype("short").astype("<u2").tobytes()
 
-    # Feed the audio data
-    session.feed_pcm16(data)
+    # Feed the audio data, the float32 array is passed without a copy
+    session.feed_float32(data)
 
     # Flush to finish off
     session.flush()
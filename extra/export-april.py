@@ -36,6 +36,9 @@ Export to ONNX format
   --language "en-us" \
   --description "This is an example model"
 
+Pass --quantize true to dynamically quantize the encoder and joiner weights to
+int8, which is considerably faster on CPU.
+
 It will generate the following file in the given `exp_dir`.
     - (name)_(language).april
 
@@ -44,8 +47,10 @@ This model may be loaded and used with libapril
 
 import argparse
 import logging
+import os
+import tempfile
 from pathlib import Path
-from typing import Tuple
+from typing import List, Tuple
 import unicodedata
 import re
 from io import BytesIO
@@ -158,6 +163,34 @@ def get_parser():
         help="The context size in the decoder. 1 means bigram; 2 means tri-gram",
     )
 
+    parser.add_argument(
+        "--quantize",
+        type=str2bool,
+        default=False,
+        help="""If True, the encoder and joiner weights are dynamically
+        quantized to int8 (integer ops). Inputs and outputs stay float32.
+        Requires the onnxruntime python package.""",
+    )
+
+    parser.add_argument(
+        "--fuse-decoder-joiner",
+        type=str2bool,
+        default=False,
+        help="""If True, the decoder and joiner are exported as a single
+        network taking encoder_out and context. This halves the number of
+        network runs per emitted token. Requires a recent libaprilasr.""",
+    )
+
+    parser.add_argument(
+        "--dynamic-encoder-time",
+        type=str2bool,
+        default=False,
+        help="""If True, the encoder is exported with a dynamic time axis so
+        that it can process many segments in one run when audio is
+        backlogged, for example when decoding files. Requires a recent
+        libaprilasr.""",
+    )
+
     add_model_arguments(parser)
 
     return parser
@@ -195,7 +228,7 @@ class MergedEncoder(nn.Module):
         self, x: torch.Tensor, h: torch.Tensor, c: torch.Tensor
     ) -> Tuple[torch.Tensor, torch.Tensor, torch.Tensor]:
         warmup = 1.0
-        x_lens = torch.tensor([9], dtype=torch.int64)
+        x_lens = torch.full((x.size(0),), x.size(1), dtype=torch.int64)
 
         x, _, new_states = self.encoder(x, x_lens, (h, c), warmup)
         x = self.encoder_proj(x)
@@ -223,13 +256,67 @@ class MergedDecoder(nn.Module):
         return decoder_out
 
 
-def export_model_onnx(model: nn.Module, sp, opset_version: int = 11) -> Tuple[BytesIO, BytesIO, BytesIO, BytesIO]:
+class FusedDecoderJoiner(nn.Module):
+    """
+    This combines the decoder, decoder_proj and joiner into one network, so
+    that a decoding step is a single network run.
+    """
+
+    def __init__(self, decoder: nn.Module, joiner: nn.Module) -> None:
+        super().__init__()
+        self.decoder = MergedDecoder(decoder, joiner.decoder_proj)
+        self.joiner = joiner
+
+    def forward(self, encoder_out: torch.Tensor, context: torch.Tensor) -> torch.Tensor:
+        decoder_out = self.decoder(context)
+        return self.joiner(encoder_out, decoder_out, False)
+
+
+MODEL_LSTM_TRANSDUCER_STATELESS = 1
+MODEL_LSTM_TRANSDUCER_STATELESS_FUSED = 2
+
+PRECISION_FP32 = 0
+PRECISION_INT8 = 1
+
+def quantize_network(network: BytesIO) -> BytesIO:
+    """Dynamically quantizes the weights of an ONNX network to int8.
+    MatMul, Gemm and LSTM weights are quantized, activations are quantized at
+    runtime. The network inputs and outputs remain float32."""
+    from onnxruntime.quantization import quantize_dynamic, QuantType
+
+    with tempfile.TemporaryDirectory() as tmp:
+        fp32_path = os.path.join(tmp, "fp32.onnx")
+        int8_path = os.path.join(tmp, "int8.onnx")
+
+        with open(fp32_path, "wb") as f:
+            f.write(network.getbuffer())
+
+        quantize_dynamic(
+            fp32_path,
+            int8_path,
+            op_types_to_quantize=["MatMul", "Gemm", "LSTM"],
+            weight_type=QuantType.QInt8,
+        )
+
+        quantized = BytesIO()
+        with open(int8_path, "rb") as f:
+            quantized.write(f.read())
+
+    return quantized
+
+
+def export_model_onnx(model: nn.Module, sp, quantize: bool = False, fuse: bool = False, dynamic_time: bool = False, opset_version: int = 11) -> Tuple[List[BytesIO], BytesIO]:
     """Export the given model to ONNX format.
     This exports the model as 3 networks:
         - encoder.onnx, which combines the encoder and joiner's encoder_proj
         - decoder.onnx, which combines the decoder and joiner's decoder_proj
         - joiner.onnx, which takes encoder and decoder outputs
 
+    or, if fuse is set, as 2 networks:
+        - encoder.onnx, as above
+        - joiner.onnx, which combines decoder.onnx and joiner.onnx and takes
+          encoder_out and context
+
 
     The encoder network has 3 inputs:
         - x: mel features, a tensor of shape (N, T, C); dtype is torch.float32
@@ -244,6 +331,10 @@ def export_model_onnx(model: nn.Module, sp, opset_version: int = 11) -> Tuple[By
     next_h0 and next_c0 should be provided as h0 and c0 inputs in the
     subsequent call.
 
+    T is 9, or dynamic if dynamic_time is set. The encoder then accepts
+    9 + 4 * (n - 1) frames and returns T' = n frames, the same as n
+    separate runs over segments of 9 frames with a step of 4.
+
     Note: The warmup argument is fixed to 1.
 
 
@@ -259,17 +350,30 @@ def export_model_onnx(model: nn.Module, sp, opset_version: int = 11) -> Tuple[By
     and has one output:
         - logit: a tensor of shape (N, vocab_size)
 
+
+    The fused joiner network has 2 inputs:
+        - encoder_out: a tensor of shape (N, 1, joiner_dim)
+        - context: a torch.int64 tensor of shape (N, decoder_model.context_size)
+    and has one output:
+        - logit: a tensor of shape (N, vocab_size)
+
+    If quantize is set, the encoder and joiner are dynamically quantized
+    after export. The decoder is small and stays in float32, unless fused
+    into the joiner.
+
     Args:
       model:
         The input model
-      out_path:
-        The path to save the exported ONNX models.
+      quantize:
+        Whether to quantize the encoder and joiner to int8.
+      fuse:
+        Whether to fuse the decoder into the joiner.
+      dynamic_time:
+        Whether to export the encoder with a dynamic time axis.
       opset_version:
         The opset version to use.
     Returns:
-      encoder_b
-      decoder_b
-      joiner_b
+      networks, in the order they are stored in the file
       params_b
     """
     encoder_b = BytesIO()
@@ -297,7 +401,8 @@ def export_model_onnx(model: nn.Module, sp, opset_version: int = 11) -> Tuple[By
         verbose=False,
         opset_version=opset_version,
         input_names=["x", "h", "c"],
-        output_names=["encoder_out", "next_h", "next_c"]
+        output_names=["encoder_out", "next_h", "next_c"],
+        dynamic_axes={"x": {1: "T"}, "encoder_out": {1: "T_out"}} if dynamic_time else None
     )
     logging.info(f"Serialized encoder")
 
@@ -310,27 +415,53 @@ def export_model_onnx(model: nn.Module, sp, opset_version: int = 11) -> Tuple[By
         verbose=False,
         opset_version=opset_version,
         input_names=["context"],
-        output_names=["decoder_out"]
+        output_names=["decoder_out"],
+        # A dynamic batch axis lets beam search run every hypothesis at once
+        dynamic_axes={"context": {0: "N"}, "decoder_out": {0: "N"}}
     )
     logging.info(f"Serialized decoder")
 
     # Export joiner
     encoder_out, _, _ = onnx_encoder(x, h, c)
-    decoder_out = onnx_decoder(context)
-
-    project_input = False
-
-    torch.onnx.export(
-        model.joiner,  # use torch.jit.trace() internally
-        (encoder_out, decoder_out, project_input),
-        joiner_b,
-        verbose=False,
-        opset_version=opset_version,
-        input_names=["encoder_out", "decoder_out"],
-        output_names=["logits"]
-    )
-    logging.info(f"Serialized joiner")
 
+    if fuse:
+        onnx_joiner = FusedDecoderJoiner(model.decoder, model.joiner)
+        onnx_joiner.eval()
+
+        torch.onnx.export(
+            onnx_joiner,  # use torch.jit.trace() internally
+            (encoder_out, context),
+            joiner_b,
+            verbose=False,
+            opset_version=opset_version,
+            input_names=["encoder_out", "context"],
+            output_names=["logits"],
+            dynamic_axes={"encoder_out": {0: "N"}, "context": {0: "N"}, "logits": {0: "N"}}
+        )
+        logging.info(f"Serialized fused decoder and joiner")
+    else:
+        decoder_out = onnx_decoder(context)
+
+        project_input = False
+
+        torch.onnx.export(
+            model.joiner,  # use torch.jit.trace() internally
+            (encoder_out, decoder_out, project_input),
+            joiner_b,
+            verbose=False,
+            opset_version=opset_version,
+            input_names=["encoder_out", "decoder_out"],
+            output_names=["logits"],
+            dynamic_axes={"encoder_out": {0: "N"}, "decoder_out": {0: "N"}, "logits": {0: "N"}}
+        )
+        logging.info(f"Serialized joiner")
+
+    precision = PRECISION_FP32
+    if quantize:
+        encoder_b = quantize_network(encoder_b)
+        joiner_b = quantize_network(joiner_b)
+        precision = PRECISION_INT8
+        logging.info(f"Quantized encoder and joiner")
 
     SAMPLERATE = 16000
     SEGMENT_STEP = 4
@@ -341,7 +472,15 @@ def export_model_onnx(model: nn.Module, sp, opset_version: int = 11) -> Tuple[By
     MEL_HIGH = 0
     SNIP_EDGES = False
 
-    params_b.write(b"PARAMS\0\0")
+    # Version 2 only adds max_encoder_segments, so only models that need it
+    # are written with it and the rest still load with older versions
+    PARAMS_VERSION = 2 if dynamic_time else 1
+
+    # The library caps this at 16
+    MAX_ENCODER_SEGMENTS = 16
+
+    params_b.write(b"PARAMS")
+    params_b.write(struct.pack("<H", PARAMS_VERSION))
     params_b.write(struct.pack("<i", N))
     params_b.write(struct.pack("<i", SEGMENT_SIZE))
     params_b.write(struct.pack("<i", SEGMENT_STEP))
@@ -357,6 +496,9 @@ def export_model_onnx(model: nn.Module, sp, opset_version: int = 11) -> Tuple[By
 
     params_b.write(struct.pack("<i", sp.get_piece_size()))
     params_b.write(struct.pack("<i", sp.piece_to_id("<blk>")))
+    params_b.write(struct.pack("<i", precision))
+    if PARAMS_VERSION >= 2:
+        params_b.write(struct.pack("<i", MAX_ENCODER_SEGMENTS))
 
     # write sentence pieces
     print("write ",sp.get_piece_size(), " pieces")
@@ -368,7 +510,10 @@ def export_model_onnx(model: nn.Module, sp, opset_version: int = 11) -> Tuple[By
 
     logging.info(f"Serialized params")
 
-    return (encoder_b, decoder_b, joiner_b, params_b)
+    if fuse:
+        return ([encoder_b, joiner_b], params_b)
+    else:
+        return ([encoder_b, decoder_b, joiner_b], params_b)
 
 
 def export_model(
@@ -377,15 +522,17 @@ def export_model(
     out_path: str,
     name: str = "Untitled",
     description: str = "No description",
-    language: str = "en-us"
+    language: str = "en-us",
+    quantize: bool = False,
+    fuse: bool = False,
+    dynamic_time: bool = False
 ) -> None:
-    encoder_out, decoder_out, joiner_out, params_out = export_model_onnx(model, sp)
+    networks, params_out = export_model_onnx(model, sp, quantize, fuse, dynamic_time)
 
-    NUM_NETWORKS = 3
-    networks = [encoder_out, decoder_out, joiner_out]
+    NUM_NETWORKS = len(networks)
 
     VERSION = 1
-    MODEL_KIND = 1
+    MODEL_KIND = MODEL_LSTM_TRANSDUCER_STATELESS_FUSED if fuse else MODEL_LSTM_TRANSDUCER_STATELESS
 
     header = BytesIO()
 
@@ -428,7 +575,7 @@ def export_model(
         f.write(header.getbuffer())
 
         network_offsets = [0] * NUM_NETWORKS
-        for i, network in enumerate([encoder_out, decoder_out, joiner_out]):
+        for i, network in enumerate(networks):
             network_offsets[i] = f.tell()
             f.write(network.getbuffer())
         
@@ -564,7 +711,7 @@ def main():
     convert_scaled_to_non_scaled(model, inplace=True, is_onnx=True)
     
     out_path = params.exp_dir / (slugify(params.name + "_" + params.language) + ".april")
-    export_model(model, sp, out_path, name=params.name, description=params.description, language=params.language)
+    export_model(model, sp, out_path, name=params.name, description=params.description, language=params.language, quantize=params.quantize, fuse=params.fuse_decoder_joiner, dynamic_time=params.dynamic_encoder_time)
 
     logging.info(f"Exported to {out_path}")
 
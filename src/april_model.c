@@ -14,11 +14,105 @@
  * along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 #include "common.h"
 #include "file/model_file.h"
 #include "april_model.h"
 #include "log.h"
 
+#ifndef USE_TINYCTHREAD
+#include <threads.h>
+#else
+#include "tinycthread/tinycthread.h"
+#endif
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(__WINDOWS__)
+#define resolve_path(path) _fullpath(NULL, path, 0)
+#else
+#define resolve_path(path) realpath(path, NULL)
+#endif
+
+#define FLOAT_T ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT
+#define INT64_T ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64
+
+static bool all_dims_known(const int64_t *dims, size_t count) {
+    for(size_t i=0; i<count; i++) {
+        if(dims[i] <= 0) return false;
+    }
+    return true;
+}
+
+// Quantization tools may leave symbolic (-1) dimensions in the graph
+// signatures. Fill in the ones that can be inferred from the params or from
+// the other networks. Returns false if any dimension remains unknown.
+static bool resolve_dynamic_dims(AprilASRModel aam) {
+    int64_t batch = aam->params.batch_size;
+
+    if(aam->x_dim[0] <= 0) aam->x_dim[0] = batch;
+    if(aam->x_dim[1] <= 0) aam->x_dim[1] = aam->params.segment_size;
+    if(aam->x_dim[2] <= 0) aam->x_dim[2] = aam->params.mel_features;
+
+    if(aam->h_dim[1] <= 0) aam->h_dim[1] = batch;
+    if(aam->c_dim[1] <= 0) aam->c_dim[1] = batch;
+
+    if(aam->eout_dim[0] <= 0) aam->eout_dim[0] = batch;
+    if(aam->eout_dim[1] <= 0) aam->eout_dim[1] = 1;
+    if(aam->dout_dim[0] <= 0) aam->dout_dim[0] = batch;
+    if(aam->dout_dim[1] <= 0) aam->dout_dim[1] = 1;
+    if(aam->eout_dim[2] <= 0) aam->eout_dim[2] = aam->dout_dim[2];
+    if(aam->dout_dim[2] <= 0) aam->dout_dim[2] = aam->eout_dim[2];
+
+    if(aam->context_dim[0] <= 0) aam->context_dim[0] = batch;
+
+    if(aam->logits_dim[0] <= 0) aam->logits_dim[0] = batch;
+    if(aam->logits_dim[1] <= 0) aam->logits_dim[1] = 1;
+    if(aam->logits_dim[2] <= 0) aam->logits_dim[2] = aam->params.token_count;
+
+    return all_dims_known(aam->x_dim, 3)
+        && all_dims_known(aam->h_dim, 3)
+        && all_dims_known(aam->c_dim, 3)
+        && all_dims_known(aam->eout_dim, 3)
+        && all_dims_known(aam->dout_dim, 3)
+        && all_dims_known(aam->context_dim, 2)
+        && all_dims_known(aam->logits_dim, 3);
+}
+
+// Encoders may be exported with a time axis longer than one segment, or a
+// dynamic one, to process several segments per run. Sets the segment range
+// and rewrites x_dim and eout_dim to the shapes of a single segment.
+// A dynamic time axis alone may just be left over from quantization, so it
+// only means several segments if the params say so. Otherwise it is left
+// for resolve_dynamic_dims to fill in.
+static bool resolve_encoder_segments(AprilASRModel aam) {
+    int64_t count = aam->params.segment_size;
+    int64_t step = aam->params.segment_step;
+
+    aam->encoder_min_segments = 1;
+    aam->encoder_max_segments = 1;
+
+    if((aam->x_dim[1] <= 0) && (aam->eout_dim[1] <= 0) && (aam->params.max_encoder_segments > 1)) {
+        aam->encoder_max_segments = aam->params.max_encoder_segments < MAX_ENCODER_SEGMENTS
+            ? aam->params.max_encoder_segments : MAX_ENCODER_SEGMENTS;
+    } else if(aam->x_dim[1] > count) {
+        if((step <= 0) || (((aam->x_dim[1] - count) % step) != 0)) return false;
+
+        int64_t segments = (aam->x_dim[1] - count) / step + 1;
+        if((aam->eout_dim[1] > 0) && (aam->eout_dim[1] != segments)) return false;
+        if(segments > MAX_ENCODER_SEGMENTS) return false;
+
+        aam->encoder_min_segments = segments;
+        aam->encoder_max_segments = segments;
+    } else {
+        return true;
+    }
+
+    aam->x_dim[1] = count;
+    aam->eout_dim[1] = 1;
+    return true;
+}
+
 #define ASSERT_OR_RETURN_NULL(expr) if(!(expr)) { LOG_WARNING("Model: assertion " #expr " failed, line %d", __LINE__); return NULL; }
 #define ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, expr) if(!(expr)) { LOG_WARNING("Model: assertion " #expr " failed, line %d", __LINE__); aam_free(aam); return NULL; }
 AprilASRModel aam_create_model(const char *model_path) {
@@ -33,7 +127,15 @@ AprilASRModel aam_create_model(const char *model_path) {
         return NULL;
     }
 
-    if((model_type(file) != MODEL_LSTM_TRANSDUCER_STATELESS) || (model_network_count(file) != 3)) {
+    ModelType type = model_type(file);
+    size_t expected_networks = 0;
+    if(type == MODEL_LSTM_TRANSDUCER_STATELESS) {
+        expected_networks = LSTM_TRANSDUCER_STATELESS_NETWORK_COUNT;
+    } else if(type == MODEL_LSTM_TRANSDUCER_STATELESS_FUSED) {
+        expected_networks = LSTM_TRANSDUCER_STATELESS_FUSED_NETWORK_COUNT;
+    }
+
+    if((expected_networks == 0) || (model_network_count(file) != expected_networks)) {
         LOG_WARNING("Model has unknown model type, or the wrong number of networks");
         free_model(file);
         return NULL;
@@ -41,7 +143,8 @@ AprilASRModel aam_create_model(const char *model_path) {
 
 
     AprilASRModel aam = (AprilASRModel)calloc(1, sizeof(struct AprilASRModel_i));
-    
+    aam->ref_count = 1;
+
     ORT_ABORT_ON_ERROR(g_ort->CreateEnv(ORT_LOGGING_LEVEL_WARNING, "aam", &aam->env));
     if(aam->env == NULL) {
         LOG_ERROR("Creating ORT environment failed!");
@@ -54,37 +157,89 @@ AprilASRModel aam_create_model(const char *model_path) {
     ORT_ABORT_ON_ERROR(g_ort->SetIntraOpNumThreads(aam->session_options, 1));
     ORT_ABORT_ON_ERROR(g_ort->SetInterOpNumThreads(aam->session_options, 1));
 
+    aam->fused = (type == MODEL_LSTM_TRANSDUCER_STATELESS_FUSED);
+
     load_network_from_model_file(aam->env, aam->session_options, file, 0, &aam->encoder);
-    load_network_from_model_file(aam->env, aam->session_options, file, 1, &aam->decoder);
-    load_network_from_model_file(aam->env, aam->session_options, file, 2, &aam->joiner);
+    if(aam->fused) {
+        load_network_from_model_file(aam->env, aam->session_options, file, 1, &aam->joiner);
+    } else {
+        load_network_from_model_file(aam->env, aam->session_options, file, 1, &aam->decoder);
+        load_network_from_model_file(aam->env, aam->session_options, file, 2, &aam->joiner);
+    }
 
-    model_read_params(file, &aam->params);
+    bool params_ok = model_read_params(file, &aam->params);
 
     transfer_strings_and_free_model(file, &aam->name, &aam->description, &aam->language);
 
+    ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, params_ok);
+
     ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, input_count(aam->encoder)  == 3);
     ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, output_count(aam->encoder) == 3);
 
-    ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, input_count(aam->decoder) == 1);
-    ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, output_count(aam->decoder) == 1);
-    
     ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, input_count(aam->joiner)  == 2);
     ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, output_count(aam->joiner) == 1);
 
+    if(!aam->fused) {
+        ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, input_count(aam->decoder) == 1);
+        ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, output_count(aam->decoder) == 1);
+    }
+
     input_dims(aam->encoder, 0, aam->x_dim, 3);
     input_dims(aam->encoder, 1, aam->h_dim, 3);
     input_dims(aam->encoder, 2, aam->c_dim, 3);
     output_dims(aam->encoder, 0, aam->eout_dim, 3);
 
-    input_dims(aam->decoder, 0, aam->context_dim, 2);
-    output_dims(aam->decoder, 0, aam->dout_dim, 3);
-
     output_dims(aam->joiner, 0, aam->logits_dim, 3);
 
+    int64_t joiner_eout_dim[3];
+    input_dims(aam->joiner, 0, joiner_eout_dim, 3);
+
+    if(aam->fused) {
+        input_dims(aam->joiner, 1, aam->context_dim, 2);
+
+        // There is no decoder output, the session still sizes its (unused)
+        // dout tensor from this
+        for(size_t i=0; i<3; i++) aam->dout_dim[i] = -1;
+
+        aam->batched_decoding = (aam->context_dim[0] <= 0)
+            && (joiner_eout_dim[0] <= 0) && (aam->logits_dim[0] <= 0);
+    } else {
+        input_dims(aam->decoder, 0, aam->context_dim, 2);
+        output_dims(aam->decoder, 0, aam->dout_dim, 3);
+
+        int64_t joiner_dout_dim[3];
+        input_dims(aam->joiner, 1, joiner_dout_dim, 3);
+
+        aam->batched_decoding = (aam->context_dim[0] <= 0) && (aam->dout_dim[0] <= 0)
+            && (joiner_eout_dim[0] <= 0) && (joiner_dout_dim[0] <= 0) && (aam->logits_dim[0] <= 0);
+    }
+
+    // Quantized networks must still take and return float tensors, the
+    // session allocates all of its tensors as float (context as int64)
+    for(size_t i=0; i<3; i++) {
+        ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, input_type(aam->encoder, i) == FLOAT_T);
+        ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, output_type(aam->encoder, i) == FLOAT_T);
+    }
+    if(aam->fused) {
+        ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, input_type(aam->joiner, 0) == FLOAT_T);
+        ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, input_type(aam->joiner, 1) == INT64_T);
+    } else {
+        ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, input_type(aam->decoder, 0) == INT64_T);
+        ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, output_type(aam->decoder, 0) == FLOAT_T);
+        ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, input_type(aam->joiner, 0) == FLOAT_T);
+        ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, input_type(aam->joiner, 1) == FLOAT_T);
+    }
+    ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, output_type(aam->joiner, 0) == FLOAT_T);
+
+    ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, resolve_encoder_segments(aam));
+    ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, resolve_dynamic_dims(aam));
+
     aam->fbank_opts.sample_freq        = aam->params.sample_rate;
     aam->fbank_opts.num_bins           = aam->params.mel_features;
     aam->fbank_opts.pull_segment_count = aam->params.segment_size;
     aam->fbank_opts.pull_segment_step  = aam->params.segment_step;
+    aam->fbank_opts.pull_min_segments  = aam->encoder_min_segments;
+    aam->fbank_opts.pull_max_segments  = aam->encoder_max_segments;
     aam->fbank_opts.frame_shift_ms     = aam->params.frame_shift_ms;
     aam->fbank_opts.frame_length_ms    = aam->params.frame_length_ms;
     aam->fbank_opts.round_pow2         = aam->params.round_pow2;
@@ -100,8 +255,17 @@ AprilASRModel aam_create_model(const char *model_path) {
     ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, aam->x_dim[1] == aam->fbank_opts.pull_segment_count);
     ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, aam->x_dim[2] == aam->fbank_opts.num_bins);
     ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, aam->logits_dim[2] == aam->params.token_count);
+    ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, aam->h_dim[0] == aam->c_dim[0]);
+    ASSERT_OR_FREE_AAM_AND_RETURN_NULL(aam, aam->eout_dim[2] == aam->dout_dim[2]);
 
-    LOG_INFO("aam: loaded model %s", aam->name);
+    LOG_INFO("aam: loaded model %s (%s%s)", aam->name,
+        aam->params.precision == APRIL_MODEL_PRECISION_INT8 ? "int8" : "fp32",
+        aam->fused ? ", fused decoder" : "");
+
+    if(aam->encoder_max_segments > 1) {
+        LOG_INFO("aam: encoder takes %zu to %zu segments per run",
+            aam->encoder_min_segments, aam->encoder_max_segments);
+    }
 
     return aam;
 }
@@ -114,9 +278,119 @@ size_t aam_get_sample_rate(AprilASRModel model) {
     return model->fbank_opts.sample_freq;
 }
 
+AprilModelPrecision aam_get_precision(AprilASRModel model) {
+    return model->params.precision;
+}
+
 
-void aam_free(AprilASRModel model) {
-    if(model == NULL) return;
+// Guards the reference counts and the list of shared models. Lookups and
+// releases both hold it, so a model whose count reached zero can't be
+// handed out again while it's being freed
+static bool g_registry_init = false;
+static mtx_t g_registry_mutex;
+static AprilASRModel g_shared_models = NULL;
+
+void aam_registry_init(void) {
+    if(g_registry_init) return;
+
+    if(mtx_init(&g_registry_mutex, mtx_plain) != thrd_success) {
+        LOG_ERROR("Failed to initialize model registry mutex");
+        return;
+    }
+
+    g_registry_init = true;
+}
+
+static void registry_lock(void) {
+    if(g_registry_init) mtx_lock(&g_registry_mutex);
+}
+
+static void registry_unlock(void) {
+    if(g_registry_init) mtx_unlock(&g_registry_mutex);
+}
+
+// Must be called with the registry locked
+static AprilASRModel registry_find(const char *shared_path) {
+    for(AprilASRModel model = g_shared_models; model != NULL; model = model->next_shared) {
+        if(strcmp(model->shared_path, shared_path) == 0) return model;
+    }
+
+    return NULL;
+}
+
+static void registry_remove(AprilASRModel model) {
+    AprilASRModel *link = &g_shared_models;
+    while(*link != NULL) {
+        if(*link == model) {
+            *link = model->next_shared;
+            return;
+        }
+
+        link = &(*link)->next_shared;
+    }
+}
+
+AprilASRModel aam_get_shared_model(const char *model_path) {
+    char *shared_path = resolve_path(model_path);
+    if(shared_path == NULL) {
+        LOG_ERROR("aam: could not resolve model path %s", model_path);
+        return NULL;
+    }
+
+    registry_lock();
+    AprilASRModel model = registry_find(shared_path);
+    if(model != NULL) model->ref_count++;
+    registry_unlock();
+
+    if(model != NULL) {
+        free(shared_path);
+        return model;
+    }
+
+    // Loaded without the lock, so loading one model doesn't hold up others
+    AprilASRModel loaded = aam_create_model(shared_path);
+    if(loaded == NULL) {
+        free(shared_path);
+        return NULL;
+    }
+
+    registry_lock();
+
+    // Another thread may have loaded the same file in the meantime
+    model = registry_find(shared_path);
+    if(model != NULL) {
+        model->ref_count++;
+    } else {
+        loaded->shared_path = shared_path;
+        loaded->next_shared = g_shared_models;
+        g_shared_models = loaded;
+        model = loaded;
+    }
+
+    registry_unlock();
+
+    if(model != loaded) {
+        free(shared_path);
+        aam_release(loaded);
+    } else {
+        LOG_INFO("aam: sharing model %s", shared_path);
+    }
+
+    return model;
+}
+
+AprilASRModel aam_retain(AprilASRModel model) {
+    if(model == NULL) return NULL;
+
+    registry_lock();
+    model->ref_count++;
+    registry_unlock();
+
+    return model;
+}
+
+static void aam_destroy(AprilASRModel model) {
+    free(model->shared_path);
 
     free(model->name);
     free(model->description);
@@ -125,10 +399,28 @@ void aam_free(AprilASRModel model) {
     free_params(&model->params);
 
     g_ort->ReleaseSession(model->joiner);
-    g_ort->ReleaseSession(model->decoder);
+    if(model->decoder != NULL) g_ort->ReleaseSession(model->decoder);
     g_ort->ReleaseSession(model->encoder);
     g_ort->ReleaseSessionOptions(model->session_options);
     g_ort->ReleaseEnv(model->env);
 
     free(model);
 }
+
+void aam_release(AprilASRModel model) {
+    if(model == NULL) return;
+
+    registry_lock();
+
+    assert(model->ref_count > 0);
+    bool last = (--model->ref_count) == 0;
+    if(last && (model->shared_path != NULL)) registry_remove(model);
+
+    registry_unlock();
+
+    if(last) aam_destroy(model);
+}
+
+void aam_free(AprilASRModel model) {
+    aam_release(model);
+}
@@ -22,6 +22,10 @@
 #include "april_api.h"
 #include "params.h"
 #include "fbank.h"
+// Upper limit of segments per encoder run for encoders with a dynamic time
+// axis
+#define MAX_ENCODER_SEGMENTS 16
+
 struct AprilASRModel_i {
     OrtEnv *env;
     OrtSessionOptions* session_options;
@@ -30,6 +34,11 @@ struct AprilASRModel_i {
     OrtSession* decoder;
     OrtSession* joiner;
 
+    // If set, the model has no separate decoder (decoder is NULL). The
+    // joiner network takes (encoder_out, context) and runs the decoder
+    // itself, so each decoding step is a single network run
+    bool fused;
+
     // The comment numbers are for reference only, it may differ
     // with different sized models.
     int64_t x_dim[3];       // (1, 9, 80)
@@ -40,12 +49,33 @@ struct AprilASRModel_i {
     int64_t context_dim[2]; // (1, 2)
     int64_t logits_dim[3];  // (1, 1, 500)
 
+    // x_dim and eout_dim above always describe a single segment. Encoders
+    // exported with a longer time axis take several segments per run,
+    // exactly encoder_min_segments of them if the axis is static, anywhere
+    // up to encoder_max_segments if it is dynamic. Both are 1 otherwise.
+    size_t encoder_min_segments;
+    size_t encoder_max_segments;
+
+    // If the decoder and joiner were exported with a dynamic batch axis,
+    // beam search can run all hypotheses in a single call
+    bool batched_decoding;
+
     FBankOptions fbank_opts;
     ModelParameters params;
 
     char *name;
     char *description;
     char *language;
+
+    // Held by the creator, aam_retain callers and every session. Guarded
+    // by the registry mutex
+    size_t ref_count;
+
+    // Set if the model is in the registry of shared models
+    char *shared_path;
+    struct AprilASRModel_i *next_shared;
 };
 
+void aam_registry_init(void);
+
 #endif
\ No newline at end of file
@@ -18,29 +18,65 @@
 #include "common.h"
 #include "log.h"
 #include "params.h"
+#include "logits.h"
 #include "april_session.h"
 
+#ifndef USE_TINYCTHREAD
+#include <threads.h>
+#else
+#include "tinycthread/tinycthread.h"
+#endif
+
+#ifdef _MSC_VER
+#define _Atomic volatile
+#endif
+
 void run_aas_callback(void *userdata, int flags);
+void run_aas_feature_callback(void *userdata, int flags);
+void aas_create_chunk_tensors(AprilASRSession aas);
+void aas_create_bindings(AprilASRSession aas);
 
-AprilASRSession aas_create_session(AprilASRModel model, AprilConfig config) {
-    AprilASRSession aas = (AprilASRSession)calloc(1, sizeof(struct AprilASRSession_i));
+bool aas_create_fallback(AprilASRSession aas, AprilConfig config);
+void aas_create_recorder(AprilASRSession aas, AprilConfig config);
+AprilASRSession aas_create_session_on(AprilASRModel model, AprilConfig config, bool is_fallback, const ThreadOptions *thread_options);
 
-    aas->sync = ((config.flags & APRIL_CONFIG_FLAG_ASYNC_RT_BIT) | (config.flags & APRIL_CONFIG_FLAG_ASYNC_NO_RT_BIT)) == 0;
-    aas->force_realtime = (config.flags & APRIL_CONFIG_FLAG_ASYNC_RT_BIT) != 0;
+// A fallback session is always synchronous, it runs on the thread of the
+// session that owns it
+AprilASRSession aas_create_session_ex(AprilASRModel model, AprilConfig config, bool is_fallback) {
+    ThreadOptions thread_options;
+    thread_options_from_config(&thread_options, &config);
+
+    return aas_create_session_on(model, config, is_fallback, &thread_options);
+}
+
+typedef struct SessionBuffersArgs {
+    AprilASRSession aas;
+    FBankOptions fbank_opts;
+} SessionBuffersArgs;
+
+static void aas_touch_tensorf(TensorF *tensor, const int64_t *shape) {
+    touch_pages(tensor->data, SHAPE_PRODUCT3(shape) * sizeof(float));
+}
 
-    FBankOptions fbank_opts = model->fbank_opts;
-    fbank_opts.use_sonic = aas->force_realtime;
+// Allocates and first touches the fbank and tensors, on the thread that
+// is going to use them
+static void aas_alloc_buffers(void *userdata) {
+    SessionBuffersArgs *args = (SessionBuffersArgs *)userdata;
+    AprilASRSession aas = args->aas;
+    AprilASRModel model = aas->model;
 
-    aas->model = model;
-    aas->fbank = make_fbank(fbank_opts);
+    aas->fbank = make_fbank(args->fbank_opts);
 
     ORT_ABORT_ON_ERROR(g_ort->CreateCpuMemoryInfo(OrtArenaAllocator, OrtMemTypeDefault, &aas->memory_info));
     OrtMemoryInfo *mi = aas->memory_info;
 
     aas->x = alloc_tensor3f(mi, model->x_dim);
+    aas_touch_tensorf(&aas->x, model->x_dim);
     for(int i=0; i<2; i++){
         aas->h[i] = alloc_tensor3f(mi, model->h_dim);
         aas->c[i] = alloc_tensor3f(mi, model->c_dim);
+        aas_touch_tensorf(&aas->h[i], model->h_dim);
+        aas_touch_tensorf(&aas->c[i], model->c_dim);
     }
 
     aas->eout = alloc_tensor3f(mi, model->eout_dim);
@@ -48,6 +84,42 @@ AprilASRSession aas_create_session(AprilASRModel model, AprilConfig config) {
 
     aas->context = alloc_tensor2i(mi, model->context_dim);
 
+    aas->logits = alloc_tensor3f(mi, model->logits_dim);
+    aas_touch_tensorf(&aas->logits, model->logits_dim);
+
+    if(model->encoder_max_segments > 1) aas_create_chunk_tensors(aas);
+    aas_create_bindings(aas);
+}
+
+AprilASRSession aas_create_session_on(AprilASRModel model, AprilConfig config, bool is_fallback, const ThreadOptions *thread_options) {
+    AprilASRSession aas = (AprilASRSession)calloc(1, sizeof(struct AprilASRSession_i));
+
+    aas->sync = is_fallback || ((config.flags & APRIL_CONFIG_FLAG_ASYNC_RT_BIT) | (config.flags & APRIL_CONFIG_FLAG_ASYNC_NO_RT_BIT)) == 0;
+    aas->force_realtime = (config.flags & APRIL_CONFIG_FLAG_ASYNC_RT_BIT) != 0;
+
+    SessionBuffersArgs buffers_args;
+    buffers_args.aas = aas;
+    buffers_args.fbank_opts = model->fbank_opts;
+    buffers_args.fbank_opts.use_sonic = aas->force_realtime;
+    buffers_args.fbank_opts.use_frame_dropping = aas->force_realtime && (g_client_version >= 2)
+        && (config.speedup_method == APRIL_SPEEDUP_DROP_FRAMES);
+
+    aas->model = aam_retain(model);
+
+    // An async session's buffers are allocated by its own thread, so that
+    // with affinity set they end up on the NUMA node of its CPUs
+    if(aas->sync) {
+        aas_alloc_buffers(&buffers_args);
+    } else {
+        aas->thread = pt_create_with_init(run_aas_callback, aas, aas_alloc_buffers, &buffers_args, thread_options);
+        if(aas->thread == NULL) {
+            LOG_ERROR("Failed to start the session thread");
+            aam_release(aas->model);
+            free(aas);
+            return NULL;
+        }
+    }
+
     if(model->context_dim[0] != 1) {
         LOG_ERROR("Currently, only batch size 1 is supported. Got batch size %ld", model->context_dim[0]);
         aas_free(aas);
@@ -55,8 +127,6 @@ AprilASRSession aas_create_session(AprilASRModel model, AprilConfig config) {
     }
     aas->context_size = model->context_dim[1];
 
-    aas->logits = alloc_tensor3f(mi, model->logits_dim);
-
     aas->dout_init = false;
     aas->hc_use_0 = false;
     aas->active_token_head = 0;
@@ -76,6 +146,29 @@ AprilASRSession aas_create_session(AprilASRModel model, AprilConfig config) {
 
     aas->handler = config.handler;
     aas->userdata = config.userdata;
+    aas->best_effort = (g_client_version >= 2) && (config.priority_class == APRIL_PRIORITY_BEST_EFFORT);
+
+    if(!is_fallback) {
+        aas->latency = lt_create();
+        if(aas->latency == NULL) {
+            aas_free(aas);
+            return NULL;
+        }
+
+        aas_create_recorder(aas, config);
+    }
+
+    if((g_client_version >= 2) && !is_fallback) {
+        size_t stride_ms = fbank_get_segments_stride_ms(aas->fbank);
+
+        if(config.feature_dump_path != NULL) {
+            aas->feature_dump = dump_create(config.feature_dump_path, DUMP_KIND_FEATURES, SHAPE_PRODUCT3(model->x_dim), stride_ms);
+        }
+
+        if(config.encoder_dump_path != NULL) {
+            aas->encoder_dump = dump_create(config.encoder_dump_path, DUMP_KIND_ENCODER_OUT, model->eout_dim[2], stride_ms);
+        }
+    }
     aas->speed_needed = 1.0;
 
     if(aas->handler == NULL) {
@@ -84,24 +177,198 @@ AprilASRSession aas_create_session(AprilASRModel model, AprilConfig config) {
         return NULL;
     }
 
+    if((g_client_version >= 2) && (config.decoding_mode == APRIL_DECODING_MODIFIED_BEAM_SEARCH)) {
+        aas->beam = beam_create(aas, config.beam_width);
+        if(aas->beam == NULL) {
+            aas_free(aas);
+            return NULL;
+        }
+    }
+
+    if((!is_fallback) && (g_client_version >= 2) && (config.fallback_model != NULL)) {
+        if(!aas_create_fallback(aas, config)) {
+            aas_free(aas);
+            return NULL;
+        }
+    }
+
     if(!aas->sync){
         aas->provider = ap_create();
-        aas->thread = pt_create(run_aas_callback, aas);
+
+        if((config.flags & APRIL_CONFIG_FLAG_PIPELINED_BIT) && (aas->fallback != NULL)) {
+            LOG_WARNING("Pipelining is not supported with a fallback model, ignoring");
+        } else if(config.flags & APRIL_CONFIG_FLAG_PIPELINED_BIT) {
+            aas->segments = sq_create(SHAPE_PRODUCT3(model->x_dim), SEGMENT_QUEUE_CAPACITY);
+        }
+
+        if(aas->segments != NULL) {
+            aas->feature_thread = pt_create(run_aas_feature_callback, aas, thread_options);
+        }
     }
 
     return aas;
 }
 
+AprilASRSession aas_create_session(AprilASRModel model, AprilConfig config) {
+    return aas_create_session_ex(model, config, false);
+}
+
+static _Atomic size_t g_recording_counter = 0;
+
+void aas_create_recorder(AprilASRSession aas, AprilConfig config) {
+    const char *path = (g_client_version >= 2) ? config.recording_path : NULL;
+
+    char env_path[1024];
+    const char *record_dir = getenv("APRIL_RECORD_DIR");
+    if((path == NULL) && (record_dir != NULL)) {
+        snprintf(env_path, sizeof(env_path), "%s/aas_%lld_%zu.rec",
+            record_dir, (long long)time(NULL), g_recording_counter++);
+        path = env_path;
+    }
+
+    if(path == NULL) return;
+
+    aas->recorder = rec_create(path, aas->model->fbank_opts.sample_freq, config.flags);
+}
+
+bool aas_create_fallback(AprilASRSession aas, AprilConfig config) {
+    AprilASRModel primary = aas->model;
+    AprilASRModel fallback = config.fallback_model;
+
+    if((primary->params.token_count != fallback->params.token_count)
+        || (primary->fbank_opts.sample_freq != fallback->fbank_opts.sample_freq)
+        || (primary->fbank_opts.num_bins != fallback->fbank_opts.num_bins)
+        || (primary->fbank_opts.pull_segment_step != fallback->fbank_opts.pull_segment_step)
+        || (primary->fbank_opts.frame_shift_ms != fallback->fbank_opts.frame_shift_ms)
+    ) {
+        LOG_ERROR("The fallback model must use the same tokens and features as the main model");
+        return false;
+    }
+
+    config.fallback_model = NULL;
+    aas->fallback = aas_create_session_ex(fallback, config, true);
+    if(aas->fallback == NULL) return false;
+
+    aas->fallback->latency = aas->latency;
+
+    aas->fallback_threshold = config.fallback_threshold > 0.0f ? config.fallback_threshold : DEFAULT_FALLBACK_THRESHOLD;
+    return true;
+}
+
+// Switches between the main and the fallback model if needed. Only called
+// between chunks of audio, and only switches once the current one has
+// emitted silence
+void aas_update_tier(AprilASRSession aas) {
+    AprilASRSession active = aas->use_fallback ? aas->fallback : aas;
+    if(!active->emitted_silence) return;
+
+    bool switch_tier;
+    if(!aas->use_fallback) {
+        switch_tier = aas->speed_needed > aas->fallback_threshold;
+    } else {
+        // The main model's speed can't be measured while it isn't running,
+        // so go back only once the fallback has plenty of headroom
+        size_t fallback_ms = active->current_time_ms - aas->fallback_since_ms;
+        switch_tier = (fallback_ms >= FALLBACK_MIN_DURATION_MS)
+            && (active->speed_needed < (aas->fallback_threshold / 2.0));
+    }
+
+    if(!switch_tier) return;
+
+    AprilASRSession next = aas->use_fallback ? aas : aas->fallback;
+
+    // Keep token timestamps continuous across both models
+    next->current_time_ms = active->current_time_ms;
+    next->last_emission_time_ms = active->last_emission_time_ms;
+    next->speed_needed = 1.0;
+    next->time_since_update_speed = 0;
+
+    aas->use_fallback = !aas->use_fallback;
+    aas->fallback_since_ms = active->current_time_ms;
+
+    LOG_INFO("Switched to the %s model at %zu ms, speed needed %.2f",
+        aas->use_fallback ? "fallback" : "main", active->current_time_ms, active->speed_needed);
+}
+
 float aas_realtime_get_speedup(AprilASRSession session) {
+    if(session->use_fallback) session = session->fallback;
+
     return session->force_realtime ? (float)session->speed_needed : 1.0f;
 }
 
+size_t aas_get_queued_ms(AprilASRSession session) {
+    if(session->sync) return 0;
+
+    size_t queued_ms = ap_queued(session->provider) * 1000 / session->model->fbank_opts.sample_freq;
+
+    if(session->segments != NULL) {
+        queued_ms += sq_count(session->segments) * fbank_get_segments_stride_ms(session->fbank);
+    }
+
+    return queued_ms;
+}
+
+size_t aas_get_processing_lag_ms(AprilASRSession session) {
+    size_t queued_ms = aas_get_queued_ms(session);
+    if(session->use_fallback) session = session->fallback;
+
+    // speed_needed includes a 10% margin, see aas_infer
+    return (size_t)((double)queued_ms * session->speed_needed / 1.1);
+}
+
+void aas_get_model_usage_ms(AprilASRSession session, size_t *primary_ms, size_t *fallback_ms) {
+    size_t sample_rate = session->model->fbank_opts.sample_freq;
+
+    if(primary_ms != NULL) *primary_ms = session->tier_samples[0] * 1000 / sample_rate;
+    if(fallback_ms != NULL) *fallback_ms = session->tier_samples[1] * 1000 / sample_rate;
+}
+
+void aas_get_emission_latency(AprilASRSession session, AprilLatencyStats *stats) {
+    lt_get_stats(session->latency, stats);
+}
+
+uint64_t aas_get_emission_latency_percentile_us(AprilASRSession session, double percentile) {
+    return lt_get_percentile_us(session->latency, percentile);
+}
+
+void aas_reset_emission_latency(AprilASRSession session) {
+    lt_reset(session->latency);
+}
+
 void aas_free(AprilASRSession session) {
     if(session == NULL) return;
 
+    // The feature thread may be waiting on the inference thread to make
+    // room in the queue, so it must stop first
+    pt_free(session->feature_thread);
     pt_free(session->thread);
+    sq_free(session->segments);
     ap_free(session->provider);
 
+    if(session->fallback != NULL) session->fallback->latency = NULL;
+    aas_free(session->fallback);
+
+    beam_free(session->beam);
+
+    dump_free(session->encoder_dump);
+    dump_free(session->feature_dump);
+    rec_free(session->recorder);
+    lt_free(session->latency);
+
+    free_io_binding(&session->joiner_binding);
+    free_io_binding(&session->decoder_binding);
+    free_io_binding(&session->encoder_binding[1]);
+    free_io_binding(&session->encoder_binding[0]);
+
+    for(int i=0; i<MAX_ENCODER_SEGMENTS; i++) {
+        free_io_binding(&session->chunk_binding[0][i]);
+        free_io_binding(&session->chunk_binding[1][i]);
+        if(session->chunk_eout[i] != NULL) g_ort->ReleaseValue(session->chunk_eout[i]);
+        if(session->chunk_x[i] != NULL) g_ort->ReleaseValue(session->chunk_x[i]);
+    }
+    free(session->chunk_eout_data);
+    free(session->chunk_x_data);
+
     free_tensorf(&session->logits);
     free_tensori(&session->context);
     free_tensorf(&session->eout);
@@ -115,6 +382,8 @@ void aas_free(AprilASRSession session) {
     g_ort->ReleaseMemoryInfo(session->memory_info);
     free_fbank(session->fbank);
 
+    aam_release(session->model);
+
     free(session);
 }
 
@@ -127,55 +396,125 @@ const char* decoder_output_names[] = {"decoder_out"};
 const char* joiner_input_names[] = {"encoder_out", "decoder_out"};
 const char* joiner_output_names[] = {"logits"};
 
-// Runs encoder on current data in aas->x
-void aas_run_encoder(AprilASRSession aas){
-    aas->hc_use_0 = !aas->hc_use_0;
-    const OrtValue *inputs[] = {
-        aas->x.tensor,
-        aas->h[aas->hc_use_0 ? 0 : 1].tensor,
-        aas->c[aas->hc_use_0 ? 0 : 1].tensor
-    };
+const char* fused_joiner_input_names[] = {"encoder_out", "context"};
 
-    OrtValue *outputs[] = {
-        aas->eout.tensor,
-        aas->h[aas->hc_use_0 ? 1 : 0].tensor,
-        aas->c[aas->hc_use_0 ? 1 : 0].tensor
-    };
+void aas_create_chunk_tensors(AprilASRSession aas) {
+    AprilASRModel model = aas->model;
+    size_t max_segments = model->encoder_max_segments;
+    int64_t step = model->params.segment_step;
 
-    ORT_ABORT_ON_ERROR(g_ort->Run(aas->model->encoder, NULL,
-                                    encoder_input_names, inputs, 3,
-                                    encoder_output_names, 3, outputs));
+    int64_t x_shape[3] = { model->x_dim[0], model->x_dim[1] + step * (max_segments - 1), model->x_dim[2] };
+    int64_t eout_shape[3] = { model->eout_dim[0], max_segments, model->eout_dim[2] };
+
+    aas->chunk_x_data = CALLOC_SHAPE3(x_shape, float);
+    aas->chunk_eout_data = CALLOC_SHAPE3(eout_shape, float);
+    touch_pages(aas->chunk_x_data, SHAPE_PRODUCT3(x_shape) * sizeof(float));
+    touch_pages(aas->chunk_eout_data, SHAPE_PRODUCT3(eout_shape) * sizeof(float));
+
+    for(size_t n=model->encoder_min_segments; n<=max_segments; n++) {
+        x_shape[1] = model->x_dim[1] + step * (n - 1);
+        eout_shape[1] = n;
+
+        CREATE_TENSOR3(aas->memory_info, aas->chunk_x_data, x_shape, float, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &aas->chunk_x[n - 1]);
+        CREATE_TENSOR3(aas->memory_info, aas->chunk_eout_data, eout_shape, float, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT, &aas->chunk_eout[n - 1]);
+    }
 }
 
-// Runs decoder on current data in aas->context
-void aas_run_decoder(AprilASRSession aas){
-    const OrtValue *inputs[] = {
-        aas->context.tensor
-    };
+void aas_create_bindings(AprilASRSession aas) {
+    AprilASRModel model = aas->model;
 
-    OrtValue *outputs[] = {
-        aas->dout.tensor
-    };
+    for(size_t n=1; n<=model->encoder_max_segments; n++){
+        if(aas->chunk_x[n - 1] == NULL) continue;
+
+        for(int i=0; i<2; i++){
+            const OrtValue *inputs[] = {
+                aas->chunk_x[n - 1],
+                aas->h[i].tensor,
+                aas->c[i].tensor
+            };
+
+            OrtValue *outputs[] = {
+                aas->chunk_eout[n - 1],
+                aas->h[1 - i].tensor,
+                aas->c[1 - i].tensor
+            };
 
-    ORT_ABORT_ON_ERROR(g_ort->Run(aas->model->decoder, NULL,
+            aas->chunk_binding[i][n - 1] = create_io_binding(model->encoder,
+                                            encoder_input_names, inputs, 3,
+                                            encoder_output_names, outputs, 3);
+        }
+    }
+
+    for(int i=0; i<2; i++){
+        const OrtValue *inputs[] = {
+            aas->x.tensor,
+            aas->h[i].tensor,
+            aas->c[i].tensor
+        };
+
+        OrtValue *outputs[] = {
+            aas->eout.tensor,
+            aas->h[1 - i].tensor,
+            aas->c[1 - i].tensor
+        };
+
+        aas->encoder_binding[i] = create_io_binding(model->encoder,
+                                    encoder_input_names, inputs, 3,
+                                    encoder_output_names, outputs, 3);
+    }
+
+    if(!model->fused) {
+        const OrtValue *inputs[] = { aas->context.tensor };
+        OrtValue *outputs[] = { aas->dout.tensor };
+
+        aas->decoder_binding = create_io_binding(model->decoder,
                                     decoder_input_names, inputs, 1,
-                                    decoder_output_names, 1, outputs));
-}
+                                    decoder_output_names, outputs, 1);
+    }
 
-// Runs joiner on current data in aas->eout and aas->dout
-void aas_run_joiner(AprilASRSession aas){
     const OrtValue *inputs[] = {
         aas->eout.tensor,
-        aas->dout.tensor
+        model->fused ? aas->context.tensor : aas->dout.tensor
     };
 
-    OrtValue *outputs[] = {
-        aas->logits.tensor
-    };
+    OrtValue *outputs[] = { aas->logits.tensor };
+
+    aas->joiner_binding = create_io_binding(model->joiner,
+                                model->fused ? fused_joiner_input_names : joiner_input_names, inputs, 2,
+                                joiner_output_names, outputs, 1);
+}
+
+// Runs encoder on current data in aas->x
+void aas_run_encoder(AprilASRSession aas){
+    aas->hc_use_0 = !aas->hc_use_0;
+
+    ORT_ABORT_ON_ERROR(g_ort->RunWithBinding(aas->model->encoder, NULL,
+                                    aas->encoder_binding[aas->hc_use_0 ? 0 : 1]));
+    aas->encoder_runs++;
+}
+
+// Runs encoder over `segments` segments in aas->chunk_x_data
+void aas_run_encoder_chunk(AprilASRSession aas, size_t segments){
+    aas->hc_use_0 = !aas->hc_use_0;
 
-    ORT_ABORT_ON_ERROR(g_ort->Run(aas->model->joiner, NULL,
-                                    joiner_input_names, inputs, 2,
-                                    joiner_output_names, 1, outputs));
+    ORT_ABORT_ON_ERROR(g_ort->RunWithBinding(aas->model->encoder, NULL,
+                                    aas->chunk_binding[aas->hc_use_0 ? 0 : 1][segments - 1]));
+    aas->encoder_runs++;
+}
+
+// Runs decoder on current data in aas->context
+void aas_run_decoder(AprilASRSession aas){
+    ORT_ABORT_ON_ERROR(g_ort->RunWithBinding(aas->model->decoder, NULL,
+                                    aas->decoder_binding));
+    aas->decoder_runs++;
+}
+
+// Runs joiner on current data in aas->eout and aas->dout, or on aas->eout
+// and aas->context if the model is fused
+void aas_run_joiner(AprilASRSession aas){
+    ORT_ABORT_ON_ERROR(g_ort->RunWithBinding(aas->model->joiner, NULL,
+                                    aas->joiner_binding));
+    aas->joiner_runs++;
 }
 
 void aas_update_context(AprilASRSession aas, int64_t new_token){
@@ -192,7 +531,8 @@ void aas_update_context(AprilASRSession aas, int64_t new_token){
         aas->context.data[last_idx] = new_token;
     }
 
-    aas_run_decoder(aas);
+    // A fused joiner reads the context directly on its next run
+    if(!aas->model->fused) aas_run_decoder(aas);
 }
 
 
@@ -248,6 +588,11 @@ void aas_finalize_previous_words(AprilASRSession aas, const AprilToken *new_toke
             &aas->active_tokens[start_of_word],
             sizeof(AprilToken) * (aas->active_token_head - start_of_word) // is this right? or off by one?
         );
+        memmove(
+            aas->active_token_ids,
+            &aas->active_token_ids[start_of_word],
+            sizeof(int) * (aas->active_token_head - start_of_word)
+        );
 
         // Update active_token_head
         aas->active_token_head -= start_of_word;
@@ -267,7 +612,7 @@ void aas_emit_silence(AprilASRSession aas) {
     }
 }
 
-bool aas_emit_token(AprilASRSession aas, AprilToken *new_token, bool force){
+bool aas_emit_token(AprilASRSession aas, AprilToken *new_token, int token_id, bool force){
     if(new_token != NULL) {
         if((!force) && (aas->last_handler_call_head == (aas->active_token_head + 1))
             && (aas->active_tokens[aas->active_token_head].token == new_token->token)
@@ -275,6 +620,7 @@ bool aas_emit_token(AprilASRSession aas, AprilToken *new_token, bool force){
             return false;
         }
 
+        aas->active_token_ids[aas->active_token_head] = token_id;
         aas->active_tokens[aas->active_token_head++] = *new_token;
     } else {
         if((!force) && (aas->last_handler_call_head == (aas->active_token_head))) {
@@ -308,16 +654,8 @@ bool aas_process_logits(AprilASRSession aas, float early_emit){
     size_t blank = params->blank_id;
     float *logits = aas->logits.data;
 
-    int max_idx = -1;
-    float max_val = -9999999999.0;
-    for(size_t i=0; i<(size_t)params->token_count; i++){
-        if(i == blank) continue;
-
-        if(logits[i] > max_val){
-            max_idx = i;
-            max_val = logits[i];
-        }
-    }
+    float max_val;
+    int max_idx = (int)logits_argmax(logits, params->token_count, blank, &max_val);
 
     bool was_context_cleared = aas->context.data[1] == aas->model->params.blank_id;
 
@@ -326,25 +664,28 @@ bool aas_process_logits(AprilASRSession aas, float early_emit){
     bool is_equal_to_previous = aas->context.data[1] == max_idx;
     if(is_equal_to_previous) early_emit = 0.0f;
 
+    // max_idx is only the blank if no other logit was usable, see
+    // logits_argmax
     float blank_val = logits[blank];
-    bool is_blank = (blank_val - early_emit) > max_val;
+    bool is_blank = (max_idx == (int)blank) || ((blank_val - early_emit) > max_val);
 
+    // The softmax normalizer is only computed when a token is actually
+    // reported, most frames are plain blanks
+    float overall_max = max_val > blank_val ? max_val : blank_val;
 
-    AprilToken token = { get_token(params, max_idx), max_val };
+    AprilToken token = { get_token(params, max_idx), 0.0f };
     token.time_ms = aas->current_time_ms;
 
-    // works for English and other latin languages, may need to do something
-    // different here for other languages like Chinese
-    if (token.token[0] == ' ') token.flags |= APRIL_TOKEN_FLAG_WORD_BOUNDARY_BIT;
+    uint8_t token_class = get_token_class(params, max_idx);
+    if(token_class & TOKEN_CLASS_WORD_BOUNDARY_BIT) token.flags |= APRIL_TOKEN_FLAG_WORD_BOUNDARY_BIT;
 
-    bool is_single_character = token.token[1] == 0;
-    bool is_end_of_sentence = is_single_character && ( (token.token[0] == '.') || (token.token[0] == '!') || (token.token[0] == '?') );
-    bool is_punctuation = is_end_of_sentence || (is_single_character && (token.token[0] == ','));
+    bool is_end_of_sentence = (token_class & TOKEN_CLASS_SENTENCE_END_BIT) != 0;
+    bool is_punctuation = (token_class & TOKEN_CLASS_PUNCTUATION_BIT) != 0;
 
     // Don't treat the "." in a number (like 10.0) as punctuation or end of sentence
     if(is_punctuation && (aas->active_token_head > 0)){
-        const char *last_token = aas->active_tokens[aas->active_token_head - 1].token;
-        if((last_token[0] >= '0') && (last_token[0] <= '9') && (token.token[0] == '.')){
+        int last_token_id = aas->active_token_ids[aas->active_token_head - 1];
+        if((get_token_class(params, last_token_id) & TOKEN_CLASS_LEADING_DIGIT_BIT) && (token.token[0] == '.')){
             is_end_of_sentence = false;
             is_punctuation = false;
         }
@@ -360,6 +701,7 @@ bool aas_process_logits(AprilASRSession aas, float early_emit){
     // If current token is non-blank, emit and return
     if(!is_blank) {
         aas->last_emission_time_ms = aas->current_time_ms;
+        token.logprob = max_val - logits_logsumexp(logits, params->token_count, overall_max);
 
         aas_update_context(aas, (int64_t)max_idx);
 
@@ -367,11 +709,10 @@ bool aas_process_logits(AprilASRSession aas, float early_emit){
 
         // Sentence boundary checks
         if((aas->active_token_head > 0) && ((token.flags & APRIL_TOKEN_FLAG_WORD_BOUNDARY_BIT) != 0)) {
-            const char *last_token = aas->active_tokens[aas->active_token_head - 1].token;
+            int last_token_id = aas->active_token_ids[aas->active_token_head - 1];
             int last_token_flags = aas->active_tokens[aas->active_token_head - 1].flags;
 
-            bool last_token_single_character = last_token[1] == 0;
-            bool last_token_end_of_sentence = last_token_single_character && ( (last_token[0] == '.') || (last_token[0] == '!') || (last_token[0] == '?') );
+            bool last_token_end_of_sentence = (get_token_class(params, last_token_id) & TOKEN_CLASS_SENTENCE_END_BIT) != 0;
 
             // If this token is a word boundary, and the last character was supposed to be
             // end of sentence, but wasn't treated as such because it came after a
@@ -395,7 +736,8 @@ bool aas_process_logits(AprilASRSession aas, float early_emit){
             aas->active_token_head = 0;
         }
 
-        aas_emit_token(aas, &token, true);
+        lt_emitted(aas->latency, 1);
+        aas_emit_token(aas, &token, max_idx, true);
 
         aas->emitted_silence = false;
     } else {
@@ -403,6 +745,7 @@ bool aas_process_logits(AprilASRSession aas, float early_emit){
 
         // If there's been silence for a while, forcibly reduce confidence to
         // kill stray prediction
+        float max_logit = max_val;
         max_val -= (float)(time_since_emission_ms)/3000.0f;
 
         // If current token is blank, but it's reasonably confident, emit
@@ -415,59 +758,176 @@ bool aas_process_logits(AprilASRSession aas, float early_emit){
             aas_clear_context(aas);
             aas_emit_silence(aas);
         } else if(reasonably_confident) {
+            token.logprob = max_logit - logits_logsumexp(logits, params->token_count, overall_max);
             token.logprob -= 8.0;
-            if(aas_emit_token(aas, &token, false)) {
+            if(aas_emit_token(aas, &token, max_idx, false)) {
                 assert(aas->active_token_head > 0);
                 aas->active_token_head--;
             }
         } else {
-            aas_emit_token(aas, NULL, false);
+            aas_emit_token(aas, NULL, -1, false);
         }
     }
 
     return is_blank;
 }
 
-bool aas_infer(AprilASRSession aas){
-    if(!aas->dout_init) {
+// Decodes the encoder output currently in aas->eout
+void aas_decode_frame(AprilASRSession aas){
+    if(aas->beam != NULL) {
+        beam_step(aas->beam);
+    } else {
+        float early_emit = 2.0f;
+        for(int i=0; i<3; i++){
+            early_emit -= 1.0f;
+            aas_run_joiner(aas);
+            if(aas_process_logits(aas, early_emit > 0.0f ? early_emit : 0.0f)) break;
+        }
+    }
+}
+
+// Pulls between min_segments and max_segments consecutive segments into
+// output as one block of frames, from the fbank or, if pipelined, from the
+// feature thread's queue. Returns the number pulled, 0 if too few are ready
+size_t aas_pull_segments(AprilASRSession aas, float *output, size_t min_segments, size_t max_segments){
+    SegmentQueue queue = aas->replay_segments != NULL ? aas->replay_segments : aas->segments;
+    if(queue == NULL) {
+        return fbank_pull_segments_n(aas->fbank, output, min_segments, max_segments);
+    }
+
+    size_t available = sq_count(queue);
+    if(available < min_segments) return 0;
+
+    size_t segments = available < max_segments ? available : max_segments;
+
+    // Consecutive segments overlap, so after the first one only the frames
+    // past the overlap are copied
+    size_t bins = aas->model->fbank_opts.num_bins;
+    size_t count = aas->model->fbank_opts.pull_segment_count;
+    size_t step = aas->model->fbank_opts.pull_segment_step;
+    for(size_t i=0; i<segments; i++){
+        const float *segment = sq_read_begin(queue);
+        assert(segment != NULL);
+
+        if(i == 0) {
+            memcpy(output, segment, count * bins * sizeof(float));
+        } else {
+            memcpy(&output[(count + step * (i - 1)) * bins], &segment[(count - step) * bins], step * bins * sizeof(float));
+        }
+
+        sq_read_finish(queue);
+    }
+
+    return segments;
+}
+
+// Realtime work is due one segment after its oldest queued audio arrived,
+// estimated from how much audio is waiting
+uint64_t aas_get_deadline_ms(AprilASRSession aas, size_t stride_ms){
+    uint64_t now = sched_now_ms();
+    if(aas->best_effort) return now + BEST_EFFORT_DEADLINE_MS;
+
+    size_t queued_ms = aas_get_queued_ms(aas);
+    return now + stride_ms - (queued_ms < now ? queued_ms : now);
+}
+
+void aas_init_decoder(AprilASRSession aas){
+    if((!aas->dout_init) && (aas->beam == NULL)) {
         for(size_t i=0; i<aas->context_size; i++) {
             aas_update_context(aas, aas->model->params.blank_id);
         }
 
         aas->dout_init = true;
     }
+}
 
-    bool any_inferred = false;
-    while(fbank_pull_segments( aas->fbank, aas->x.data, sizeof(float)*SHAPE_PRODUCT3(aas->model->x_dim) )){
-        size_t stride_ms = fbank_get_segments_stride_ms(aas->fbank);
-        aas->current_time_ms += stride_ms;
+// The fbank speed, as seen by the thread running inference
+static double aas_get_speed(AprilASRSession aas){
+    return aas->segments != NULL ? sq_get_speed(aas->segments) : fbank_get_speed(aas->fbank);
+}
+
+// Decodes the encoder output frame in eout
+void aas_decode_eout(AprilASRSession aas, size_t stride_ms){
+    if(aas->encoder_dump != NULL) dump_write(aas->encoder_dump, aas->eout.data);
 
+    aas->current_time_ms += stride_ms;
+
+    // Sped up audio covers more of the fed audio per frame
+    double sample_rate = (double)aas->model->fbank_opts.sample_freq;
+    lt_advance(aas->latency, (double)stride_ms * aas_get_speed(aas) * sample_rate / 1000.0);
+
+    aas_decode_frame(aas);
+}
+
+// A chunked encoder waits until it has a full chunk, the segments trickle
+// in a few at a time. The rest go in a smaller chunk when flushing
+static size_t aas_get_min_segments(AprilASRSession aas){
+    AprilASRModel model = aas->model;
+
+    bool draining = (aas->segments != NULL) ? sq_flush_queued(aas->segments) : aas->draining;
+    return draining ? model->encoder_min_segments : model->encoder_max_segments;
+}
+
+bool aas_infer(AprilASRSession aas){
+    aas_init_decoder(aas);
+
+    AprilASRModel model = aas->model;
+    bool chunked = model->encoder_max_segments > 1;
+    float *x = chunked ? aas->chunk_x_data : aas->x.data;
+    size_t stride_ms = fbank_get_segments_stride_ms(aas->fbank);
+
+    bool any_inferred = false;
+    for(;;){
         clock_t clock_start = clock();
 
-        aas_run_encoder(aas);
+        size_t segments = aas_pull_segments(aas, x, aas_get_min_segments(aas), model->encoder_max_segments);
+        if(segments == 0) break;
 
-        float early_emit = 2.0f;
-        for(int i=0; i<3; i++){
-            early_emit -= 1.0f;
-            aas_run_joiner(aas);
-            if(aas_process_logits(aas, early_emit > 0.0f ? early_emit : 0.0f)) break;
+        if(aas->feature_dump != NULL) {
+            // Segment i of the block starts i steps in
+            size_t offset = model->fbank_opts.pull_segment_step * model->fbank_opts.num_bins;
+            for(size_t i=0; i<segments; i++) dump_write(aas->feature_dump, &x[i * offset]);
+        }
+
+        sched_acquire(aas_get_deadline_ms(aas, stride_ms));
+
+        if(chunked) aas_run_encoder_chunk(aas, segments);
+        else aas_run_encoder(aas);
+
+        // Decoding calls the handler, which may feed another synchronous
+        // session and would deadlock if this still held the only slot
+        sched_release();
+
+        if(chunked) {
+            size_t frame_size = model->eout_dim[2];
+            for(size_t i=0; i<segments; i++){
+                memcpy(aas->eout.data, &aas->chunk_eout_data[i * frame_size], frame_size * sizeof(float));
+                aas_decode_eout(aas, stride_ms);
+            }
+        } else {
+            aas_decode_eout(aas, stride_ms);
         }
 
         clock_t clock_end = clock();
 
         double time_used_ms = ((double)(clock_end - clock_start) * 1000.0) / ((double)CLOCKS_PER_SEC);
-        double stride_ms_d = (double)stride_ms;
+        double stride_ms_d = (double)(stride_ms * segments);
 
         double speed_needed = (time_used_ms * 1.1) / stride_ms_d;
         aas->speed_needed = ((aas->speed_needed * 9.0) + speed_needed)/10.0;
 
-        aas->time_since_update_speed += stride_ms;
+        aas->time_since_update_speed += stride_ms * segments;
 
         any_inferred = true;
     }
 
     if(aas->force_realtime && (aas->time_since_update_speed > 2000)) {
-        fbank_set_speed(aas->fbank, aas->speed_needed > 1.0 ? aas->speed_needed : 1.0);
+        double speed = aas->speed_needed > 1.0 ? aas->speed_needed : 1.0;
+
+        // If pipelined, the fbank belongs to the feature thread, which
+        // picks this up in _aas_feed_pcm16
+        if(aas->segments != NULL) sq_set_speed(aas->segments, speed);
+        else fbank_set_speed(aas->fbank, speed);
 
         aas->time_since_update_speed = 0;
     }
@@ -475,12 +935,53 @@ bool aas_infer(AprilASRSession aas){
     return any_inferred;
 }
 
+// Inference is behind, let it catch up. The audio provider keeps buffering
+// in the meantime
+static void aas_wait_for_inference(AprilASRSession aas){
+    pt_raise(aas->thread, PT_FLAG_AUDIO);
+    sq_wait_for_space(aas->segments);
+}
+
+// Called after new audio reached the fbank. Runs inference right away, or
+// if pipelined, moves the new segments to the queue and wakes up the
+// inference thread
+void aas_process_features(AprilASRSession aas){
+    if(aas->segments == NULL) {
+        aas_infer(aas);
+        return;
+    }
+
+    size_t segment_bytes = sizeof(float) * SHAPE_PRODUCT3(aas->model->x_dim);
+
+    bool any_queued = false;
+    for(;;){
+        float *slot = sq_write_begin(aas->segments);
+        if(slot == NULL) {
+            aas_wait_for_inference(aas);
+            continue;
+        }
+
+        if(!fbank_pull_segments(aas->fbank, slot, segment_bytes)) break;
+
+        sq_write_finish(aas->segments);
+        any_queued = true;
+    }
+
+    if(any_queued) pt_raise(aas->thread, PT_FLAG_AUDIO);
+}
+
 void _aas_feed_pcm16(AprilASRSession session, short *pcm16, size_t short_count);
 void aas_feed_pcm16(AprilASRSession session, short *pcm16, size_t short_count) {
-    if(session->sync) return _aas_feed_pcm16(session, pcm16, short_count);
+    if(session->recorder != NULL) rec_feed(session->recorder, pcm16, short_count);
+
+    if(session->sync) {
+        lt_feed(session->latency, short_count);
+        return _aas_feed_pcm16(session, pcm16, short_count);
+    }
 
     bool success = ap_push_audio(session->provider, pcm16, short_count);
-    pt_raise(session->thread, PT_FLAG_AUDIO);
+    if(success) lt_feed(session->latency, short_count);
+    pt_raise(session->feature_thread != NULL ? session->feature_thread : session->thread, PT_FLAG_AUDIO);
 
     if(!success){
         session->handler(
@@ -492,22 +993,69 @@ void aas_feed_pcm16(AprilASRSession session, short *pcm16, size_t short_count) {
     }
 }
 
+size_t aas_feed_pcm16_ex(AprilASRSession session, short *pcm16, size_t short_count, size_t timeout_ms) {
+    if(session->sync) {
+        if(session->recorder != NULL) rec_feed(session->recorder, pcm16, short_count);
 
-#ifdef APRIL_DEBUG_SAVE_AUDIO
-FILE *fd = NULL;
-#endif
+        lt_feed(session->latency, short_count);
+        _aas_feed_pcm16(session, pcm16, short_count);
+        return short_count;
+    }
+
+    ProcThread thread = session->feature_thread != NULL ? session->feature_thread : session->thread;
+
+    // Recorded as fed when the call was made, not when it returned
+    uint64_t entry_us = session->recorder != NULL ? rec_now_us() : 0;
+
+    // Saturated, so that SIZE_MAX blocks until everything is accepted
+    uint64_t now_ms = sched_now_ms();
+    uint64_t deadline_ms = ((uint64_t)timeout_ms > (UINT64_MAX - now_ms)) ? UINT64_MAX : (now_ms + timeout_ms);
+    size_t accepted = 0;
+    for(;;) {
+        size_t pushed = ap_push_audio_partial(session->provider, &pcm16[accepted], short_count - accepted);
+        lt_feed(session->latency, pushed);
+        accepted += pushed;
+
+        pt_raise(thread, PT_FLAG_AUDIO);
+
+        now_ms = sched_now_ms();
+        if((accepted == short_count) || (now_ms >= deadline_ms)) break;
+
+        uint64_t remaining_ms = deadline_ms - now_ms;
+        ap_wait_for_room(session->provider, remaining_ms > SIZE_MAX ? SIZE_MAX : (size_t)remaining_ms);
+    }
+
+    // Only what was accepted, rejected audio is fed again by the caller
+    if((session->recorder != NULL) && (accepted > 0)) rec_feed_at(session->recorder, pcm16, accepted, entry_us);
+
+    return accepted;
+}
 
 #define SEGSIZE 3200 //TODO
-void _aas_feed_pcm16(AprilASRSession session, short *pcm16, size_t short_count) {
-#ifdef APRIL_DEBUG_SAVE_AUDIO
-    if(fd == NULL) fd = fopen("/tmp/aas_debug.bin", "w");
-#endif
 
-    assert(session->fbank != NULL);
+// Picks the session whose fbank takes the next count samples, the fallback
+// if it is in use, and readies it for them
+static AprilASRSession aas_begin_feed(AprilASRSession session, size_t count) {
+    session->was_flushed = false;
+
+    if(session->fallback != NULL) {
+        aas_update_tier(session);
+        session->tier_samples[session->use_fallback ? 1 : 0] += count;
+
+        if(session->use_fallback) return aas_begin_feed(session->fallback, count);
+    }
+
+    if(session->segments != NULL) fbank_set_speed(session->fbank, sq_get_speed(session->segments));
+
+    return session;
+}
+
+void _aas_feed_pcm16(AprilASRSession session, short *pcm16, size_t short_count) {
     assert(session != NULL);
     assert(pcm16 != NULL);
 
-    session->was_flushed = false;
+    session = aas_begin_feed(session, short_count);
+    assert(session->fbank != NULL);
 
     size_t head = 0;
     float wave[SEGSIZE];
@@ -521,52 +1069,247 @@ void _aas_feed_pcm16(AprilASRSession session, short *pcm16, size_t short_count)
             wave[i] = (float)pcm16[head + i] / 32768.0f;
         }
 
-#ifdef APRIL_DEBUG_SAVE_AUDIO
-        fwrite(wave, sizeof(float), remaining, fd);
-#endif
-
         fbank_accept_waveform(session->fbank, wave, remaining);
 
-        aas_infer(session);
+        aas_process_features(session);
 
         head += remaining;
     }
+}
 
-#ifdef APRIL_DEBUG_SAVE_AUDIO
-    fflush(fd);
-#endif
+static inline float aas_clip_sample(float sample) {
+    if(sample != sample) return 0.0f;
+    if(sample > 1.0f) return 1.0f;
+    if(sample < -1.0f) return -1.0f;
+    return sample;
+}
+
+static void aas_float_to_pcm16(const float *samples, short *pcm16, size_t count) {
+    for(size_t i=0; i<count; i++){
+        pcm16[i] = (short)(aas_clip_sample(samples[i]) * 32767.0f);
+    }
+}
+
+// The samples go to the fbank as they are, only clipped
+static void _aas_feed_float32(AprilASRSession session, const float *samples, size_t count) {
+    session = aas_begin_feed(session, count);
+    assert(session->fbank != NULL);
+
+    float wave[SEGSIZE];
+    for(size_t head = 0; head < count; head += SEGSIZE) {
+        size_t remaining = count - head;
+        if(remaining > SEGSIZE) remaining = SEGSIZE;
+
+        // Copied, as the fbank may change the wave in place
+        for(size_t i=0; i<remaining; i++){
+            wave[i] = aas_clip_sample(samples[head + i]);
+        }
+
+        fbank_accept_waveform(session->fbank, wave, remaining);
+
+        aas_process_features(session);
+    }
+}
+
+void aas_feed_float32(AprilASRSession session, const float *samples, size_t count) {
+    short pcm16[SEGSIZE];
+
+    // Recordings only hold PCM16
+    if(session->recorder != NULL) {
+        for(size_t head = 0; head < count; head += SEGSIZE) {
+            size_t remaining = count - head;
+            if(remaining > SEGSIZE) remaining = SEGSIZE;
+
+            aas_float_to_pcm16(&samples[head], pcm16, remaining);
+            rec_feed(session->recorder, pcm16, remaining);
+        }
+    }
+
+    if(session->sync) {
+        lt_feed(session->latency, count);
+        return _aas_feed_float32(session, samples, count);
+    }
+
+    // The audio provider holds PCM16. All of the buffer goes in or none of
+    // it does, so that a call is dropped and reported at most once
+    if(count > ap_room(session->provider)) {
+        LOG_WARNING("Can't keep up! Attempted to write %zu samples", count);
+        session->handler(
+            session->userdata,
+            APRIL_RESULT_ERROR_CANT_KEEP_UP,
+            0,
+            NULL
+        );
+        return;
+    }
+
+    for(size_t head = 0; head < count; head += SEGSIZE) {
+        size_t remaining = count - head;
+        if(remaining > SEGSIZE) remaining = SEGSIZE;
+
+        aas_float_to_pcm16(&samples[head], pcm16, remaining);
+        ap_push_audio(session->provider, pcm16, remaining);
+    }
+
+    lt_feed(session->latency, count);
+    pt_raise(session->feature_thread != NULL ? session->feature_thread : session->thread, PT_FLAG_AUDIO);
 }
 
 void _aas_flush(AprilASRSession session);
 void aas_flush(AprilASRSession session) {
+    if(session->recorder != NULL) rec_flush(session->recorder);
+    lt_flush(session->latency);
+
     if(session->sync) return _aas_flush(session);
 
-    pt_raise(session->thread, PT_FLAG_FLUSH);
+    pt_raise(session->feature_thread != NULL ? session->feature_thread : session->thread, PT_FLAG_FLUSH);
 }
 
+void aas_finish_flush(AprilASRSession session);
 void _aas_flush(AprilASRSession session) {
+    if(session->use_fallback) return _aas_flush(session->fallback);
+
     if(session->was_flushed) return;
 
     session->was_flushed = true;
+    session->draining = true;
 
     while(fbank_flush(session->fbank))
-        aas_infer(session);
+        aas_process_features(session);
 
     for(int i=0; i<2; i++)
         fbank_accept_waveform(session->fbank, NULL, SEGSIZE);
 
     while(fbank_flush(session->fbank))
-        aas_infer(session);
+        aas_process_features(session);
+
+    session->draining = false;
+
+    // The inference thread finishes up once it reaches the marker, so
+    // audio fed after this doesn't end up in the flushed utterance
+    if(session->segments != NULL) {
+        while(!sq_write_flush(session->segments))
+            aas_wait_for_inference(session);
+
+        pt_raise(session->thread, PT_FLAG_AUDIO);
+        return;
+    }
+
+    aas_finish_flush(session);
+}
 
-    aas_finalize_tokens(session);
-    aas_clear_context(session);
+// Emits the final result once all audio has gone through inference
+void aas_finish_flush(AprilASRSession session) {
+    if(session->feature_dump != NULL) dump_write_flush(session->feature_dump);
+    if(session->encoder_dump != NULL) dump_write_flush(session->encoder_dump);
+
+    if(session->beam != NULL) {
+        beam_finalize(session->beam);
+    } else {
+        aas_finalize_tokens(session);
+        aas_clear_context(session);
+    }
     aas_emit_silence(session);
+
+    lt_flushed(session->latency);
+}
+
+int aas_replay_dump(AprilASRSession session, const char *dump_path) {
+    if(!session->sync) {
+        LOG_ERROR("Dumps can only be replayed with synchronous sessions");
+        return 0;
+    }
+
+    DumpReader reader = dump_open(dump_path);
+    if(reader == NULL) return 0;
+
+    AprilASRModel model = session->model;
+    DumpKind kind = dump_get_kind(reader);
+    size_t record_floats = dump_get_record_floats(reader);
+    size_t stride_ms = dump_get_stride_ms(reader);
+
+    size_t expected_floats = 0;
+    if(kind == DUMP_KIND_FEATURES) expected_floats = SHAPE_PRODUCT3(model->x_dim);
+    else if(kind == DUMP_KIND_ENCODER_OUT) expected_floats = model->eout_dim[2];
+
+    if((expected_floats == 0) || (record_floats != expected_floats)
+        || (stride_ms != fbank_get_segments_stride_ms(session->fbank))
+    ) {
+        LOG_ERROR("Dump %s was not made with a compatible model", dump_path);
+        dump_close(reader);
+        return 0;
+    }
+
+    // Features go through the same path as when pipelined, so multi-segment
+    // encoders get their usual chunks
+    if(kind == DUMP_KIND_FEATURES) {
+        session->replay_segments = sq_create(record_floats, SEGMENT_QUEUE_CAPACITY);
+        if(session->replay_segments == NULL) {
+            dump_close(reader);
+            return 0;
+        }
+    }
+
+    aas_init_decoder(session);
+
+    float *record = (float *)calloc(record_floats, sizeof(float));
+    uint32_t flags;
+    while(dump_read(reader, record, &flags)) {
+        if(flags & DUMP_RECORD_FLUSH) {
+            session->draining = true;
+            aas_infer(session);
+            session->draining = false;
+
+            aas_finish_flush(session);
+            continue;
+        }
+
+        if(kind == DUMP_KIND_ENCODER_OUT) {
+            memcpy(session->eout.data, record, record_floats * sizeof(float));
+            aas_decode_eout(session, stride_ms);
+            continue;
+        }
+
+        float *slot = sq_write_begin(session->replay_segments);
+        if(slot == NULL) {
+            aas_infer(session);
+            slot = sq_write_begin(session->replay_segments);
+            assert(slot != NULL);
+        }
+
+        memcpy(slot, record, record_floats * sizeof(float));
+        sq_write_finish(session->replay_segments);
+    }
+
+    session->draining = true;
+    aas_infer(session);
+    session->draining = false;
+
+    free(record);
+    sq_free(session->replay_segments);
+    session->replay_segments = NULL;
+    dump_close(reader);
+
+    return 1;
 }
 
 
 void run_aas_callback(void *userdata, int flags) {
     AprilASRSession session = userdata;
 
+    // Pipelined, the audio has already been turned into queued segments.
+    // Any left before a flush marker are too few to infer, being padding.
+    // If more arrived since aas_infer returned, the flag raised with them
+    // brings this callback back
+    if(session->segments != NULL) {
+        for(;;){
+            aas_infer(session);
+            if(!sq_pop_flush(session->segments, session->model->encoder_min_segments)) return;
+
+            aas_finish_flush(session);
+        }
+    }
+
     if(flags & PT_FLAG_FLUSH) {
         _aas_flush(session);
     }
@@ -583,3 +1326,23 @@ void run_aas_callback(void *userdata, int flags) {
         }
     }
 }
+
+void run_aas_feature_callback(void *userdata, int flags) {
+    AprilASRSession session = userdata;
+
+    if(flags & PT_FLAG_AUDIO) {
+        for(;;){
+            size_t short_count = 3200;
+            short *shorts = ap_pull_audio(session->provider, &short_count);
+            if(short_count == 0) break;
+
+            _aas_feed_pcm16(session, shorts, short_count);
+
+            ap_pull_audio_finish(session->provider, short_count);
+        }
+    }
+
+    if(flags & PT_FLAG_FLUSH) {
+        _aas_flush(session);
+    }
+}
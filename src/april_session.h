@@ -26,9 +26,24 @@
 
 #include "audio_provider.h"
 #include "proc_thread.h"
+#include "segment_queue.h"
+#include "beam_search.h"
+#include "scheduler.h"
+#include "dump.h"
+#include "recorder.h"
+#include "latency.h"
 
 #define MAX_ACTIVE_TOKENS 72
 
+// Segments buffered between the feature and inference threads, 2.56s
+#define SEGMENT_QUEUE_CAPACITY 64
+
+#define DEFAULT_FALLBACK_THRESHOLD 0.9
+
+// Minimum audio processed by the fallback model before trying the main
+// model again, to avoid switching back and forth
+#define FALLBACK_MIN_DURATION_MS 10000
+
 struct AprilASRSession_i {
     AprilASRModel model;
     OnlineFBank fbank;
@@ -50,18 +65,46 @@ struct AprilASRSession_i {
 
     TensorF logits;
 
+    // Bound once at creation. The encoder has one binding per direction of
+    // the h/c ping-pong, indexed like the inputs (0 if hc_use_0)
+    OrtIoBinding *encoder_binding[2];
+    OrtIoBinding *decoder_binding;
+    OrtIoBinding *joiner_binding;
+
+    // Only used if the encoder takes several segments per run. The views
+    // and bindings are indexed by segment count - 1, each encoder output
+    // frame is copied to eout in turn for decoding
+    float *chunk_x_data;
+    float *chunk_eout_data;
+    OrtValue *chunk_x[MAX_ENCODER_SEGMENTS];
+    OrtValue *chunk_eout[MAX_ENCODER_SEGMENTS];
+    OrtIoBinding *chunk_binding[2][MAX_ENCODER_SEGMENTS];
+
+    // NULL when using greedy search
+    BeamSearch beam;
+
     AprilToken active_tokens[MAX_ACTIVE_TOKENS];
+    int active_token_ids[MAX_ACTIVE_TOKENS];
     size_t active_token_head;
     size_t last_handler_call_head;
 
     bool emitted_silence;
     bool was_flushed;
 
+    // Set while flushing or replaying the end of a dump, when no more
+    // segments are coming to fill up an encoder chunk
+    bool draining;
+
     bool sync;
     bool force_realtime;
     AudioProvider provider;
     ProcThread thread;
 
+    // Only if pipelined. The feature thread runs fbank and fills segments,
+    // the main thread runs inference on them
+    ProcThread feature_thread;
+    SegmentQueue segments;
+
     size_t current_time_ms;
     size_t last_emission_time_ms;
 
@@ -70,6 +113,48 @@ struct AprilASRSession_i {
 
     size_t time_since_update_speed;
     double speed_needed;
+
+    // Only if a fallback model was given. The fallback is a synchronous
+    // session of its own, fed instead of this one while use_fallback is set.
+    // Switching only happens after silence, so no utterance is split
+    AprilASRSession fallback;
+    bool use_fallback;
+    double fallback_threshold;
+    size_t fallback_since_ms;
+    size_t tier_samples[2];
+
+    bool best_effort;
+
+    // Only if dumping
+    DumpWriter feature_dump;
+    DumpWriter encoder_dump;
+
+    // Only while replaying a feature dump, holds the segments read from it
+    SegmentQueue replay_segments;
+
+    // Only if recording, sees the public calls before anything else
+    Recorder recorder;
+
+    // Owned by the main session, the fallback session shares it
+    LatencyTracker latency;
+
+    // Number of network runs so far. A fused decoder and joiner counts
+    // as a joiner run
+    size_t encoder_runs;
+    size_t decoder_runs;
+    size_t joiner_runs;
 };
 
+extern const char* encoder_input_names[];
+extern const char* encoder_output_names[];
+extern const char* decoder_input_names[];
+extern const char* decoder_output_names[];
+extern const char* joiner_input_names[];
+extern const char* joiner_output_names[];
+extern const char* fused_joiner_input_names[];
+
+void aas_finalize_tokens(AprilASRSession aas);
+void aas_emit_silence(AprilASRSession aas);
+bool aas_emit_token(AprilASRSession aas, AprilToken *new_token, int token_id, bool force);
+
 #endif
\ No newline at end of file
@@ -17,11 +17,18 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include "common.h"
 #include "log.h"
 #include "audio_provider.h"
 
+#ifndef USE_TINYCTHREAD
+#include <threads.h>
+#else
+#include "tinycthread/tinycthread.h"
+#endif
+
 #ifdef _MSC_VER
 #define _Atomic volatile
 #endif
@@ -29,6 +36,8 @@
 #define MIN(A, B) ((A) < (B)) ? (A) : (B)
 
 #define MAX_AUDIO 48000
+
+#define AP_MAX_WAIT_MS 60000
 struct AudioProvider_i {
     short audio[MAX_AUDIO];
 
@@ -37,15 +46,43 @@ struct AudioProvider_i {
 
     // Current index to write data
     _Atomic size_t tail;
+
+    // Set by a pusher sleeping on room_cond, so pulling only takes the
+    // mutex when someone is waiting
+    _Atomic bool pusher_waiting;
+
+    mtx_t mutex;
+    cnd_t room_cond;
+    bool sync_init;
 };
 
 AudioProvider ap_create() {
     AudioProvider ap = (AudioProvider)calloc(1, sizeof(struct AudioProvider_i));
     if(ap == NULL) return NULL;
 
+    if(mtx_init(&ap->mutex, mtx_plain) != thrd_success) {
+        LOG_ERROR("Failed to initialize AudioProvider mutex");
+        free(ap);
+        return NULL;
+    }
+
+    if(cnd_init(&ap->room_cond) != thrd_success) {
+        LOG_ERROR("Failed to initialize AudioProvider cond");
+        mtx_destroy(&ap->mutex);
+        free(ap);
+        return NULL;
+    }
+
+    ap->sync_init = true;
     return ap;
 }
 
+size_t ap_queued(AudioProvider ap) {
+    size_t head = ap->head;
+    size_t tail = ap->tail;
+    return (tail >= head) ? (tail - head) : ((MAX_AUDIO - head) + tail);
+}
+
 bool ap_push_audio(AudioProvider ap, const short *audio, size_t short_count) {
     if(short_count > (MAX_AUDIO / 2)) {
         LOG_WARNING("AudioProvider is being given a lot of audio (%zu samples), please reduce", short_count);
@@ -74,6 +111,19 @@ bool ap_push_audio(AudioProvider ap, const short *audio, size_t short_count) {
     return true;
 }
 
+size_t ap_room(AudioProvider ap) {
+    // One sample is left free, matching ap_push_audio
+    return (MAX_AUDIO - 1) - ap_queued(ap);
+}
+
+size_t ap_push_audio_partial(AudioProvider ap, const short *audio, size_t short_count) {
+    size_t room = ap_room(ap);
+    if(short_count > room) short_count = room;
+    if(short_count == 0) return 0;
+
+    return ap_push_audio(ap, audio, short_count) ? short_count : 0;
+}
+
 short *ap_pull_audio(AudioProvider ap, size_t *short_count) {
     if(ap->tail == ap->head) {
         *short_count = 0;
@@ -95,8 +145,51 @@ short *ap_pull_audio(AudioProvider ap, size_t *short_count) {
 
 void ap_pull_audio_finish(AudioProvider ap, size_t short_count) {
     ap->head = (ap->head + short_count) % MAX_AUDIO;
+
+    if(ap->pusher_waiting) {
+        mtx_lock(&ap->mutex);
+        cnd_broadcast(&ap->room_cond);
+        mtx_unlock(&ap->mutex);
+    }
+}
+
+bool ap_wait_for_room(AudioProvider ap, size_t timeout_ms) {
+    // Capped so the TIME_UTC point can't overflow time_t, callers loop
+    if(timeout_ms > AP_MAX_WAIT_MS) timeout_ms = AP_MAX_WAIT_MS;
+
+    // cnd_timedwait takes a TIME_UTC point
+    struct timespec until;
+    timespec_get(&until, TIME_UTC);
+    until.tv_sec += timeout_ms / 1000;
+    until.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+    if(until.tv_nsec >= 1000000000) {
+        until.tv_sec++;
+        until.tv_nsec -= 1000000000;
+    }
+
+    mtx_lock(&ap->mutex);
+
+    // Set before checking, so that a pull after the check sees it
+    ap->pusher_waiting = true;
+    while(ap_queued(ap) >= (MAX_AUDIO - 1)) {
+        if(cnd_timedwait(&ap->room_cond, &ap->mutex, &until) != thrd_success) break;
+    }
+    ap->pusher_waiting = false;
+
+    bool has_room = ap_queued(ap) < (MAX_AUDIO - 1);
+
+    mtx_unlock(&ap->mutex);
+
+    return has_room;
 }
 
 void ap_free(AudioProvider ap) {
+    if(ap == NULL) return;
+
+    if(ap->sync_init) {
+        cnd_destroy(&ap->room_cond);
+        mtx_destroy(&ap->mutex);
+    }
+
     free(ap);
 }
\ No newline at end of file
@@ -27,8 +27,24 @@ AudioProvider ap_create();
 // Returns true if successful, false if buffer is full
 bool ap_push_audio(AudioProvider ap, const short *audio, size_t short_count);
 
+// Pushes as much audio as there is room for, returns the number of samples
+// pushed
+size_t ap_push_audio_partial(AudioProvider ap, const short *audio, size_t short_count);
+
 short *ap_pull_audio(AudioProvider ap,  size_t *short_count);
 void ap_pull_audio_finish(AudioProvider ap, size_t short_count);
+
+// Blocks the pushing thread until some audio has been pulled to make room,
+// or until timeout_ms passes, at most a minute. Returns true if there is
+// room
+bool ap_wait_for_room(AudioProvider ap, size_t timeout_ms);
+
+// Number of samples pushed but not yet pulled
+size_t ap_queued(AudioProvider ap);
+
+// Number of samples that can be pushed before the buffer is full. Only
+// grows until the pushing thread pushes again
+size_t ap_room(AudioProvider ap);
 void ap_free(AudioProvider ap);
 
 #endif
\ No newline at end of file
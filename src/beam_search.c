@@ -0,0 +1,690 @@
+/*
+ * Copyright (C) 2022 abb128
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <string.h>
+#include "common.h"
+#include "log.h"
+#include "params.h"
+#include "logits.h"
+#include "beam_search.h"
+#include "april_session.h"
+
+#define HASH_EMPTY 14695981039346656037ULL
+#define HASH_PRIME 1099511628211ULL
+
+typedef struct BeamHyp {
+    // Total log-probability of the hypothesis
+    float logprob;
+
+    // Hash of the token sequence, for quickly finding identical hypotheses
+    uint64_t hash;
+
+    // These point into the arena, each is MAX_ACTIVE_TOKENS long
+    size_t num_tokens;
+    int *tokens;
+    float *token_logprobs;
+    size_t *token_times;
+
+    // The last context_size tokens, blank padded
+    int64_t *context;
+} BeamHyp;
+
+typedef struct BeamCandidate {
+    float score;
+    int hyp;
+    int token;
+} BeamCandidate;
+
+struct BeamSearch_i {
+    AprilASRSession aas;
+
+    size_t beam;
+    size_t context_size;
+    size_t joiner_dim;
+    size_t token_count;
+    bool batched;
+    bool fused;
+
+    size_t num_hyps;
+    BeamHyp *hyps;
+    BeamHyp *next;
+    void *arena;
+
+    // Network tensors, each with room for `beam` rows. Row i of the current
+    // dout buffer is the decoder output of hyps[i]
+    int64_t *context_rows;
+    float *eout_rows;
+    float *dec_rows;
+    float *dout_rows[2];
+    int dout_cur;
+    float *logits_rows;
+
+    // View i covers rows [0, i] as one batch if batched, otherwise only
+    // row i as a batch of 1
+    OrtValue **context_views;
+    OrtValue **eout_views;
+    OrtValue **dec_views;
+    OrtValue **dout_views[2];
+    OrtValue **logits_views;
+
+    // Bindings over the views above, indexed the same way. The joiner has
+    // one set per dout buffer
+    OrtIoBinding **decoder_bindings;
+    OrtIoBinding **joiner_bindings[2];
+
+    // Decoder output of an all-blank context, used when resetting
+    float *blank_dout;
+
+    // Min-heap holding the best candidates of the current frame
+    BeamCandidate *heap;
+    size_t heap_size;
+
+    size_t last_partial_count;
+    uint64_t last_partial_hash;
+    size_t last_reset_time_ms;
+};
+
+static inline uint64_t hash_append(uint64_t hash, int token) {
+    return (hash ^ (uint64_t)(token + 1)) * HASH_PRIME;
+}
+
+static uint64_t hash_tokens(const int *tokens, size_t count) {
+    uint64_t hash = HASH_EMPTY;
+    for(size_t i=0; i<count; i++) hash = hash_append(hash, tokens[i]);
+    return hash;
+}
+
+static inline float log_add(float a, float b) {
+    float max = a > b ? a : b;
+    return max + log1pf(expf(-fabsf(a - b)));
+}
+
+
+static OrtValue **create_views(BeamSearch bs, void *data, size_t row_bytes, const int64_t *model_shape, size_t rank, ONNXTensorElementDataType type) {
+    OrtValue **views = (OrtValue **)calloc(bs->beam, sizeof(OrtValue *));
+
+    int64_t shape[3];
+    memcpy(shape, model_shape, rank * sizeof(int64_t));
+
+    for(size_t i=0; i<bs->beam; i++) {
+        char *start = (char *)data;
+        size_t rows = i + 1;
+        if(!bs->batched) {
+            start += i * row_bytes;
+            rows = 1;
+        }
+
+        shape[0] = (int64_t)rows;
+        ORT_ABORT_ON_ERROR(g_ort->CreateTensorWithDataAsOrtValue(bs->aas->memory_info,
+            start, rows * row_bytes, shape, rank, type, &views[i]));
+    }
+
+    return views;
+}
+
+static void free_views(BeamSearch bs, OrtValue **views) {
+    if(views == NULL) return;
+
+    for(size_t i=0; i<bs->beam; i++) g_ort->ReleaseValue(views[i]);
+    free(views);
+}
+
+static OrtIoBinding **create_decoder_bindings(BeamSearch bs) {
+    OrtIoBinding **bindings = (OrtIoBinding **)calloc(bs->beam, sizeof(OrtIoBinding *));
+
+    for(size_t i=0; i<bs->beam; i++) {
+        const OrtValue *inputs[] = { bs->context_views[i] };
+        OrtValue *outputs[] = { bs->dec_views[i] };
+
+        bindings[i] = create_io_binding(bs->aas->model->decoder,
+                                        decoder_input_names, inputs, 1,
+                                        decoder_output_names, outputs, 1);
+    }
+
+    return bindings;
+}
+
+static OrtIoBinding **create_joiner_bindings(BeamSearch bs, OrtValue **dout_views) {
+    OrtIoBinding **bindings = (OrtIoBinding **)calloc(bs->beam, sizeof(OrtIoBinding *));
+
+    for(size_t i=0; i<bs->beam; i++) {
+        const OrtValue *inputs[] = {
+            bs->eout_views[i],
+            bs->fused ? bs->context_views[i] : dout_views[i]
+        };
+        OrtValue *outputs[] = { bs->logits_views[i] };
+
+        bindings[i] = create_io_binding(bs->aas->model->joiner,
+                                        bs->fused ? fused_joiner_input_names : joiner_input_names, inputs, 2,
+                                        joiner_output_names, outputs, 1);
+    }
+
+    return bindings;
+}
+
+static void free_bindings(BeamSearch bs, OrtIoBinding **bindings) {
+    if(bindings == NULL) return;
+
+    for(size_t i=0; i<bs->beam; i++) free_io_binding(&bindings[i]);
+    free(bindings);
+}
+
+// Runs the decoder over context_rows[0..rows) into dec_rows
+static void run_decoder(BeamSearch bs, size_t rows) {
+    assert(!bs->fused);
+
+    size_t runs = bs->batched ? 1 : rows;
+    for(size_t i=0; i<runs; i++) {
+        size_t view = bs->batched ? (rows - 1) : i;
+
+        ORT_ABORT_ON_ERROR(g_ort->RunWithBinding(bs->aas->model->decoder, NULL,
+                                        bs->decoder_bindings[view]));
+        bs->aas->decoder_runs++;
+    }
+}
+
+// Runs the joiner over eout_rows and the current dout rows into logits_rows.
+// A fused joiner takes context_rows instead of the dout rows
+static void run_joiner(BeamSearch bs, size_t rows) {
+    size_t runs = bs->batched ? 1 : rows;
+    for(size_t i=0; i<runs; i++) {
+        size_t view = bs->batched ? (rows - 1) : i;
+        int buffer = bs->fused ? 0 : bs->dout_cur;
+
+        ORT_ABORT_ON_ERROR(g_ort->RunWithBinding(bs->aas->model->joiner, NULL,
+                                        bs->joiner_bindings[buffer][view]));
+        bs->aas->joiner_runs++;
+    }
+}
+
+
+static void heap_sift_down(BeamCandidate *heap, size_t size, size_t i) {
+    for(;;) {
+        size_t smallest = i;
+        size_t l = 2*i + 1;
+        size_t r = 2*i + 2;
+        if((l < size) && (heap[l].score < heap[smallest].score)) smallest = l;
+        if((r < size) && (heap[r].score < heap[smallest].score)) smallest = r;
+        if(smallest == i) return;
+
+        BeamCandidate tmp = heap[i];
+        heap[i] = heap[smallest];
+        heap[smallest] = tmp;
+        i = smallest;
+    }
+}
+
+static void heap_sift_up(BeamCandidate *heap, size_t i) {
+    while(i > 0) {
+        size_t parent = (i - 1) / 2;
+        if(heap[parent].score <= heap[i].score) return;
+
+        BeamCandidate tmp = heap[i];
+        heap[i] = heap[parent];
+        heap[parent] = tmp;
+        i = parent;
+    }
+}
+
+// Keeps the `beam` best candidates seen so far
+static inline void heap_offer(BeamSearch bs, float score, int hyp, int token) {
+    if(bs->heap_size < bs->beam) {
+        BeamCandidate c = { score, hyp, token };
+        bs->heap[bs->heap_size] = c;
+        heap_sift_up(bs->heap, bs->heap_size);
+        bs->heap_size++;
+    } else if(score > bs->heap[0].score) {
+        BeamCandidate c = { score, hyp, token };
+        bs->heap[0] = c;
+        heap_sift_down(bs->heap, bs->heap_size, 0);
+    }
+}
+
+// Sorts the heap contents in place from best to worst
+static void heap_sort_descending(BeamSearch bs) {
+    size_t size = bs->heap_size;
+    while(size > 1) {
+        BeamCandidate tmp = bs->heap[0];
+        bs->heap[0] = bs->heap[size - 1];
+        bs->heap[size - 1] = tmp;
+        size--;
+        heap_sift_down(bs->heap, size, 0);
+    }
+}
+
+
+static void copy_hyp(BeamSearch bs, BeamHyp *dst, const BeamHyp *src) {
+    dst->logprob = src->logprob;
+    dst->hash = src->hash;
+    dst->num_tokens = src->num_tokens;
+    memcpy(dst->tokens, src->tokens, src->num_tokens * sizeof(int));
+    memcpy(dst->token_logprobs, src->token_logprobs, src->num_tokens * sizeof(float));
+    memcpy(dst->token_times, src->token_times, src->num_tokens * sizeof(size_t));
+    memcpy(dst->context, src->context, bs->context_size * sizeof(int64_t));
+}
+
+static bool same_tokens(const BeamHyp *a, const BeamHyp *b) {
+    return (a->hash == b->hash)
+        && (a->num_tokens == b->num_tokens)
+        && (memcmp(a->tokens, b->tokens, a->num_tokens * sizeof(int)) == 0);
+}
+
+static BeamHyp *best_hyp(BeamSearch bs) {
+    BeamHyp *best = &bs->hyps[0];
+    for(size_t i=1; i<bs->num_hyps; i++) {
+        if(bs->hyps[i].logprob > best->logprob) best = &bs->hyps[i];
+    }
+
+    return best;
+}
+
+static inline float *dout_row(BeamSearch bs, int buffer, size_t row) {
+    return &bs->dout_rows[buffer][row * bs->joiner_dim];
+}
+
+
+// Writes the first `count` tokens of hyp into the session's active tokens,
+// with the same flag rules as the greedy search
+static void fill_active_tokens(BeamSearch bs, const BeamHyp *hyp, size_t count) {
+    AprilASRSession aas = bs->aas;
+    ModelParameters *params = &aas->model->params;
+
+    for(size_t i=0; i<count; i++) {
+        int id = hyp->tokens[i];
+        uint8_t cls = get_token_class(params, id);
+
+        AprilToken *token = &aas->active_tokens[i];
+        token->token = get_token(params, id);
+        token->logprob = hyp->token_logprobs[i];
+        token->time_ms = hyp->token_times[i];
+        token->flags = (AprilTokenFlagBits)(cls & TOKEN_CLASS_WORD_BOUNDARY_BIT);
+        token->reserved = NULL;
+
+        if(cls & TOKEN_CLASS_SENTENCE_END_BIT) {
+            // Don't treat the "." in a number (like 10.0) as end of sentence,
+            // unless a new word follows it
+            bool after_digit = (i > 0) && (get_token_class(params, hyp->tokens[i - 1]) & TOKEN_CLASS_LEADING_DIGIT_BIT);
+            bool before_word = ((i + 1) < hyp->num_tokens) && (get_token_class(params, hyp->tokens[i + 1]) & TOKEN_CLASS_WORD_BOUNDARY_BIT);
+
+            if(!(after_digit && (token->token[0] == '.')) || before_word) {
+                token->flags |= APRIL_TOKEN_FLAG_SENTENCE_END_BIT;
+            }
+        }
+
+        aas->active_token_ids[i] = id;
+    }
+
+    aas->active_token_head = count;
+}
+
+// Emits the first `count` tokens of the best hypothesis as final, then
+// collapses the beam to that hypothesis holding only the remaining tokens
+static void beam_commit(BeamSearch bs, BeamHyp *best, size_t count) {
+    AprilASRSession aas = bs->aas;
+
+    if(count > 0) {
+        fill_active_tokens(bs, best, count);
+        aas_finalize_tokens(aas);
+    }
+
+    BeamHyp *dst = &bs->hyps[0];
+    if(dst != best) {
+        copy_hyp(bs, dst, best);
+        memcpy(dout_row(bs, bs->dout_cur, 0), dout_row(bs, bs->dout_cur, best - bs->hyps), bs->joiner_dim * sizeof(float));
+    }
+
+    size_t remaining = dst->num_tokens - count;
+    memmove(dst->tokens, &dst->tokens[count], remaining * sizeof(int));
+    memmove(dst->token_logprobs, &dst->token_logprobs[count], remaining * sizeof(float));
+    memmove(dst->token_times, &dst->token_times[count], remaining * sizeof(size_t));
+    dst->num_tokens = remaining;
+    dst->hash = hash_tokens(dst->tokens, remaining);
+    dst->logprob = 0.0f;
+
+    bs->num_hyps = 1;
+    bs->last_partial_count = (size_t)-1;
+}
+
+static void beam_reset_context(BeamSearch bs) {
+    BeamHyp *hyp = &bs->hyps[0];
+    int blank = bs->aas->model->params.blank_id;
+
+    for(size_t i=0; i<bs->context_size; i++) hyp->context[i] = blank;
+    memcpy(dout_row(bs, bs->dout_cur, 0), bs->blank_dout, bs->joiner_dim * sizeof(float));
+
+    hyp->num_tokens = 0;
+    hyp->hash = HASH_EMPTY;
+    hyp->logprob = 0.0f;
+    bs->num_hyps = 1;
+    bs->last_reset_time_ms = bs->aas->current_time_ms;
+    bs->last_partial_count = 0;
+    bs->last_partial_hash = HASH_EMPTY;
+}
+
+
+BeamSearch beam_create(AprilASRSession aas, size_t beam_width) {
+    AprilASRModel model = aas->model;
+
+    if(beam_width == 0) beam_width = DEFAULT_BEAM_WIDTH;
+    if(beam_width > MAX_BEAM_WIDTH) {
+        LOG_WARNING("Beam width %zu is too large, using %d", beam_width, MAX_BEAM_WIDTH);
+        beam_width = MAX_BEAM_WIDTH;
+    }
+
+    BeamSearch bs = (BeamSearch)calloc(1, sizeof(struct BeamSearch_i));
+    if(bs == NULL) return NULL;
+
+    bs->aas = aas;
+    bs->beam = beam_width;
+    bs->context_size = model->context_dim[1];
+    bs->joiner_dim = model->dout_dim[2];
+    bs->token_count = model->params.token_count;
+    bs->batched = model->batched_decoding;
+    bs->fused = model->fused;
+
+    if(!bs->batched) {
+        LOG_INFO("Model does not support batched decoding, beam search will run the decoder and joiner once per hypothesis");
+    }
+
+    size_t K = bs->beam;
+    size_t C = bs->context_size;
+    size_t D = bs->joiner_dim;
+    size_t V = bs->token_count;
+
+    // One allocation for every hypothesis of both generations
+    size_t per_hyp = MAX_ACTIVE_TOKENS * (sizeof(int) + sizeof(float) + sizeof(size_t)) + C * sizeof(int64_t);
+    bs->arena = calloc(2 * K, per_hyp);
+    bs->hyps = (BeamHyp *)calloc(K, sizeof(BeamHyp));
+    bs->next = (BeamHyp *)calloc(K, sizeof(BeamHyp));
+
+    bs->context_rows   = (int64_t *)calloc(K * C, sizeof(int64_t));
+    bs->eout_rows      = (float *)calloc(K * D, sizeof(float));
+    bs->dec_rows       = (float *)calloc(K * D, sizeof(float));
+    bs->dout_rows[0]   = (float *)calloc(K * D, sizeof(float));
+    bs->dout_rows[1]   = (float *)calloc(K * D, sizeof(float));
+    bs->logits_rows    = (float *)calloc(K * V, sizeof(float));
+    bs->blank_dout     = (float *)calloc(D, sizeof(float));
+    bs->heap           = (BeamCandidate *)calloc(K, sizeof(BeamCandidate));
+
+    if((bs->arena == NULL) || (bs->hyps == NULL) || (bs->next == NULL)
+        || (bs->context_rows == NULL) || (bs->eout_rows == NULL) || (bs->dec_rows == NULL)
+        || (bs->dout_rows[0] == NULL) || (bs->dout_rows[1] == NULL)
+        || (bs->logits_rows == NULL) || (bs->blank_dout == NULL) || (bs->heap == NULL)) {
+        LOG_ERROR("Failed to allocate beam search of width %zu", K);
+        beam_free(bs);
+        return NULL;
+    }
+
+    char *arena = (char *)bs->arena;
+    for(size_t i=0; i<2*K; i++) {
+        BeamHyp *hyp = (i < K) ? &bs->hyps[i] : &bs->next[i - K];
+        hyp->tokens         = (int *)arena;     arena += MAX_ACTIVE_TOKENS * sizeof(int);
+        hyp->token_logprobs = (float *)arena;   arena += MAX_ACTIVE_TOKENS * sizeof(float);
+        hyp->token_times    = (size_t *)arena;  arena += MAX_ACTIVE_TOKENS * sizeof(size_t);
+        hyp->context        = (int64_t *)arena; arena += C * sizeof(int64_t);
+    }
+
+    bs->context_views   = create_views(bs, bs->context_rows,   C * sizeof(int64_t), model->context_dim, 2, ONNX_TENSOR_ELEMENT_DATA_TYPE_INT64);
+    bs->eout_views      = create_views(bs, bs->eout_rows,      D * sizeof(float), model->eout_dim, 3, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT);
+    bs->dec_views       = create_views(bs, bs->dec_rows,       D * sizeof(float), model->dout_dim, 3, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT);
+    bs->dout_views[0]   = create_views(bs, bs->dout_rows[0],   D * sizeof(float), model->dout_dim, 3, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT);
+    bs->dout_views[1]   = create_views(bs, bs->dout_rows[1],   D * sizeof(float), model->dout_dim, 3, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT);
+    bs->logits_views    = create_views(bs, bs->logits_rows,    V * sizeof(float), model->logits_dim, 3, ONNX_TENSOR_ELEMENT_DATA_TYPE_FLOAT);
+
+    // A fused joiner reads the context rows, which are not double buffered
+    if(bs->fused) {
+        bs->joiner_bindings[0] = create_joiner_bindings(bs, NULL);
+    } else {
+        bs->decoder_bindings   = create_decoder_bindings(bs);
+        bs->joiner_bindings[0] = create_joiner_bindings(bs, bs->dout_views[0]);
+        bs->joiner_bindings[1] = create_joiner_bindings(bs, bs->dout_views[1]);
+    }
+
+    // Cache the decoder output for an empty context
+    if(!bs->fused) {
+        for(size_t i=0; i<C; i++) bs->context_rows[i] = model->params.blank_id;
+        run_decoder(bs, 1);
+        memcpy(bs->blank_dout, bs->dec_rows, D * sizeof(float));
+    }
+
+    bs->dout_cur = 0;
+    beam_reset_context(bs);
+
+    return bs;
+}
+
+void beam_step(BeamSearch bs) {
+    AprilASRSession aas = bs->aas;
+    ModelParameters *params = &aas->model->params;
+    int blank = params->blank_id;
+
+    size_t n = bs->num_hyps;
+    size_t C = bs->context_size;
+    size_t D = bs->joiner_dim;
+    size_t V = bs->token_count;
+
+    for(size_t i=0; i<n; i++) {
+        memcpy(&bs->eout_rows[i * D], aas->eout.data, D * sizeof(float));
+        if(bs->fused) memcpy(&bs->context_rows[i * C], bs->hyps[i].context, C * sizeof(int64_t));
+    }
+
+    run_joiner(bs, n);
+
+    // Partial top-K selection over every (hypothesis, token) extension
+    float log_norms[MAX_BEAM_WIDTH];
+    bs->heap_size = 0;
+    for(size_t i=0; i<n; i++) {
+        const float *logits = &bs->logits_rows[i * V];
+
+        float max_val;
+        logits_argmax(logits, V, V, &max_val);
+        log_norms[i] = logits_logsumexp(logits, V, max_val);
+
+        float base = bs->hyps[i].logprob - log_norms[i];
+
+        // Nothing from this hypothesis can beat the current K-th best
+        if((bs->heap_size == bs->beam) && ((base + max_val) <= bs->heap[0].score)) continue;
+
+        for(size_t v=0; v<V; v++) {
+            heap_offer(bs, base + logits[v], (int)i, (int)v);
+        }
+    }
+
+    heap_sort_descending(bs);
+
+    int cur = bs->dout_cur;
+    int nxt = 1 - cur;
+
+    bool needs_decoder[MAX_BEAM_WIDTH];
+    size_t m = 0;
+    for(size_t c=0; c<bs->heap_size; c++) {
+        const BeamCandidate *cand = &bs->heap[c];
+        const BeamHyp *src = &bs->hyps[cand->hyp];
+        bool is_blank = cand->token == blank;
+
+        // No room for another token. The beam is committed before the best
+        // hypothesis gets here, so this only drops unlikely hypotheses
+        if((!is_blank) && (src->num_tokens >= MAX_ACTIVE_TOKENS)) continue;
+
+        BeamHyp *dst = &bs->next[m];
+        copy_hyp(bs, dst, src);
+        dst->logprob = cand->score;
+
+        if(!is_blank) {
+            size_t t = dst->num_tokens++;
+            dst->tokens[t] = cand->token;
+            dst->token_logprobs[t] = bs->logits_rows[cand->hyp * V + cand->token] - log_norms[cand->hyp];
+            dst->token_times[t] = aas->current_time_ms;
+            dst->hash = hash_append(dst->hash, cand->token);
+
+            memmove(&dst->context[0], &dst->context[1], (C - 1) * sizeof(int64_t));
+            dst->context[C - 1] = cand->token;
+        }
+
+        // Merge with an identical hypothesis reached by a different path
+        bool merged = false;
+        for(size_t j=0; j<m; j++) {
+            if(same_tokens(&bs->next[j], dst)) {
+                bs->next[j].logprob = log_add(bs->next[j].logprob, dst->logprob);
+                merged = true;
+                break;
+            }
+        }
+        if(merged) continue;
+
+        needs_decoder[m] = (!is_blank) && (!bs->fused);
+        if(is_blank && (!bs->fused)) {
+            memcpy(dout_row(bs, nxt, m), dout_row(bs, cur, cand->hyp), D * sizeof(float));
+        }
+
+        m++;
+    }
+
+    if(m == 0) return;
+
+    // Run the decoder once per distinct context
+    size_t row_of[MAX_BEAM_WIDTH];
+    size_t unique = 0;
+    for(size_t j=0; j<m; j++) {
+        if(!needs_decoder[j]) continue;
+
+        size_t u;
+        for(u=0; u<unique; u++) {
+            if(memcmp(&bs->context_rows[u * C], bs->next[j].context, C * sizeof(int64_t)) == 0) break;
+        }
+
+        if(u == unique) {
+            memcpy(&bs->context_rows[u * C], bs->next[j].context, C * sizeof(int64_t));
+            unique++;
+        }
+
+        row_of[j] = u;
+    }
+
+    if(unique > 0) {
+        run_decoder(bs, unique);
+
+        for(size_t j=0; j<m; j++) {
+            if(needs_decoder[j]) {
+                memcpy(dout_row(bs, nxt, j), &bs->dec_rows[row_of[j] * D], D * sizeof(float));
+            }
+        }
+    }
+
+    BeamHyp *tmp = bs->hyps;
+    bs->hyps = bs->next;
+    bs->next = tmp;
+    bs->num_hyps = m;
+    bs->dout_cur = nxt;
+
+    // Only differences between scores matter. Keeping the best at 0 stops
+    // them all from drifting down by the blank score every frame, which
+    // during a long silence would cost the precision that tells them apart
+    BeamHyp *best = best_hyp(bs);
+    float best_logprob = best->logprob;
+    for(size_t i=0; i<m; i++) bs->hyps[i].logprob -= best_logprob;
+
+    // Emit results for the best hypothesis
+    size_t count = best->num_tokens;
+
+    size_t last_emission_time_ms = bs->last_reset_time_ms;
+    if((count > 0) && (best->token_times[count - 1] > last_emission_time_ms)) {
+        last_emission_time_ms = best->token_times[count - 1];
+    }
+
+    if((aas->current_time_ms - last_emission_time_ms) >= 2200) {
+        if(count > 0) {
+            beam_finalize(bs);
+        }
+
+        aas_emit_silence(aas);
+        return;
+    }
+
+    // Force final if a new sentence has started
+    if(count >= 2) {
+        uint8_t last_cls = get_token_class(params, best->tokens[count - 1]);
+        uint8_t prev_cls = get_token_class(params, best->tokens[count - 2]);
+        if((last_cls & TOKEN_CLASS_WORD_BOUNDARY_BIT) && (prev_cls & TOKEN_CLASS_SENTENCE_END_BIT)) {
+            beam_commit(bs, best, count - 1);
+            best = &bs->hyps[0];
+            count = best->num_tokens;
+        }
+    }
+
+    // Running out of room, finalize everything except the current word
+    if(count >= (MAX_ACTIVE_TOKENS - 1)) {
+        size_t start_of_word = count - 1;
+        while((start_of_word > 0) && !(get_token_class(params, best->tokens[start_of_word]) & TOKEN_CLASS_WORD_BOUNDARY_BIT)) {
+            start_of_word--;
+        }
+
+        beam_commit(bs, best, start_of_word > 0 ? start_of_word : count);
+        best = &bs->hyps[0];
+        count = best->num_tokens;
+    }
+
+    if((count != bs->last_partial_count) || (best->hash != bs->last_partial_hash)) {
+        fill_active_tokens(bs, best, count);
+
+        // At most one token is added per frame
+        if((count > 0) && (best->token_times[count - 1] == aas->current_time_ms)) {
+            lt_emitted(aas->latency, 1);
+        }
+
+        aas_emit_token(aas, NULL, -1, true);
+
+        bs->last_partial_count = count;
+        bs->last_partial_hash = best->hash;
+
+        if(count > 0) aas->emitted_silence = false;
+    }
+}
+
+void beam_finalize(BeamSearch bs) {
+    BeamHyp *best = best_hyp(bs);
+    beam_commit(bs, best, best->num_tokens);
+    beam_reset_context(bs);
+}
+
+void beam_free(BeamSearch bs) {
+    if(bs == NULL) return;
+
+    free_bindings(bs, bs->joiner_bindings[1]);
+    free_bindings(bs, bs->joiner_bindings[0]);
+    free_bindings(bs, bs->decoder_bindings);
+
+    free_views(bs, bs->logits_views);
+    free_views(bs, bs->dout_views[1]);
+    free_views(bs, bs->dout_views[0]);
+    free_views(bs, bs->dec_views);
+    free_views(bs, bs->eout_views);
+    free_views(bs, bs->context_views);
+
+    free(bs->heap);
+    free(bs->blank_dout);
+    free(bs->logits_rows);
+    free(bs->dout_rows[1]);
+    free(bs->dout_rows[0]);
+    free(bs->dec_rows);
+    free(bs->eout_rows);
+    free(bs->context_rows);
+    free(bs->next);
+    free(bs->hyps);
+    free(bs->arena);
+    free(bs);
+}
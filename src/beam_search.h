@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2022 abb128
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _APRIL_BEAM_SEARCH
+#define _APRIL_BEAM_SEARCH
+
+#include <stddef.h>
+#include "common.h"
+#include "april_api.h"
+
+#define MAX_BEAM_WIDTH 16
+#define DEFAULT_BEAM_WIDTH 4
+
+struct BeamSearch_i;
+typedef struct BeamSearch_i * BeamSearch;
+
+// Modified beam search (at most one symbol per encoder frame). All
+// hypotheses live in an arena allocated here, nothing is allocated per
+// frame. Decoder and joiner calls for the whole beam are batched into a
+// single run when the model supports it (see AprilASRModel_i.batched_decoding)
+BeamSearch beam_create(AprilASRSession aas, size_t beam_width);
+
+// Advances the beam by the encoder frame currently in aas->eout, and emits
+// partial or final results through the session handler
+void beam_step(BeamSearch bs);
+
+// Emits the best hypothesis as a final result and resets the beam to an
+// empty context
+void beam_finalize(BeamSearch bs);
+
+void beam_free(BeamSearch bs);
+
+#endif
@@ -17,7 +17,16 @@
 #ifndef _APRIL_COMMON
 #define _APRIL_COMMON
 
+#include <stddef.h>
+
 #define _APRIL_EXPORT
 extern int g_client_version;
 
+// Writes to every page of a fresh allocation. The OS places a page on the
+// NUMA node of the thread that first writes to it, calloc alone doesn't
+static inline void touch_pages(void *data, size_t size) {
+    volatile char *bytes = (volatile char *)data;
+    for(size_t i=0; i<size; i+=4096) bytes[i] = 0;
+}
+
 #endif
\ No newline at end of file
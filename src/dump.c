@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2022 abb128
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "log.h"
+#include "dump.h"
+#include "file/util.h"
+
+static const char DUMP_MAGIC[8] = { 'A', 'P', 'R', 'I', 'L', 'D', 'M', 'P' };
+
+// Sizes in the file, see dump.h for the layout
+#define DUMP_HEADER_SIZE 32
+#define DUMP_RECORD_HEADER_SIZE 8
+
+typedef struct DumpHeader {
+    uint32_t version;
+    uint32_t kind;
+    uint32_t record_floats;
+    uint32_t stride_ms;
+} DumpHeader;
+
+struct DumpWriter_i {
+    FILE *fd;
+    size_t record_floats;
+    float *zeros;
+
+    // A whole record as written to the file
+    uint8_t *record;
+};
+
+struct DumpReader_i {
+    FILE *fd;
+    DumpHeader header;
+};
+
+static bool write_record(DumpWriter writer, const float *data, uint32_t flags) {
+    uint8_t *record = writer->record;
+    mfu_put_u32(&record[0], flags);
+    mfu_put_u32(&record[4], 0);
+
+    for(size_t i=0; i<writer->record_floats; i++) {
+        uint32_t bits;
+        memcpy(&bits, &data[i], sizeof(bits));
+        mfu_put_u32(&record[DUMP_RECORD_HEADER_SIZE + i * 4], bits);
+    }
+
+    size_t size = DUMP_RECORD_HEADER_SIZE + writer->record_floats * 4;
+    return fwrite(record, 1, size, writer->fd) == size;
+}
+
+DumpWriter dump_create(const char *path, DumpKind kind, size_t record_floats, size_t stride_ms) {
+    DumpWriter writer = (DumpWriter)calloc(1, sizeof(struct DumpWriter_i));
+    if(writer == NULL) return NULL;
+
+    writer->record_floats = record_floats;
+    writer->zeros = (float *)calloc(record_floats, sizeof(float));
+    writer->record = (uint8_t *)malloc(DUMP_RECORD_HEADER_SIZE + record_floats * 4);
+    writer->fd = fopen(path, "wb");
+    if((writer->zeros == NULL) || (writer->record == NULL) || (writer->fd == NULL)) {
+        LOG_ERROR("Failed to open dump file %s", path);
+        dump_free(writer);
+        return NULL;
+    }
+
+    uint8_t header[DUMP_HEADER_SIZE] = { 0 };
+    memcpy(header, DUMP_MAGIC, sizeof(DUMP_MAGIC));
+    mfu_put_u32(&header[8], DUMP_VERSION);
+    mfu_put_u32(&header[12], (uint32_t)kind);
+    mfu_put_u32(&header[16], (uint32_t)record_floats);
+    mfu_put_u32(&header[20], (uint32_t)stride_ms);
+
+    if(fwrite(header, sizeof(header), 1, writer->fd) != 1) {
+        LOG_ERROR("Failed to write dump file header to %s", path);
+        dump_free(writer);
+        return NULL;
+    }
+
+    return writer;
+}
+
+void dump_write(DumpWriter writer, const float *data) {
+    if(!write_record(writer, data, 0)) {
+        LOG_WARNING("Failed to write to dump file");
+    }
+}
+
+void dump_write_flush(DumpWriter writer) {
+    if(!write_record(writer, writer->zeros, DUMP_RECORD_FLUSH)) {
+        LOG_WARNING("Failed to write to dump file");
+    }
+
+    fflush(writer->fd);
+}
+
+void dump_free(DumpWriter writer) {
+    if(writer == NULL) return;
+
+    if(writer->fd != NULL) fclose(writer->fd);
+    free(writer->record);
+    free(writer->zeros);
+    free(writer);
+}
+
+DumpReader dump_open(const char *path) {
+    DumpReader reader = (DumpReader)calloc(1, sizeof(struct DumpReader_i));
+    if(reader == NULL) return NULL;
+
+    reader->fd = fopen(path, "rb");
+    if(reader->fd == NULL) {
+        LOG_ERROR("Failed to open dump file %s", path);
+        dump_close(reader);
+        return NULL;
+    }
+
+    uint8_t header[DUMP_HEADER_SIZE];
+    if((fread(header, sizeof(header), 1, reader->fd) != 1)
+        || (memcmp(header, DUMP_MAGIC, sizeof(DUMP_MAGIC)) != 0)
+    ) {
+        LOG_ERROR("%s is not a dump file", path);
+        dump_close(reader);
+        return NULL;
+    }
+
+    reader->header.version = mfu_get_u32(&header[8]);
+    reader->header.kind = mfu_get_u32(&header[12]);
+    reader->header.record_floats = mfu_get_u32(&header[16]);
+    reader->header.stride_ms = mfu_get_u32(&header[20]);
+
+    if(reader->header.version != DUMP_VERSION) {
+        LOG_ERROR("Unsupported dump file version %u in %s", reader->header.version, path);
+        dump_close(reader);
+        return NULL;
+    }
+
+    return reader;
+}
+
+DumpKind dump_get_kind(DumpReader reader) {
+    return (DumpKind)reader->header.kind;
+}
+
+size_t dump_get_record_floats(DumpReader reader) {
+    return reader->header.record_floats;
+}
+
+size_t dump_get_stride_ms(DumpReader reader) {
+    return reader->header.stride_ms;
+}
+
+bool dump_read(DumpReader reader, float *data, uint32_t *flags) {
+    uint8_t record[DUMP_RECORD_HEADER_SIZE];
+    if(fread(record, sizeof(record), 1, reader->fd) != 1) return false;
+
+    size_t count = reader->header.record_floats;
+    if(fread(data, 4, count, reader->fd) != count) {
+        LOG_WARNING("Dump file ends with a partial record");
+        return false;
+    }
+
+    // Decoded in place, each float takes the 4 bytes it was read into
+    for(size_t i=0; i<count; i++) {
+        uint32_t bits = mfu_get_u32((const uint8_t *)&data[i]);
+        memcpy(&data[i], &bits, sizeof(bits));
+    }
+
+    *flags = mfu_get_u32(&record[0]);
+    return true;
+}
+
+void dump_close(DumpReader reader) {
+    if(reader == NULL) return;
+
+    if(reader->fd != NULL) fclose(reader->fd);
+    free(reader);
+}
@@ -0,0 +1,69 @@
+/*
+ * Copyright (C) 2022 abb128
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _APRIL_DUMP
+#define _APRIL_DUMP
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+// Dumps of a session's intermediate outputs, for re-running decoding on
+// them later without the fbank and encoder. The file is a 32 byte header
+// followed by fixed size records, so record i is at byte
+// 32 + i * (8 + 4 * record_floats) and the file can be memory mapped:
+//
+//   header: char magic[8] "APRILDMP", u32 version, u32 kind,
+//           u32 record_floats, u32 stride_ms, u32 reserved[2]
+//   record: u32 flags, u32 reserved, f32 data[record_floats]
+//
+// All values are little endian, whatever the host byte order. A record with DUMP_RECORD_FLUSH set marks
+// a flush, its data is zeroes
+
+#define DUMP_VERSION 1
+#define DUMP_RECORD_FLUSH 1
+
+typedef enum DumpKind {
+    // Each record is one fbank segment of (segment_size, mel_features)
+    DUMP_KIND_FEATURES = 1,
+
+    // Each record is one encoder output frame
+    DUMP_KIND_ENCODER_OUT = 2
+} DumpKind;
+
+struct DumpWriter_i;
+typedef struct DumpWriter_i *DumpWriter;
+
+DumpWriter dump_create(const char *path, DumpKind kind, size_t record_floats, size_t stride_ms);
+void dump_write(DumpWriter writer, const float *data);
+void dump_write_flush(DumpWriter writer);
+void dump_free(DumpWriter writer);
+
+struct DumpReader_i;
+typedef struct DumpReader_i *DumpReader;
+
+DumpReader dump_open(const char *path);
+DumpKind dump_get_kind(DumpReader reader);
+size_t dump_get_record_floats(DumpReader reader);
+size_t dump_get_stride_ms(DumpReader reader);
+
+// Reads the next record into data, which must have room for record_floats.
+// Returns false at the end of the file
+bool dump_read(DumpReader reader, float *data, uint32_t *flags);
+void dump_close(DumpReader reader);
+
+#endif
@@ -124,6 +124,10 @@ struct OnlineFBank_i {
 
     double speed_factor;
     sonicStream sonic_stream;
+
+    // Fraction of a frame owed to the output when dropping frames, a frame
+    // is kept each time this reaches 1
+    double keep_accumulator;
 };
 
 OnlineFBank make_fbank(FBankOptions opts) {
@@ -144,9 +148,11 @@ OnlineFBank make_fbank(FBankOptions opts) {
     generate_banks(fbank->mel_bins, opts.num_bins, fbank->num_fft_bins,
         fbank->padded_window_size, opts.sample_freq, opts.mel_low, opts.mel_high);
 
-    fbank->temp_segments_y = opts.pull_segment_count * 32;
+    size_t max_segments = opts.pull_max_segments > 1 ? opts.pull_max_segments : 1;
+    fbank->temp_segments_y = opts.pull_segment_count * 32 + opts.pull_segment_step * (max_segments - 1);
     fbank->temp_segments_count = fbank->temp_segments_y * fbank->num_fft_bins;
     fbank->temp_segments = (float*)calloc(fbank->temp_segments_count, sizeof(float));
+    touch_pages(fbank->temp_segments, fbank->temp_segments_count * sizeof(float));
 
     fbank->temp_segment_tail = 0;
     fbank->temp_segment_head = 0;
@@ -160,8 +166,9 @@ OnlineFBank make_fbank(FBankOptions opts) {
     fbank->ret  = (double*)calloc(fbank->padded_window_size + 1, sizeof(double));
 
     fbank->speed_factor = 1.0;
+    fbank->keep_accumulator = 1.0;
 
-    if(opts.use_sonic) {
+    if(opts.use_sonic && !opts.use_frame_dropping) {
         fbank->sonic_stream = sonicCreateStream(opts.sample_freq, 1);
     } else {
         fbank->sonic_stream = NULL;
@@ -172,6 +179,10 @@ OnlineFBank make_fbank(FBankOptions opts) {
 
 const float ZEROS[32768] = { 0 };
 void fbank_accept_waveform(OnlineFBank fbank, float *wave, size_t wave_count) {
+    // Padding from flushing is never dropped
+    bool drop_frames = (wave != NULL) && fbank->opts.use_frame_dropping && (fbank->speed_factor > 1.0);
+    double keep_ratio = 1.0 / fbank->speed_factor;
+
     if(wave == NULL) wave = ZEROS;
     else if(fbank->sonic_stream != NULL) {
         sonicSetSpeed(fbank->sonic_stream, (float)fbank->speed_factor);
@@ -225,6 +236,15 @@ void fbank_accept_waveform(OnlineFBank fbank, float *wave, size_t wave_count) {
             return;
         }
 
+        // Keep 1 out of every speed_factor frames, skipping the rest before
+        // any work is done on them
+        if(drop_frames) {
+            fbank->keep_accumulator += keep_ratio;
+            if(fbank->keep_accumulator < 1.0) continue;
+
+            fbank->keep_accumulator -= 1.0;
+        }
+
         for(int j=0; j<fbank->padded_window_size; j++){
             ssize_t wave_idx = start_idx + j;
             if(wave_idx < 0){
@@ -309,7 +329,10 @@ bool fbank_flush(OnlineFBank fbank) {
     ssize_t min = -(fbank->opts.pull_segment_count * 3);
     if(fbank->temp_segment_avail_f < min) return false;
 
-    while(fbank->temp_segment_avail < fbank->opts.pull_segment_count) {
+    size_t min_segments = fbank->opts.pull_min_segments > 1 ? fbank->opts.pull_min_segments : 1;
+    size_t target = fbank->opts.pull_segment_count + fbank->opts.pull_segment_step * (min_segments - 1);
+
+    while(fbank->temp_segment_avail < target) {
         float *out = &fbank->temp_segments[fbank->temp_segment_head * fbank->opts.num_bins];
         for(int mel=0; mel<fbank->opts.num_bins; mel++){
             out[mel] = (float)log((double)kEps);
@@ -348,6 +371,34 @@ bool fbank_pull_segments(OnlineFBank fbank, float *output, size_t output_count)
     return true;
 }
 
+size_t fbank_pull_segments_n(OnlineFBank fbank, float *output, size_t min_segments, size_t max_segments) {
+    size_t count = fbank->opts.pull_segment_count;
+    size_t step = fbank->opts.pull_segment_step;
+
+    if(fbank->temp_segment_avail < count) return 0;
+
+    size_t segments = (fbank->temp_segment_avail - count) / step + 1;
+    if(segments < min_segments) return 0;
+    if(segments > max_segments) segments = max_segments;
+
+    size_t frames = count + step * (segments - 1);
+    for(size_t i=0; i<frames; i++){
+        size_t curr_idx = (fbank->temp_segment_tail + i) % fbank->temp_segments_y;
+        memcpy(
+            &output[i * fbank->opts.num_bins],
+            &fbank->temp_segments[curr_idx * fbank->opts.num_bins],
+            fbank->opts.num_bins * sizeof(float)
+        );
+    }
+
+    fbank->temp_segment_tail += step * segments;
+    fbank->temp_segment_tail = fbank->temp_segment_tail % fbank->temp_segments_y;
+    fbank->temp_segment_avail -= step * segments;
+    fbank->temp_segment_avail_f -= step * segments;
+
+    return segments;
+}
+
 void fbank_set_speed(OnlineFBank fbank, double factor) {
     fbank->speed_factor = factor;
 }
@@ -58,9 +58,24 @@ typedef struct FBankOptions {
     // will step over 4 segments
     int pull_segment_step;
 
+    // Smallest number of segments the caller pulls at once with
+    // fbank_pull_segments_n. fbank_flush pads enough frames for this many.
+    // If 0, 1 is assumed
+    int pull_min_segments;
+
+    // Largest number of segments the caller waits for before pulling with
+    // fbank_pull_segments_n. The buffer is sized to hold them. If 0, 1 is
+    // assumed
+    int pull_max_segments;
+
     // If false, speed feature will be unavailable
     bool use_sonic;
 
+    // If set, speeding up skips computing some feature frames instead of
+    // time-stretching the audio with sonic. Costs nothing, but the skipped
+    // frames are lost. Takes precedence over use_sonic
+    bool use_frame_dropping;
+
     bool remove_dc_offset; // true
     float preemph_coeff; // 0.97
 } FBankOptions;
@@ -68,6 +83,12 @@ typedef struct FBankOptions {
 OnlineFBank make_fbank(FBankOptions opts);
 void fbank_accept_waveform(OnlineFBank fbank, float *wave, size_t wave_count);
 bool fbank_pull_segments(OnlineFBank fbank, float *output, size_t output_count);
+
+// Pulls up to max_segments consecutive segments at once, as one block of
+// pull_segment_count + pull_segment_step * (n - 1) frames. Output must have
+// room for max_segments. Returns the number of segments n pulled, or 0 if
+// fewer than min_segments are available
+size_t fbank_pull_segments_n(OnlineFBank fbank, float *output, size_t min_segments, size_t max_segments);
 bool fbank_flush(OnlineFBank fbank); // Returns false if no more left to flush
 
 void fbank_set_speed(OnlineFBank fbank, double factor);
@@ -24,10 +24,15 @@
     [2]: joiner   */
 #define LSTM_TRANSDUCER_STATELESS_NETWORK_COUNT 3
 
+/*  [0]: encoder
+    [1]: decoder and joiner fused into one network */
+#define LSTM_TRANSDUCER_STATELESS_FUSED_NETWORK_COUNT 2
+
 typedef enum ModelType {
     MODEL_UNKNOWN = 0,
     MODEL_LSTM_TRANSDUCER_STATELESS = 1,
-    MODEL_MAX = 2,
+    MODEL_LSTM_TRANSDUCER_STATELESS_FUSED = 2,
+    MODEL_MAX = 3,
 } ModelType;
 
 
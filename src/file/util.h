@@ -20,12 +20,14 @@
 #ifdef _MSC_VER
 
 // Assuming Windows is always little-endian
+#define le16toh(x) x
 #define le32toh(x) x
 #define le64toh(x) x
 
 #elif __APPLE__
 
 // Assuming OSX is always little-endian
+#define le16toh(x) x
 #define le32toh(x) x
 #define le64toh(x) x
 
@@ -38,6 +40,13 @@
 #include <stdio.h>
 #include "log.h"
 
+static inline uint16_t mfu_read_u16(FILE *fd) {
+    uint16_t v;
+    fread(&v, sizeof(uint16_t), 1, fd);
+    v = le16toh(v);
+    return v;
+}
+
 static inline uint32_t mfu_read_u32(FILE *fd) {
     uint32_t v;
     fread(&v, sizeof(uint32_t), 1, fd);
@@ -79,4 +88,36 @@ static inline char *mfu_alloc_read_string(FILE *fd) {
     return v;
 }
 
+// For files the library writes itself, such as recordings and dumps.
+// Fields are put into and taken out of byte buffers one byte at a time,
+// so they are little endian whatever the host is
+static inline void mfu_put_u16(uint8_t *b, uint16_t v) {
+    b[0] = (uint8_t)v;
+    b[1] = (uint8_t)(v >> 8);
+}
+
+static inline void mfu_put_u32(uint8_t *b, uint32_t v) {
+    for(int i=0; i<4; i++) b[i] = (uint8_t)(v >> (8 * i));
+}
+
+static inline void mfu_put_u64(uint8_t *b, uint64_t v) {
+    for(int i=0; i<8; i++) b[i] = (uint8_t)(v >> (8 * i));
+}
+
+static inline uint16_t mfu_get_u16(const uint8_t *b) {
+    return (uint16_t)(b[0] | (b[1] << 8));
+}
+
+static inline uint32_t mfu_get_u32(const uint8_t *b) {
+    uint32_t v = 0;
+    for(int i=0; i<4; i++) v |= (uint32_t)b[i] << (8 * i);
+    return v;
+}
+
+static inline uint64_t mfu_get_u64(const uint8_t *b) {
+    uint64_t v = 0;
+    for(int i=0; i<8; i++) v |= (uint64_t)b[i] << (8 * i);
+    return v;
+}
+
 #endif
\ No newline at end of file
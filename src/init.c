@@ -25,6 +25,8 @@
 #include "onnxruntime_c_api.h"
 #include "ort_util.h"
 #include "log.h"
+#include "scheduler.h"
+#include "april_model.h"
 
 int g_client_version = 0;
 const OrtApi* g_ort = NULL;
@@ -48,4 +50,11 @@ void aam_api_init(int version){
         LOG_ERROR("Failed to init ONNX Runtime engine!");
         exit(-1);
     }
+
+    sched_init();
+    aam_registry_init();
+}
+
+void aam_set_max_concurrent_inference(size_t count) {
+    sched_set_max_concurrent(count);
 }
\ No newline at end of file
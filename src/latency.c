@@ -0,0 +1,301 @@
+/*
+ * Copyright (C) 2022 abb128
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+#include "log.h"
+#include "latency.h"
+
+#ifndef USE_TINYCTHREAD
+#include <threads.h>
+#else
+#include "tinycthread/tinycthread.h"
+#endif
+
+#define LATENCY_HALF_BUCKETS (LATENCY_EXACT_BUCKETS / 2)
+#define LATENCY_BUCKET_COUNT (LATENCY_EXACT_BUCKETS + (LATENCY_MAX_BITS - LATENCY_SUB_BUCKET_BITS - 1) * LATENCY_HALF_BUCKETS)
+#define LATENCY_MAX_VALUE ((((uint64_t)1) << LATENCY_MAX_BITS) - 1)
+
+// Feeds not yet reached by the decoder. The async buffer holds 3 seconds,
+// so this is only exceeded when feeding under 3 ms at a time
+#define LATENCY_MAX_MARKS 1024
+
+typedef struct LatencyMark {
+    // Total samples fed up to the end of this feed
+    uint64_t end_sample;
+    uint64_t arrival_us;
+
+    // Marks a flush, whose padding arrives with it
+    bool flush;
+} LatencyMark;
+
+struct LatencyTracker_i {
+    mtx_t mutex;
+    bool mutex_init;
+
+    LatencyMark marks[LATENCY_MAX_MARKS];
+    size_t mark_head;
+    size_t mark_count;
+
+    uint64_t fed_samples;
+    bool last_was_flush;
+
+    double decoded_samples;
+
+    uint64_t buckets[LATENCY_BUCKET_COUNT];
+    uint64_t total_count;
+    uint64_t total_us;
+    uint64_t min_us;
+    uint64_t max_us;
+};
+
+static uint64_t lt_now_us(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+static size_t lt_bucket_index(uint64_t value) {
+    if(value > LATENCY_MAX_VALUE) value = LATENCY_MAX_VALUE;
+    if(value < LATENCY_EXACT_BUCKETS) return (size_t)value;
+
+    size_t msb = 0;
+    while((value >> (msb + 1)) != 0) msb++;
+
+    // Keeps the top LATENCY_SUB_BUCKET_BITS + 1 bits, so sub is in
+    // [LATENCY_HALF_BUCKETS, LATENCY_EXACT_BUCKETS)
+    size_t shift = msb - LATENCY_SUB_BUCKET_BITS;
+    size_t sub = (size_t)(value >> shift);
+
+    return LATENCY_EXACT_BUCKETS + (shift - 1) * LATENCY_HALF_BUCKETS + (sub - LATENCY_HALF_BUCKETS);
+}
+
+// Highest value that falls into the bucket
+static uint64_t lt_bucket_upper(size_t index) {
+    if(index < LATENCY_EXACT_BUCKETS) return index;
+
+    size_t shift = (index - LATENCY_EXACT_BUCKETS) / LATENCY_HALF_BUCKETS + 1;
+    uint64_t sub = (index - LATENCY_EXACT_BUCKETS) % LATENCY_HALF_BUCKETS + LATENCY_HALF_BUCKETS;
+
+    return ((sub + 1) << shift) - 1;
+}
+
+LatencyTracker lt_create(void) {
+    LatencyTracker lt = (LatencyTracker)calloc(1, sizeof(struct LatencyTracker_i));
+    if(lt == NULL) return NULL;
+
+    if(mtx_init(&lt->mutex, mtx_plain) != thrd_success) {
+        LOG_ERROR("Failed to initialize latency tracker mutex");
+        lt_free(lt);
+        return NULL;
+    }
+    lt->mutex_init = true;
+
+    lt->min_us = UINT64_MAX;
+
+    return lt;
+}
+
+static LatencyMark *lt_newest_mark(LatencyTracker lt) {
+    if(lt->mark_count == 0) return NULL;
+    return &lt->marks[(lt->mark_head + lt->mark_count - 1) % LATENCY_MAX_MARKS];
+}
+
+static bool lt_push_mark(LatencyTracker lt, bool flush) {
+    if(lt->mark_count == LATENCY_MAX_MARKS) return false;
+
+    LatencyMark *mark = &lt->marks[(lt->mark_head + lt->mark_count) % LATENCY_MAX_MARKS];
+    mark->end_sample = lt->fed_samples;
+    mark->arrival_us = lt_now_us();
+    mark->flush = flush;
+
+    lt->mark_count++;
+    return true;
+}
+
+static void lt_pop_mark(LatencyTracker lt) {
+    lt->mark_head = (lt->mark_head + 1) % LATENCY_MAX_MARKS;
+    lt->mark_count--;
+}
+
+// Drops feeds the decoder has gone past. Flush marks stay until the flush
+// is done
+static void lt_prune(LatencyTracker lt) {
+    while(lt->mark_count > 0) {
+        LatencyMark *mark = &lt->marks[lt->mark_head];
+        if(mark->flush || ((double)mark->end_sample >= lt->decoded_samples)) break;
+
+        lt_pop_mark(lt);
+    }
+}
+
+void lt_feed(LatencyTracker lt, size_t short_count) {
+    if(short_count == 0) return;
+
+    mtx_lock(&lt->mutex);
+
+    lt->fed_samples += short_count;
+    lt->last_was_flush = false;
+
+    if(!lt_push_mark(lt, false)) {
+        // Merge into the newest feed, the delay of this audio will be
+        // somewhat underestimated
+        LatencyMark *newest = lt_newest_mark(lt);
+        if(!newest->flush) newest->end_sample = lt->fed_samples;
+    }
+
+    mtx_unlock(&lt->mutex);
+}
+
+void lt_flush(LatencyTracker lt) {
+    mtx_lock(&lt->mutex);
+
+    // A repeated flush does nothing in the session
+    if(!lt->last_was_flush) {
+        lt->last_was_flush = lt_push_mark(lt, true);
+    }
+
+    mtx_unlock(&lt->mutex);
+}
+
+void lt_advance(LatencyTracker lt, double short_count) {
+    mtx_lock(&lt->mutex);
+
+    lt->decoded_samples += short_count;
+    lt_prune(lt);
+
+    mtx_unlock(&lt->mutex);
+}
+
+void lt_emitted(LatencyTracker lt, size_t count) {
+    if(count == 0) return;
+
+    mtx_lock(&lt->mutex);
+
+    lt_prune(lt);
+
+    // No mark when replaying a dump, or when the decoder got to audio whose
+    // feed call hasn't returned yet
+    if(lt->mark_count == 0) {
+        mtx_unlock(&lt->mutex);
+        return;
+    }
+
+    uint64_t now = lt_now_us();
+    uint64_t arrival = lt->marks[lt->mark_head].arrival_us;
+    uint64_t delay_us = now > arrival ? (now - arrival) : 0;
+
+    lt->buckets[lt_bucket_index(delay_us)] += count;
+    lt->total_count += count;
+    lt->total_us += delay_us * count;
+    if(delay_us < lt->min_us) lt->min_us = delay_us;
+    if(delay_us > lt->max_us) lt->max_us = delay_us;
+
+    mtx_unlock(&lt->mutex);
+}
+
+void lt_flushed(LatencyTracker lt) {
+    mtx_lock(&lt->mutex);
+
+    uint64_t flushed_at = lt->fed_samples;
+    while(lt->mark_count > 0) {
+        LatencyMark mark = lt->marks[lt->mark_head];
+        lt_pop_mark(lt);
+
+        if(mark.flush) {
+            flushed_at = mark.end_sample;
+            break;
+        }
+    }
+
+    lt->decoded_samples = (double)flushed_at;
+
+    mtx_unlock(&lt->mutex);
+}
+
+static uint64_t lt_percentile_locked(LatencyTracker lt, double percentile) {
+    if(lt->total_count == 0) return 0;
+
+    if(percentile < 0.0) percentile = 0.0;
+    if(percentile > 100.0) percentile = 100.0;
+
+    uint64_t target = (uint64_t)((percentile / 100.0) * (double)lt->total_count + 0.5);
+    if(target < 1) target = 1;
+
+    uint64_t seen = 0;
+    for(size_t i=0; i<LATENCY_BUCKET_COUNT; i++) {
+        seen += lt->buckets[i];
+        if(seen >= target) {
+            uint64_t upper = lt_bucket_upper(i);
+            return upper < lt->max_us ? upper : lt->max_us;
+        }
+    }
+
+    return lt->max_us;
+}
+
+void lt_get_stats(LatencyTracker lt, AprilLatencyStats *stats) {
+    mtx_lock(&lt->mutex);
+
+    memset(stats, 0, sizeof(AprilLatencyStats));
+    stats->count = (size_t)lt->total_count;
+    if(lt->total_count > 0) {
+        stats->min_us = lt->min_us;
+        stats->max_us = lt->max_us;
+        stats->mean_us = lt->total_us / lt->total_count;
+        stats->p50_us = lt_percentile_locked(lt, 50.0);
+        stats->p90_us = lt_percentile_locked(lt, 90.0);
+        stats->p99_us = lt_percentile_locked(lt, 99.0);
+        stats->p999_us = lt_percentile_locked(lt, 99.9);
+    }
+
+    mtx_unlock(&lt->mutex);
+}
+
+uint64_t lt_get_percentile_us(LatencyTracker lt, double percentile) {
+    mtx_lock(&lt->mutex);
+    uint64_t value = lt_percentile_locked(lt, percentile);
+    mtx_unlock(&lt->mutex);
+
+    return value;
+}
+
+void lt_reset(LatencyTracker lt) {
+    mtx_lock(&lt->mutex);
+
+    memset(lt->buckets, 0, sizeof(lt->buckets));
+    lt->total_count = 0;
+    lt->total_us = 0;
+    lt->min_us = UINT64_MAX;
+    lt->max_us = 0;
+
+    mtx_unlock(&lt->mutex);
+}
+
+void lt_free(LatencyTracker lt) {
+    if(lt == NULL) return;
+
+    if(lt->mutex_init) mtx_destroy(&lt->mutex);
+    free(lt);
+}
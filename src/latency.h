@@ -0,0 +1,65 @@
+/*
+ * Copyright (C) 2022 abb128
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef _APRIL_LATENCY
+#define _APRIL_LATENCY
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+#include "april_api.h"
+
+// Tracks how long it takes from audio being fed to a token from that audio
+// being emitted. Feeds are timestamped as they arrive, and the decoder
+// looks up the arrival time of the audio it has reached when it emits a
+// token. The delays go into a log-bucketed histogram, like HdrHistogram:
+// values below LATENCY_EXACT_BUCKETS us are exact, above that each power
+// of two is split into LATENCY_EXACT_BUCKETS/2 buckets, so percentiles are
+// accurate to about 3%
+
+#define LATENCY_SUB_BUCKET_BITS 5
+#define LATENCY_EXACT_BUCKETS (1 << (LATENCY_SUB_BUCKET_BITS + 1))
+
+// Delays above 2^40 us (about 12 days) are counted in the last bucket
+#define LATENCY_MAX_BITS 40
+
+struct LatencyTracker_i;
+typedef struct LatencyTracker_i *LatencyTracker;
+
+// Calls may come from any thread
+LatencyTracker lt_create(void);
+
+// Called by the public feed and flush calls, when the audio arrives
+void lt_feed(LatencyTracker lt, size_t short_count);
+void lt_flush(LatencyTracker lt);
+
+// Called by the decoder. lt_advance moves over decoded input audio, and
+// lt_emitted records the delay of `count` tokens emitted at that point.
+// lt_flushed realigns with the fed audio once a flush is done, since the
+// padding added by a flush was never fed
+void lt_advance(LatencyTracker lt, double short_count);
+void lt_emitted(LatencyTracker lt, size_t count);
+void lt_flushed(LatencyTracker lt);
+
+void lt_get_stats(LatencyTracker lt, AprilLatencyStats *stats);
+uint64_t lt_get_percentile_us(LatencyTracker lt, double percentile);
+void lt_reset(LatencyTracker lt);
+
+void lt_free(LatencyTracker lt);
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * Copyright (C) 2022 abb128
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <stdint.h>
+#include "common.h"
+#include "logits.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && (_M_IX86_FP >= 2))
+#define LOGITS_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+#ifdef LOGITS_USE_SSE2
+
+static inline float hmax_ps(__m128 v) {
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(v);
+}
+
+static inline float hsum_ps(__m128 v) {
+    v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_add_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 0, 3, 2)));
+    return _mm_cvtss_f32(v);
+}
+
+// exp(x) for x <= 0, relative error around 2e-7. Splits x into n*ln2 + r
+// and evaluates a degree 5 polynomial for exp(r), then scales by 2^n
+// through the exponent bits.
+static inline __m128 exp_neg_ps(__m128 x) {
+    x = _mm_max_ps(x, _mm_set1_ps(-87.0f));
+
+    __m128i n = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.44269504088896341f)));
+    __m128 nf = _mm_cvtepi32_ps(n);
+
+    __m128 r = _mm_sub_ps(x, _mm_mul_ps(nf, _mm_set1_ps(0.693359375f)));
+    r = _mm_sub_ps(r, _mm_mul_ps(nf, _mm_set1_ps(-2.12194440e-4f)));
+
+    __m128 p = _mm_set1_ps(1.9875691500E-4f);
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.3981999507E-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(8.3334519073E-3f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(4.1665795894E-2f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(1.6666665459E-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(5.0000001201E-1f));
+    p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, r), r), r);
+    p = _mm_add_ps(p, _mm_set1_ps(1.0f));
+
+    __m128i pow2n = _mm_slli_epi32(_mm_add_epi32(n, _mm_set1_epi32(127)), 23);
+    return _mm_mul_ps(p, _mm_castsi128_ps(pow2n));
+}
+
+static float range_max(const float *v, size_t n) {
+    float result = -INFINITY;
+    size_t i = 0;
+
+    if(n >= 8) {
+        __m128 m0 = _mm_loadu_ps(&v[0]);
+        __m128 m1 = _mm_loadu_ps(&v[4]);
+        for(i=8; (i + 8) <= n; i += 8) {
+            m0 = _mm_max_ps(m0, _mm_loadu_ps(&v[i]));
+            m1 = _mm_max_ps(m1, _mm_loadu_ps(&v[i + 4]));
+        }
+        result = hmax_ps(_mm_max_ps(m0, m1));
+    }
+
+    for(; i<n; i++) {
+        if(v[i] > result) result = v[i];
+    }
+
+    return result;
+}
+
+static size_t find_first(const float *v, size_t n, float value, size_t skip) {
+    __m128 target = _mm_set1_ps(value);
+    size_t i = 0;
+    for(; (i + 4) <= n; i += 4) {
+        int mask = _mm_movemask_ps(_mm_cmpeq_ps(_mm_loadu_ps(&v[i]), target));
+        while(mask != 0) {
+            size_t lane = 0;
+            while(((mask >> lane) & 1) == 0) lane++;
+
+            if((i + lane) != skip) return i + lane;
+            mask &= ~(1 << lane);
+        }
+    }
+
+    for(; i<n; i++) {
+        if((v[i] == value) && (i != skip)) return i;
+    }
+
+    return n;
+}
+
+float logits_logsumexp(const float *logits, size_t count, float max_val) {
+    __m128 vmax = _mm_set1_ps(max_val);
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+
+    size_t i = 0;
+    for(; (i + 8) <= count; i += 8) {
+        acc0 = _mm_add_ps(acc0, exp_neg_ps(_mm_sub_ps(_mm_loadu_ps(&logits[i]), vmax)));
+        acc1 = _mm_add_ps(acc1, exp_neg_ps(_mm_sub_ps(_mm_loadu_ps(&logits[i + 4]), vmax)));
+    }
+
+    float sum = hsum_ps(_mm_add_ps(acc0, acc1));
+    for(; i<count; i++) {
+        sum += expf(logits[i] - max_val);
+    }
+
+    return max_val + logf(sum);
+}
+
+#else
+
+static float range_max(const float *v, size_t n) {
+    float result = -INFINITY;
+    for(size_t i=0; i<n; i++) {
+        if(v[i] > result) result = v[i];
+    }
+
+    return result;
+}
+
+static size_t find_first(const float *v, size_t n, float value, size_t skip) {
+    for(size_t i=0; i<n; i++) {
+        if((v[i] == value) && (i != skip)) return i;
+    }
+
+    return n;
+}
+
+float logits_logsumexp(const float *logits, size_t count, float max_val) {
+    float sum = 0.0f;
+    for(size_t i=0; i<count; i++) {
+        sum += expf(logits[i] - max_val);
+    }
+
+    return max_val + logf(sum);
+}
+
+#endif
+
+// Two passes: a vectorized max, then a vectorized search for the first
+// element equal to it. Both are much cheaper than tracking indices per lane.
+size_t logits_argmax(const float *logits, size_t count, size_t skip, float *max_val) {
+    float result;
+    if(skip < count) {
+        float before = range_max(logits, skip);
+        float after = range_max(&logits[skip + 1], count - skip - 1);
+        result = before > after ? before : after;
+    } else {
+        result = range_max(logits, count);
+    }
+
+    *max_val = result;
+    size_t index = find_first(logits, count, result, skip);
+
+    // NaNs never compare equal, so if the logits are all NaN nothing is found
+    if(index >= count) {
+        *max_val = -INFINITY;
+        return skip < count ? skip : 0;
+    }
+
+    return index;
+}
@@ -0,0 +1,35 @@
+/*
+ * Copyright (C) 2022 abb128
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _APRIL_LOGITS
+#define _APRIL_LOGITS
+
+#include <stddef.h>
+#include "common.h"
+
+// Returns the index of the largest value in logits[0..count), ignoring the
+// value at index `skip` (pass count or larger to skip nothing). The value
+// is written to max_val. Ties resolve to the lowest index. If there is no
+// largest value because of NaNs, returns `skip` (0 if out of range) with a
+// max_val of -INFINITY.
+size_t logits_argmax(const float *logits, size_t count, size_t skip, float *max_val);
+
+// Returns log(sum(exp(logits))), computed stably. `max_val` must be the
+// maximum of logits. Subtract the result from a logit to get its
+// log-probability under softmax.
+float logits_logsumexp(const float *logits, size_t count, float max_val);
+
+#endif
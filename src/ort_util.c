@@ -48,3 +48,53 @@ size_t output_dims(OrtSession* session, size_t idx, int64_t *dimensions, size_t
 
     return num;
 }
+
+ONNXTensorElementDataType input_type(OrtSession* session, size_t idx) {
+    ONNXTensorElementDataType type;
+    OrtTypeInfo *info;
+    const OrtTensorTypeAndShapeInfo *tinfo;
+    ORT_ABORT_ON_ERROR(g_ort->SessionGetInputTypeInfo(session, idx, &info));
+    ORT_ABORT_ON_ERROR(g_ort->CastTypeInfoToTensorInfo(info, &tinfo));
+    assert(tinfo != NULL);
+    ORT_ABORT_ON_ERROR(g_ort->GetTensorElementType(tinfo, &type));
+    g_ort->ReleaseTypeInfo(info);
+
+    return type;
+}
+
+ONNXTensorElementDataType output_type(OrtSession* session, size_t idx) {
+    ONNXTensorElementDataType type;
+    OrtTypeInfo *info;
+    const OrtTensorTypeAndShapeInfo *tinfo;
+    ORT_ABORT_ON_ERROR(g_ort->SessionGetOutputTypeInfo(session, idx, &info));
+    ORT_ABORT_ON_ERROR(g_ort->CastTypeInfoToTensorInfo(info, &tinfo));
+    assert(tinfo != NULL);
+    ORT_ABORT_ON_ERROR(g_ort->GetTensorElementType(tinfo, &type));
+    g_ort->ReleaseTypeInfo(info);
+
+    return type;
+}
+
+OrtIoBinding *create_io_binding(OrtSession *session,
+                                const char **input_names, const OrtValue **inputs, size_t num_inputs,
+                                const char **output_names, OrtValue **outputs, size_t num_outputs) {
+    OrtIoBinding *binding;
+    ORT_ABORT_ON_ERROR(g_ort->CreateIoBinding(session, &binding));
+
+    for(size_t i=0; i<num_inputs; i++) {
+        ORT_ABORT_ON_ERROR(g_ort->BindInput(binding, input_names[i], inputs[i]));
+    }
+
+    for(size_t i=0; i<num_outputs; i++) {
+        ORT_ABORT_ON_ERROR(g_ort->BindOutput(binding, output_names[i], outputs[i]));
+    }
+
+    return binding;
+}
+
+void free_io_binding(OrtIoBinding **binding) {
+    if(*binding == NULL) return;
+
+    g_ort->ReleaseIoBinding(*binding);
+    *binding = NULL;
+}
@@ -111,6 +111,19 @@ static inline void free_tensori(TensorI *f) {
 size_t input_dims(OrtSession* session, size_t idx, int64_t *dimensions, size_t dim_size);
 size_t output_dims(OrtSession* session, size_t idx, int64_t *dimensions, size_t dim_size);
 
+ONNXTensorElementDataType input_type(OrtSession* session, size_t idx);
+ONNXTensorElementDataType output_type(OrtSession* session, size_t idx);
+
+// Binds the inputs and outputs once, so that runs through RunWithBinding do
+// not need to look up names or validate the values again. The values must
+// stay alive for the lifetime of the binding
+OrtIoBinding *create_io_binding(OrtSession *session,
+                                const char **input_names, const OrtValue **inputs, size_t num_inputs,
+                                const char **output_names, OrtValue **outputs, size_t num_outputs);
+
+// Releases the binding if non-NULL, and sets it to NULL
+void free_io_binding(OrtIoBinding **binding);
+
 static inline size_t input_count(OrtSession *session) {
     size_t num;
     ORT_ABORT_ON_ERROR(g_ort->SessionGetInputCount(session, &num));
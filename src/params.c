@@ -28,8 +28,22 @@
 
 #define ASSERT_OR_RETURN_FALSE(expr) if(!(expr)) { LOG_WARNING("Params: assertion " #expr " failed, line %d", __LINE__); return false; }
 
-char *get_token(ModelParameters *params, size_t token_index){
-    return &params->tokens[params->token_length * token_index];
+static uint8_t classify_token(const char *token) {
+    uint8_t cls = 0;
+
+    // works for English and other latin languages, may need to do something
+    // different here for other languages like Chinese
+    if(token[0] == ' ') cls |= TOKEN_CLASS_WORD_BOUNDARY_BIT;
+    if((token[0] >= '0') && (token[0] <= '9')) cls |= TOKEN_CLASS_LEADING_DIGIT_BIT;
+
+    bool is_single_character = (token[0] != 0) && (token[1] == 0);
+    bool is_end_of_sentence = is_single_character && ( (token[0] == '.') || (token[0] == '!') || (token[0] == '?') );
+    bool is_punctuation = is_end_of_sentence || (is_single_character && (token[0] == ','));
+
+    if(is_end_of_sentence) cls |= TOKEN_CLASS_SENTENCE_END_BIT;
+    if(is_punctuation) cls |= TOKEN_CLASS_PUNCTUATION_BIT;
+
+    return cls;
 }
 
 bool read_params(ModelParameters *params, const char *path) {
@@ -42,16 +56,23 @@ bool read_params(ModelParameters *params, const char *path) {
     return result;
 }
 
-const char *PARAMS_EXPECTED_MAGIC = "PARAMS\0\0";
+// The last two bytes of the magic are the params version (uint16)
+const char *PARAMS_EXPECTED_MAGIC = "PARAMS";
 bool read_params_from_fd(ModelParameters *params, FILE *fd) {
-    char magic[8];
-    fread(magic, 1, 8, fd);
+    char magic[6];
+    fread(magic, 1, 6, fd);
 
-    if(memcmp(magic, PARAMS_EXPECTED_MAGIC, 8) != 0) {
+    if(memcmp(magic, PARAMS_EXPECTED_MAGIC, 6) != 0) {
         LOG_INFO("magic check failed for params");
         return false;
     }
 
+    params->version = (int)mfu_read_u16(fd);
+    if(params->version > PARAMS_VERSION_CURRENT) {
+        LOG_WARNING("Unsupported params version %d", params->version);
+        return false;
+    }
+
     params->batch_size   = mfu_read_i32(fd);
     params->segment_size = mfu_read_i32(fd);
     params->segment_step = mfu_read_i32(fd);
@@ -68,6 +89,16 @@ bool read_params_from_fd(ModelParameters *params, FILE *fd) {
     params->token_count  = mfu_read_i32(fd);
     params->blank_id     = mfu_read_i32(fd);
 
+    params->precision = APRIL_MODEL_PRECISION_FP32;
+    if(params->version >= 1) {
+        params->precision = (AprilModelPrecision)mfu_read_i32(fd);
+    }
+
+    params->max_encoder_segments = 1;
+    if(params->version >= 2) {
+        params->max_encoder_segments = mfu_read_i32(fd);
+    }
+
     ASSERT_OR_RETURN_FALSE(params->batch_size == 1);
     ASSERT_OR_RETURN_FALSE((params->segment_size > 0) && (params->segment_size < 100));
     ASSERT_OR_RETURN_FALSE((params->segment_step > 0) && (params->segment_step < 100) && (params->segment_step <= params->segment_size));
@@ -75,6 +106,8 @@ bool read_params_from_fd(ModelParameters *params, FILE *fd) {
     ASSERT_OR_RETURN_FALSE((params->sample_rate > 0) && (params->sample_rate < 144000));
     ASSERT_OR_RETURN_FALSE((params->token_count > 0) && (params->token_count < 16384));
     ASSERT_OR_RETURN_FALSE((params->blank_id >= 0) && (params->blank_id < params->token_count));
+    ASSERT_OR_RETURN_FALSE((params->precision >= APRIL_MODEL_PRECISION_FP32) && (params->precision <= APRIL_MODEL_PRECISION_INT8));
+    ASSERT_OR_RETURN_FALSE((params->max_encoder_segments > 0) && (params->max_encoder_segments < 1000));
 
     ASSERT_OR_RETURN_FALSE((params->frame_shift_ms > 0) && (params->frame_shift_ms <= params->frame_length_ms));
     ASSERT_OR_RETURN_FALSE((params->frame_length_ms > 0) && (params->frame_length_ms <= 5000));
@@ -82,35 +115,48 @@ bool read_params_from_fd(ModelParameters *params, FILE *fd) {
     ASSERT_OR_RETURN_FALSE((params->mel_high == 0) || (params->mel_high > params->mel_low));
 
 
-    // Read all piece lengths and figure out the maximum
-    size_t tokens_start = ftell(fd);
+    // Read all tokens in a single pass into a packed pool
+    params->token_offsets = (uint32_t *)calloc(params->token_count, sizeof(uint32_t));
+    params->token_classes = (uint8_t *)calloc(params->token_count, sizeof(uint8_t));
+
+    size_t pool_capacity = params->token_count * 8;
+    params->token_pool = (char *)malloc(pool_capacity);
+    params->token_pool_size = 0;
+
+    ASSERT_OR_RETURN_FALSE((params->token_offsets != NULL) && (params->token_classes != NULL) && (params->token_pool != NULL));
 
-    params->token_length = 0;
     for(int i=0; i<params->token_count; i++){
         int32_t token_len = mfu_read_i32(fd);
-        if(token_len > (int32_t)params->token_length)
-            params->token_length = token_len;
 
-        fseek(fd, token_len, SEEK_CUR);
-    }
-    params->token_length += 1; // for '\0' byte
+        ASSERT_OR_RETURN_FALSE((token_len >= 0) && (token_len < 65536));
 
-    // Allocate the memory
-    params->tokens = (char *)calloc(params->token_count, params->token_length);
+        size_t required = params->token_pool_size + token_len + 1;
+        if(required > pool_capacity) {
+            while(required > pool_capacity) pool_capacity *= 2;
 
-    // Rewind back and read
-    fseek(fd, tokens_start, SEEK_SET);
-    for(int i=0; i<params->token_count; i++){
-        int32_t token_len = mfu_read_i32(fd);
+            char *new_pool = (char *)realloc(params->token_pool, pool_capacity);
+            ASSERT_OR_RETURN_FALSE(new_pool != NULL);
+            params->token_pool = new_pool;
+        }
 
-        ASSERT_OR_RETURN_FALSE(token_len < (int32_t)params->token_length);
+        char *token = &params->token_pool[params->token_pool_size];
+        ASSERT_OR_RETURN_FALSE(fread(token, 1, token_len, fd) == (size_t)token_len);
+        token[token_len] = '\0';
 
-        fread(get_token(params, i), 1, token_len, fd);
+        params->token_offsets[i] = (uint32_t)params->token_pool_size;
+        params->token_classes[i] = classify_token(token);
+        params->token_pool_size = required;
     }
 
+    // Give back the unused capacity
+    char *shrunk_pool = (char *)realloc(params->token_pool, params->token_pool_size);
+    if(shrunk_pool != NULL) params->token_pool = shrunk_pool;
+
     return true;
 }
 
 void free_params(ModelParameters *params){
-    free(params->tokens);
+    free(params->token_pool);
+    free(params->token_offsets);
+    free(params->token_classes);
 }
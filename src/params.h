@@ -22,8 +22,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "common.h"
+#include "april_api.h"
+
+// Version 0 files have no fields past blank_id. Version 1 adds precision,
+// version 2 adds max_encoder_segments.
+#define PARAMS_VERSION_CURRENT 2
 
 typedef struct ModelParameters {
+    int version;
+
     int batch_size;
     int segment_size;
     int segment_step;
@@ -39,13 +46,48 @@ typedef struct ModelParameters {
 
     int blank_id;
 
+    AprilModelPrecision precision;
+
+    // How many segments the encoder may take per run if its time axis is
+    // dynamic. 1 unless the exporter says so
+    int max_encoder_segments;
+
     int token_count;
-    size_t token_length;
-    
-    char *tokens;
+
+    // All tokens packed back to back, each null-terminated
+    char *token_pool;
+    size_t token_pool_size;
+
+    // Offset of each token into token_pool, of size token_count
+    uint32_t *token_offsets;
+
+    // TokenClassBits of each token, of size token_count
+    uint8_t *token_classes;
 } ModelParameters;
 
-char *get_token(ModelParameters *params, size_t token_index);
+// Precomputed per-token properties, so the decoder does not need to inspect
+// the token strings. The first two bits match AprilTokenFlagBits.
+typedef enum TokenClassBits {
+    // Token starts with a space
+    TOKEN_CLASS_WORD_BOUNDARY_BIT = APRIL_TOKEN_FLAG_WORD_BOUNDARY_BIT,
+
+    // Token is exactly ".", "!" or "?"
+    TOKEN_CLASS_SENTENCE_END_BIT  = APRIL_TOKEN_FLAG_SENTENCE_END_BIT,
+
+    // Token is a single punctuation character: ".", "!", "?" or ","
+    TOKEN_CLASS_PUNCTUATION_BIT   = 0x04,
+
+    // Token starts with a digit 0-9
+    TOKEN_CLASS_LEADING_DIGIT_BIT = 0x08
+} TokenClassBits;
+
+static inline const char *get_token(const ModelParameters *params, size_t token_index) {
+    return &params->token_pool[params->token_offsets[token_index]];
+}
+
+static inline uint8_t get_token_class(const ModelParameters *params, size_t token_index) {
+    return params->token_classes[token_index];
+}
 
 // Returns false if reading failed
 bool read_params(ModelParameters *params, const char *path);
@@ -44,15 +44,27 @@ struct ProcThread_i {
 
     ProcThreadCallback callback;
     void *userdata;
+
+    ProcThreadInit init;
+    void *init_userdata;
+
+    ThreadOptions options;
 };
 
-ProcThread pt_create(ProcThreadCallback callback, void *userdata) {
+ProcThread pt_create(ProcThreadCallback callback, void *userdata, const ThreadOptions *options) {
+    return pt_create_with_init(callback, userdata, NULL, NULL, options);
+}
+
+ProcThread pt_create_with_init(ProcThreadCallback callback, void *userdata, ProcThreadInit init, void *init_userdata, const ThreadOptions *options) {
     ProcThread thread = (ProcThread)calloc(1, sizeof(struct ProcThread_i));
     if(thread == NULL) return NULL;
 
     thread->initialized = false;
     thread->callback = callback;
     thread->userdata = userdata;
+    thread->init = init;
+    thread->init_userdata = init_userdata;
+    if(options != NULL) thread->options = *options;
 
     if(cnd_init(&thread->cond) != thrd_success){
         LOG_WARNING("Failed to initialize cnd_t");
@@ -78,6 +90,11 @@ ProcThread pt_create(ProcThreadCallback callback, void *userdata) {
         thread->thrd_init = true;
     }
 
+    // init_userdata may be on the caller's stack
+    if(init != NULL) {
+        while(!thread->initialized) thrd_yield();
+    }
+
     return thread;
 }
 
@@ -138,6 +155,10 @@ void pt_free(ProcThread thread) {
 int run_pt(void *userdata){
     ProcThread thread = (ProcThread)userdata;
 
+    thread_apply_options(&thread->options);
+
+    if(thread->init != NULL) thread->init(thread->init_userdata);
+
     if(mtx_lock(&thread->mutex) != thrd_success){
         LOG_ERROR("Failed to lock mutex!");
         return 1;
@@ -145,9 +166,14 @@ int run_pt(void *userdata){
 
     for(;;){
         thread->initialized = true;
-        if(cnd_wait(&thread->cond, &thread->mutex) != thrd_success) {
-            LOG_ERROR("Failed to wait for cond!");
-            return 2;
+
+        // Flags raised while the callback was running are handled right
+        // away instead of waiting for the next signal
+        while(thread->flags == 0) {
+            if(cnd_wait(&thread->cond, &thread->mutex) != thrd_success) {
+                LOG_ERROR("Failed to wait for cond!");
+                return 2;
+            }
         }
 
         int flags = thread->flags;
@@ -18,6 +18,7 @@
 #define _APRIL_PROC_THREAD
 
 #include "common.h"
+#include "thread_opts.h"
 
 #define PT_FLAG_KILL 1
 #define PT_FLAG_AUDIO 2
@@ -27,8 +28,14 @@ struct ProcThread_i;
 
 typedef struct ProcThread_i * ProcThread;
 typedef void(*ProcThreadCallback)(void*, int);
+typedef void(*ProcThreadInit)(void*);
 
-ProcThread pt_create(ProcThreadCallback callback, void *userdata);
+// Options may be NULL, they are applied from the new thread itself
+ProcThread pt_create(ProcThreadCallback callback, void *userdata, const ThreadOptions *options);
+
+// Like pt_create, but the new thread first runs init(init_userdata) with
+// its options applied, and this only returns once init has
+ProcThread pt_create_with_init(ProcThreadCallback callback, void *userdata, ProcThreadInit init, void *init_userdata, const ThreadOptions *options);
 void pt_raise(ProcThread thread, int flag);
 void pt_free(ProcThread thread);
 
@@ -0,0 +1,244 @@
+/*
+ * Copyright (C) 2022 abb128
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "common.h"
+#include "log.h"
+#include "recorder.h"
+#include "file/util.h"
+
+#ifndef USE_TINYCTHREAD
+#include <threads.h>
+#else
+#include "tinycthread/tinycthread.h"
+#endif
+
+static const char RECORDING_MAGIC[8] = { 'A', 'P', 'R', 'I', 'L', 'R', 'E', 'C' };
+
+// Sizes in the file, see recorder.h for the layout
+#define RECORDING_HEADER_SIZE 24
+#define RECORDED_EVENT_HEADER_SIZE 16
+
+// Samples are converted to little endian this many at a time
+#define SAMPLES_PER_WRITE 512
+
+typedef struct RecordingHeader {
+    uint32_t version;
+    uint32_t sample_rate;
+    uint32_t config_flags;
+} RecordingHeader;
+
+struct Recorder_i {
+    FILE *fd;
+    uint64_t start_us;
+
+    bool mutex_init;
+    mtx_t mutex;
+};
+
+struct RecordingReader_i {
+    FILE *fd;
+    RecordingHeader header;
+
+    short *samples;
+    size_t samples_capacity;
+};
+
+uint64_t rec_now_us(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+Recorder rec_create(const char *path, size_t sample_rate, uint32_t config_flags) {
+    Recorder rec = (Recorder)calloc(1, sizeof(struct Recorder_i));
+    if(rec == NULL) return NULL;
+
+    if(mtx_init(&rec->mutex, mtx_plain) != thrd_success) {
+        LOG_ERROR("Failed to initialize recorder mutex");
+        rec_free(rec);
+        return NULL;
+    }
+    rec->mutex_init = true;
+
+    rec->fd = fopen(path, "wb");
+    if(rec->fd == NULL) {
+        LOG_ERROR("Failed to open recording file %s", path);
+        rec_free(rec);
+        return NULL;
+    }
+
+    uint8_t header[RECORDING_HEADER_SIZE] = { 0 };
+    memcpy(header, RECORDING_MAGIC, sizeof(RECORDING_MAGIC));
+    mfu_put_u32(&header[8], RECORDING_VERSION);
+    mfu_put_u32(&header[12], (uint32_t)sample_rate);
+    mfu_put_u32(&header[16], config_flags);
+
+    if(fwrite(header, sizeof(header), 1, rec->fd) != 1) {
+        LOG_ERROR("Failed to write recording header to %s", path);
+        rec_free(rec);
+        return NULL;
+    }
+
+    rec->start_us = rec_now_us();
+
+    LOG_INFO("Recording session to %s", path);
+    return rec;
+}
+
+static bool rec_write_samples(FILE *fd, const short *pcm16, size_t short_count) {
+    uint8_t bytes[SAMPLES_PER_WRITE * 2];
+    for(size_t head = 0; head < short_count; head += SAMPLES_PER_WRITE) {
+        size_t count = short_count - head;
+        if(count > SAMPLES_PER_WRITE) count = SAMPLES_PER_WRITE;
+
+        for(size_t i=0; i<count; i++) mfu_put_u16(&bytes[i * 2], (uint16_t)pcm16[head + i]);
+
+        if(fwrite(bytes, 2, count, fd) != count) return false;
+    }
+
+    return true;
+}
+
+static void rec_write_event(Recorder rec, RecordedEventType type, const short *pcm16, size_t short_count, uint64_t time_us) {
+    uint8_t event[RECORDED_EVENT_HEADER_SIZE];
+    mfu_put_u32(&event[0], (uint32_t)type);
+    mfu_put_u32(&event[4], (uint32_t)short_count);
+
+    mtx_lock(&rec->mutex);
+
+    mfu_put_u64(&event[8], time_us > rec->start_us ? time_us - rec->start_us : 0);
+
+    bool ok = fwrite(event, sizeof(event), 1, rec->fd) == 1;
+    if(ok && (short_count > 0)) {
+        ok = rec_write_samples(rec->fd, pcm16, short_count);
+    }
+
+    if(!ok) LOG_WARNING("Failed to write to recording file");
+
+    mtx_unlock(&rec->mutex);
+}
+
+void rec_feed(Recorder rec, const short *pcm16, size_t short_count) {
+    rec_write_event(rec, RECORDED_FEED, pcm16, short_count, rec_now_us());
+}
+
+void rec_feed_at(Recorder rec, const short *pcm16, size_t short_count, uint64_t time_us) {
+    rec_write_event(rec, RECORDED_FEED, pcm16, short_count, time_us);
+}
+
+void rec_flush(Recorder rec) {
+    rec_write_event(rec, RECORDED_FLUSH, NULL, 0, rec_now_us());
+
+    mtx_lock(&rec->mutex);
+    fflush(rec->fd);
+    mtx_unlock(&rec->mutex);
+}
+
+void rec_free(Recorder rec) {
+    if(rec == NULL) return;
+
+    if(rec->fd != NULL) fclose(rec->fd);
+    if(rec->mutex_init) mtx_destroy(&rec->mutex);
+    free(rec);
+}
+
+RecordingReader rec_open(const char *path) {
+    RecordingReader reader = (RecordingReader)calloc(1, sizeof(struct RecordingReader_i));
+    if(reader == NULL) return NULL;
+
+    reader->fd = fopen(path, "rb");
+    if(reader->fd == NULL) {
+        LOG_ERROR("Failed to open recording %s", path);
+        rec_close(reader);
+        return NULL;
+    }
+
+    uint8_t header[RECORDING_HEADER_SIZE];
+    if((fread(header, sizeof(header), 1, reader->fd) != 1)
+        || (memcmp(header, RECORDING_MAGIC, sizeof(RECORDING_MAGIC)) != 0)
+    ) {
+        LOG_ERROR("%s is not a recording", path);
+        rec_close(reader);
+        return NULL;
+    }
+
+    reader->header.version = mfu_get_u32(&header[8]);
+    reader->header.sample_rate = mfu_get_u32(&header[12]);
+    reader->header.config_flags = mfu_get_u32(&header[16]);
+
+    if(reader->header.version != RECORDING_VERSION) {
+        LOG_ERROR("Unsupported recording version %u in %s", reader->header.version, path);
+        rec_close(reader);
+        return NULL;
+    }
+
+    return reader;
+}
+
+size_t rec_get_sample_rate(RecordingReader reader) {
+    return reader->header.sample_rate;
+}
+
+uint32_t rec_get_config_flags(RecordingReader reader) {
+    return reader->header.config_flags;
+}
+
+bool rec_next(RecordingReader reader, RecordedEvent *event) {
+    uint8_t header[RECORDED_EVENT_HEADER_SIZE];
+    if(fread(header, sizeof(header), 1, reader->fd) != 1) return false;
+
+    uint32_t sample_count = mfu_get_u32(&header[4]);
+    if(sample_count > reader->samples_capacity) {
+        short *samples = (short *)realloc(reader->samples, sample_count * sizeof(short));
+        if(samples == NULL) return false;
+
+        reader->samples = samples;
+        reader->samples_capacity = sample_count;
+    }
+
+    if(fread(reader->samples, 2, sample_count, reader->fd) != sample_count) {
+        LOG_WARNING("Recording ends with a partial event");
+        return false;
+    }
+
+    // Decoded in place, each sample takes the 2 bytes it was read into
+    for(uint32_t i=0; i<sample_count; i++) {
+        reader->samples[i] = (short)mfu_get_u16((const uint8_t *)&reader->samples[i]);
+    }
+
+    event->type = (RecordedEventType)mfu_get_u32(&header[0]);
+    event->time_us = mfu_get_u64(&header[8]);
+    event->samples = reader->samples;
+    event->sample_count = sample_count;
+    return true;
+}
+
+void rec_close(RecordingReader reader) {
+    if(reader == NULL) return;
+
+    if(reader->fd != NULL) fclose(reader->fd);
+    free(reader->samples);
+    free(reader);
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright (C) 2022 abb128
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _APRIL_RECORDER
+#define _APRIL_RECORDER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+// Records the calls made to a session, with their timing, so that the same
+// feed pattern can be replayed later. The file is a 24 byte header followed
+// by events:
+//
+//   header: char magic[8] "APRILREC", u32 version, u32 sample_rate,
+//           u32 config_flags, u32 reserved
+//   event:  u32 type, u32 sample_count, u64 time_us,
+//           s16 samples[sample_count]
+//
+// All values are little endian, whatever the host byte order. time_us
+// counts from when recording began
+
+#define RECORDING_VERSION 1
+
+typedef enum RecordedEventType {
+    RECORDED_FEED = 1,
+    RECORDED_FLUSH = 2
+} RecordedEventType;
+
+typedef struct RecordedEvent {
+    RecordedEventType type;
+    uint64_t time_us;
+
+    // Only for RECORDED_FEED. Valid until the next call to rec_next
+    const short *samples;
+    size_t sample_count;
+} RecordedEvent;
+
+struct Recorder_i;
+typedef struct Recorder_i *Recorder;
+
+// Calls may come from any thread
+Recorder rec_create(const char *path, size_t sample_rate, uint32_t config_flags);
+void rec_feed(Recorder rec, const short *pcm16, size_t short_count);
+
+// Records a feed as made at time_us, from rec_now_us, for calls that only
+// know how much was fed after they blocked
+void rec_feed_at(Recorder rec, const short *pcm16, size_t short_count, uint64_t time_us);
+uint64_t rec_now_us(void);
+
+void rec_flush(Recorder rec);
+void rec_free(Recorder rec);
+
+struct RecordingReader_i;
+typedef struct RecordingReader_i *RecordingReader;
+
+RecordingReader rec_open(const char *path);
+size_t rec_get_sample_rate(RecordingReader reader);
+uint32_t rec_get_config_flags(RecordingReader reader);
+
+// Returns false at the end of the recording
+bool rec_next(RecordingReader reader, RecordedEvent *event);
+void rec_close(RecordingReader reader);
+
+#endif
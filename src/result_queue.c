@@ -0,0 +1,258 @@
+/*
+ * Copyright (C) 2022 abb128
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "log.h"
+#include "april_api.h"
+
+#ifndef USE_TINYCTHREAD
+#include <threads.h>
+#else
+#include "tinycthread/tinycthread.h"
+#endif
+
+#if defined(_WIN32) || defined(__WIN32__) || defined(__WINDOWS__)
+#define QUEUE_NO_FD
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/eventfd.h>
+#define QUEUE_EVENTFD
+#endif
+#endif
+
+typedef struct QueuedResult {
+    struct QueuedResult *next;
+
+    AprilResultType result;
+    size_t count;
+    size_t capacity;
+    AprilToken tokens[];
+} QueuedResult;
+
+struct AprilResultQueue_i {
+    mtx_t mutex;
+    bool mutex_init;
+
+    QueuedResult *head;
+    QueuedResult *tail;
+
+    // The link that points to the tail, to replace it
+    QueuedResult **tail_link;
+
+    // With eventfd, both are the same descriptor
+    int read_fd;
+    int write_fd;
+};
+
+static QueuedResult *aaq_make_result(AprilResultType result, size_t count, const AprilToken *tokens) {
+    QueuedResult *queued = (QueuedResult *)malloc(sizeof(QueuedResult) + count * sizeof(AprilToken));
+    if(queued == NULL) return NULL;
+
+    queued->next = NULL;
+    queued->result = result;
+    queued->count = count;
+    queued->capacity = count;
+    if(count > 0) memcpy(queued->tokens, tokens, count * sizeof(AprilToken));
+
+    return queued;
+}
+
+#ifndef QUEUE_NO_FD
+static bool aaq_set_flags(int fd) {
+    int fd_flags = fcntl(fd, F_GETFD);
+    int fl_flags = fcntl(fd, F_GETFL);
+    if((fd_flags < 0) || (fl_flags < 0)) return false;
+
+    return (fcntl(fd, F_SETFD, fd_flags | FD_CLOEXEC) == 0)
+        && (fcntl(fd, F_SETFL, fl_flags | O_NONBLOCK) == 0);
+}
+#endif
+
+// Called with the mutex held. The descriptor is readable exactly while the
+// queue is not empty, so it's signalled when the first result arrives and
+// drained when the last one is popped
+static void aaq_signal(AprilResultQueue queue) {
+#if defined(QUEUE_EVENTFD)
+    uint64_t one = 1;
+    if(write(queue->write_fd, &one, sizeof(one)) != sizeof(one)) {
+        LOG_WARNING("Failed to signal result queue");
+    }
+#elif !defined(QUEUE_NO_FD)
+    char byte = 0;
+    if(write(queue->write_fd, &byte, 1) != 1) {
+        LOG_WARNING("Failed to signal result queue");
+    }
+#endif
+}
+
+static void aaq_drain(AprilResultQueue queue) {
+#if defined(QUEUE_EVENTFD)
+    uint64_t value;
+    if(read(queue->read_fd, &value, sizeof(value)) != sizeof(value)) {
+        LOG_WARNING("Failed to drain result queue");
+    }
+#elif !defined(QUEUE_NO_FD)
+    char bytes[16];
+    while(read(queue->read_fd, bytes, sizeof(bytes)) > 0) {}
+#endif
+}
+
+AprilResultQueue aaq_create(void) {
+    AprilResultQueue queue = (AprilResultQueue)calloc(1, sizeof(struct AprilResultQueue_i));
+    if(queue == NULL) return NULL;
+
+    queue->read_fd = -1;
+    queue->write_fd = -1;
+
+    if(mtx_init(&queue->mutex, mtx_plain) != thrd_success) {
+        LOG_ERROR("Failed to initialize result queue mutex");
+        aaq_free(queue);
+        return NULL;
+    }
+    queue->mutex_init = true;
+
+#if defined(QUEUE_EVENTFD)
+    queue->read_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    queue->write_fd = queue->read_fd;
+    if(queue->read_fd < 0) {
+        LOG_ERROR("Failed to create eventfd for result queue, errno %d", errno);
+        aaq_free(queue);
+        return NULL;
+    }
+#elif !defined(QUEUE_NO_FD)
+    int fds[2];
+    if(pipe(fds) != 0) {
+        LOG_ERROR("Failed to create pipe for result queue, errno %d", errno);
+        aaq_free(queue);
+        return NULL;
+    }
+
+    queue->read_fd = fds[0];
+    queue->write_fd = fds[1];
+    if(!aaq_set_flags(queue->read_fd) || !aaq_set_flags(queue->write_fd)) {
+        LOG_ERROR("Failed to set flags on result queue pipe, errno %d", errno);
+        aaq_free(queue);
+        return NULL;
+    }
+#endif
+
+    return queue;
+}
+
+void aaq_handler(void *userdata, AprilResultType result, size_t count, const AprilToken *tokens) {
+    AprilResultQueue queue = (AprilResultQueue)userdata;
+
+    mtx_lock(&queue->mutex);
+
+    QueuedResult *tail = queue->tail;
+    bool replace = (tail != NULL)
+        && (tail->result == APRIL_RESULT_RECOGNITION_PARTIAL)
+        && (result == APRIL_RESULT_RECOGNITION_PARTIAL);
+
+    if(replace && (tail->capacity >= count)) {
+        tail->count = count;
+        if(count > 0) memcpy(tail->tokens, tokens, count * sizeof(AprilToken));
+
+        mtx_unlock(&queue->mutex);
+        return;
+    }
+
+    QueuedResult *queued = aaq_make_result(result, count, tokens);
+    if(queued == NULL) {
+        LOG_ERROR("Failed to allocate result of %zu tokens, dropping it", count);
+        mtx_unlock(&queue->mutex);
+        return;
+    }
+
+    if(replace) {
+        *queue->tail_link = queued;
+        queue->tail = queued;
+        free(tail);
+    } else {
+        bool was_empty = queue->head == NULL;
+
+        queue->tail_link = (tail != NULL) ? &tail->next : &queue->head;
+        *queue->tail_link = queued;
+        queue->tail = queued;
+
+        if(was_empty) aaq_signal(queue);
+    }
+
+    mtx_unlock(&queue->mutex);
+}
+
+int aaq_get_fd(AprilResultQueue queue) {
+    return queue->read_fd;
+}
+
+int aaq_pop(AprilResultQueue queue, AprilResultType *result, AprilToken *tokens, size_t max_tokens, size_t *count) {
+    mtx_lock(&queue->mutex);
+
+    QueuedResult *head = queue->head;
+    if(head == NULL) {
+        *count = 0;
+        mtx_unlock(&queue->mutex);
+        return 0;
+    }
+
+    *count = head->count;
+    if(head->count > max_tokens) {
+        mtx_unlock(&queue->mutex);
+        return 0;
+    }
+
+    *result = head->result;
+    if(head->count > 0) memcpy(tokens, head->tokens, head->count * sizeof(AprilToken));
+
+    queue->head = head->next;
+    if(queue->tail_link == &head->next) queue->tail_link = &queue->head;
+    if(queue->head == NULL) {
+        queue->tail = NULL;
+        queue->tail_link = NULL;
+        aaq_drain(queue);
+    }
+
+    mtx_unlock(&queue->mutex);
+
+    free(head);
+    return 1;
+}
+
+void aaq_free(AprilResultQueue queue) {
+    if(queue == NULL) return;
+
+    QueuedResult *queued = queue->head;
+    while(queued != NULL) {
+        QueuedResult *next = queued->next;
+        free(queued);
+        queued = next;
+    }
+
+#ifndef QUEUE_NO_FD
+    if(queue->read_fd >= 0) close(queue->read_fd);
+    if((queue->write_fd >= 0) && (queue->write_fd != queue->read_fd)) close(queue->write_fd);
+#endif
+
+    if(queue->mutex_init) mtx_destroy(&queue->mutex);
+    free(queue);
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (C) 2022 abb128
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <time.h>
+#include "common.h"
+#include "log.h"
+#include "scheduler.h"
+
+#ifndef USE_TINYCTHREAD
+#include <threads.h>
+#else
+#include "tinycthread/tinycthread.h"
+#endif
+
+#ifdef _MSC_VER
+#define _Atomic volatile
+#endif
+
+// Lives on the stack of the waiting thread
+typedef struct SchedWaiter {
+    uint64_t deadline_ms;
+    uint64_t sequence;
+    struct SchedWaiter *next;
+} SchedWaiter;
+
+static bool g_sched_init = false;
+static mtx_t g_sched_mutex;
+static cnd_t g_sched_cond;
+
+// Only changed with the mutex held, but read without it so that the
+// unlimited default never takes the mutex
+static _Atomic size_t g_sched_max_concurrent = 0;
+static _Atomic size_t g_sched_active = 0;
+static _Atomic size_t g_sched_waiting = 0;
+
+static uint64_t g_sched_sequence = 0;
+static SchedWaiter *g_sched_waiters = NULL;
+
+void sched_init(void) {
+    if(g_sched_init) return;
+
+    if(mtx_init(&g_sched_mutex, mtx_plain) != thrd_success) {
+        LOG_ERROR("Failed to initialize scheduler mutex");
+        return;
+    }
+
+    if(cnd_init(&g_sched_cond) != thrd_success) {
+        LOG_ERROR("Failed to initialize scheduler cond");
+        mtx_destroy(&g_sched_mutex);
+        return;
+    }
+
+    g_sched_init = true;
+}
+
+void sched_set_max_concurrent(size_t count) {
+    if(!g_sched_init) return;
+
+    mtx_lock(&g_sched_mutex);
+    g_sched_max_concurrent = count;
+    mtx_unlock(&g_sched_mutex);
+
+    cnd_broadcast(&g_sched_cond);
+}
+
+uint64_t sched_now_ms(void) {
+    struct timespec ts;
+#ifdef CLOCK_MONOTONIC
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+#else
+    timespec_get(&ts, TIME_UTC);
+#endif
+    return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+// Ties go to whoever started waiting first
+static bool sched_is_earliest(const SchedWaiter *waiter) {
+    for(const SchedWaiter *w = g_sched_waiters; w != NULL; w = w->next) {
+        if(w == waiter) continue;
+
+        if((w->deadline_ms < waiter->deadline_ms)
+            || ((w->deadline_ms == waiter->deadline_ms) && (w->sequence < waiter->sequence))
+        ) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void sched_remove_waiter(SchedWaiter *waiter) {
+    for(SchedWaiter **w = &g_sched_waiters; *w != NULL; w = &(*w)->next) {
+        if(*w == waiter) {
+            *w = waiter->next;
+            return;
+        }
+    }
+}
+
+void sched_acquire(uint64_t deadline_ms) {
+    if(!g_sched_init) return;
+
+    // Still counted while unlimited, so that lowering the limit later
+    // accounts for work already running
+    if(g_sched_max_concurrent == 0) {
+        g_sched_active++;
+        return;
+    }
+
+    mtx_lock(&g_sched_mutex);
+
+    SchedWaiter waiter = { deadline_ms, g_sched_sequence++, g_sched_waiters };
+    g_sched_waiters = &waiter;
+
+    // Counted before checking for a free slot. A release that comes after
+    // the check sees it and wakes this up
+    g_sched_waiting++;
+
+    while((g_sched_max_concurrent != 0)
+        && ((g_sched_active >= g_sched_max_concurrent) || !sched_is_earliest(&waiter))
+    ) {
+        cnd_wait(&g_sched_cond, &g_sched_mutex);
+    }
+
+    sched_remove_waiter(&waiter);
+    g_sched_waiting--;
+    g_sched_active++;
+
+    mtx_unlock(&g_sched_mutex);
+
+    // The next earliest waiter may be able to go too
+    cnd_broadcast(&g_sched_cond);
+}
+
+void sched_release(void) {
+    if(!g_sched_init) return;
+
+    g_sched_active--;
+    if(g_sched_waiting == 0) return;
+
+    // A waiter holds the mutex from its check until it waits, so taking it
+    // here keeps the wakeup from landing in between
+    mtx_lock(&g_sched_mutex);
+    mtx_unlock(&g_sched_mutex);
+
+    cnd_broadcast(&g_sched_cond);
+}
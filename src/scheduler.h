@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2022 abb128
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _APRIL_SCHEDULER
+#define _APRIL_SCHEDULER
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "common.h"
+
+// Process-wide gate allowing at most a set number of sessions to run
+// inference at once. Waiting sessions are let through earliest deadline
+// first. Unlimited by default, in which case acquiring never blocks
+
+// Added to the current time to get the deadline of best-effort work, so
+// it goes after realtime work but can't be starved forever
+#define BEST_EFFORT_DEADLINE_MS 30000
+
+void sched_init(void);
+void sched_set_max_concurrent(size_t count);
+
+// Monotonic milliseconds, the time base for deadlines
+uint64_t sched_now_ms(void);
+
+// Blocks until a slot is free and no waiting session has an earlier
+// deadline. Every acquire must be paired with a release
+void sched_acquire(uint64_t deadline_ms);
+void sched_release(void);
+
+#endif
@@ -0,0 +1,204 @@
+/*
+ * Copyright (C) 2022 abb128
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include "common.h"
+#include "log.h"
+#include "segment_queue.h"
+
+#ifndef USE_TINYCTHREAD
+#include <threads.h>
+#else
+#include "tinycthread/tinycthread.h"
+#endif
+
+#ifdef _MSC_VER
+#define _Atomic volatile
+#endif
+
+struct SegmentQueue_i {
+    float *data;
+    size_t segment_size;
+
+    // Set for slots holding a flush marker instead of a segment
+    bool *flush;
+
+    // One slot is always left empty to tell a full queue from an empty one
+    size_t slots;
+
+    // Current slot to read from, only advanced by the consumer
+    _Atomic size_t head;
+
+    // Current slot to write to, only advanced by the producer
+    _Atomic size_t tail;
+
+    // The producer sets this before sleeping on space_cond, so the consumer
+    // only takes the mutex when someone is waiting
+    _Atomic bool producer_waiting;
+
+    // Set by the consumer, read by the producer
+    _Atomic double speed;
+
+    mtx_t mutex;
+    cnd_t space_cond;
+    bool sync_init;
+};
+
+SegmentQueue sq_create(size_t segment_size, size_t capacity) {
+    SegmentQueue sq = (SegmentQueue)calloc(1, sizeof(struct SegmentQueue_i));
+    if(sq == NULL) return NULL;
+
+    sq->segment_size = segment_size;
+    sq->slots = capacity + 1;
+    sq->speed = 1.0;
+    sq->data = (float *)calloc(sq->slots * segment_size, sizeof(float));
+    sq->flush = (bool *)calloc(sq->slots, sizeof(bool));
+    if((sq->data == NULL) || (sq->flush == NULL)) {
+        LOG_ERROR("Failed to allocate segment queue of %zu segments", capacity);
+        sq_free(sq);
+        return NULL;
+    }
+
+    if(mtx_init(&sq->mutex, mtx_plain) != thrd_success) {
+        LOG_ERROR("Failed to initialize segment queue mutex");
+        sq_free(sq);
+        return NULL;
+    }
+
+    if(cnd_init(&sq->space_cond) != thrd_success) {
+        LOG_ERROR("Failed to initialize segment queue cond");
+        mtx_destroy(&sq->mutex);
+        sq_free(sq);
+        return NULL;
+    }
+
+    sq->sync_init = true;
+    return sq;
+}
+
+static bool sq_full(SegmentQueue sq) {
+    return ((sq->tail + 1) % sq->slots) == sq->head;
+}
+
+float *sq_write_begin(SegmentQueue sq) {
+    if(sq_full(sq)) return NULL;
+
+    return &sq->data[sq->tail * sq->segment_size];
+}
+
+void sq_write_finish(SegmentQueue sq) {
+    sq->flush[sq->tail] = false;
+    sq->tail = (sq->tail + 1) % sq->slots;
+}
+
+bool sq_write_flush(SegmentQueue sq) {
+    if(sq_full(sq)) return false;
+
+    sq->flush[sq->tail] = true;
+    sq->tail = (sq->tail + 1) % sq->slots;
+    return true;
+}
+
+void sq_wait_for_space(SegmentQueue sq) {
+    mtx_lock(&sq->mutex);
+
+    // Set before checking, so that a consumer freeing a slot after the
+    // check sees it and signals
+    sq->producer_waiting = true;
+    while(sq_full(sq)) {
+        cnd_wait(&sq->space_cond, &sq->mutex);
+    }
+    sq->producer_waiting = false;
+
+    mtx_unlock(&sq->mutex);
+}
+
+static void sq_advance_head(SegmentQueue sq, size_t head) {
+    sq->head = head;
+
+    if(sq->producer_waiting) {
+        mtx_lock(&sq->mutex);
+        cnd_signal(&sq->space_cond);
+        mtx_unlock(&sq->mutex);
+    }
+}
+
+const float *sq_read_begin(SegmentQueue sq) {
+    size_t head = sq->head;
+    if((head == sq->tail) || sq->flush[head]) return NULL;
+
+    return &sq->data[head * sq->segment_size];
+}
+
+void sq_read_finish(SegmentQueue sq) {
+    sq_advance_head(sq, (sq->head + 1) % sq->slots);
+}
+
+bool sq_pop_flush(SegmentQueue sq, size_t max_dropped) {
+    size_t tail = sq->tail;
+    size_t count = 0;
+    for(size_t i = sq->head; (i != tail) && (count < max_dropped); i = (i + 1) % sq->slots) {
+        if(sq->flush[i]) {
+            sq_advance_head(sq, (i + 1) % sq->slots);
+            return true;
+        }
+
+        count++;
+    }
+
+    return false;
+}
+
+void sq_set_speed(SegmentQueue sq, double speed) {
+    sq->speed = speed;
+}
+
+double sq_get_speed(SegmentQueue sq) {
+    return sq->speed;
+}
+
+size_t sq_count(SegmentQueue sq) {
+    size_t tail = sq->tail;
+    size_t count = 0;
+    for(size_t i = sq->head; (i != tail) && !sq->flush[i]; i = (i + 1) % sq->slots) {
+        count++;
+    }
+
+    return count;
+}
+
+bool sq_flush_queued(SegmentQueue sq) {
+    size_t tail = sq->tail;
+    for(size_t i = sq->head; i != tail; i = (i + 1) % sq->slots) {
+        if(sq->flush[i]) return true;
+    }
+
+    return false;
+}
+
+void sq_free(SegmentQueue sq) {
+    if(sq == NULL) return;
+
+    if(sq->sync_init) {
+        cnd_destroy(&sq->space_cond);
+        mtx_destroy(&sq->mutex);
+    }
+
+    free(sq->flush);
+    free(sq->data);
+    free(sq);
+}
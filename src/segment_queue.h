@@ -0,0 +1,67 @@
+/*
+ * Copyright (C) 2022 abb128
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _APRIL_SEGMENT_QUEUE
+#define _APRIL_SEGMENT_QUEUE
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "common.h"
+
+// Queue of fixed size feature segments, for exactly one producer thread
+// and one consumer thread. Reads and writes are lock-free, only a producer
+// waiting for space sleeps on a condition variable. The producer may also
+// queue flush markers, which the consumer can't read past until it pops
+// them with sq_pop_flush
+struct SegmentQueue_i;
+typedef struct SegmentQueue_i *SegmentQueue;
+
+SegmentQueue sq_create(size_t segment_size, size_t capacity);
+
+// Returns the slot to write the next segment into, or NULL if full. The
+// segment becomes visible to the consumer on sq_write_finish
+float *sq_write_begin(SegmentQueue sq);
+void sq_write_finish(SegmentQueue sq);
+
+// Queues a flush marker after the segments written so far. Returns false
+// if full
+bool sq_write_flush(SegmentQueue sq);
+
+// Blocks the producer until at least one slot is free
+void sq_wait_for_space(SegmentQueue sq);
+
+// Returns the oldest segment, or NULL if empty or if a flush marker is
+// next. The slot is released on sq_read_finish
+const float *sq_read_begin(SegmentQueue sq);
+void sq_read_finish(SegmentQueue sq);
+
+// If a flush marker is queued with fewer than max_dropped segments before
+// it, drops it along with those segments and returns true
+bool sq_pop_flush(SegmentQueue sq, size_t max_dropped);
+
+// Speed the consumer wants the producer's fbank to run at, 1.0 until set
+void sq_set_speed(SegmentQueue sq, double speed);
+double sq_get_speed(SegmentQueue sq);
+
+// Number of segments ready to be read before the next flush marker
+size_t sq_count(SegmentQueue sq);
+
+// Returns true if a flush marker is queued
+bool sq_flush_queued(SegmentQueue sq);
+
+void sq_free(SegmentQueue sq);
+
+#endif
@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2022 abb128
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifdef __linux__
+#define _GNU_SOURCE
+#include <sched.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#elif defined(_WIN32)
+#include <windows.h>
+#endif
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include "common.h"
+#include "log.h"
+#include "thread_opts.h"
+
+// Nice level for APRIL_THREAD_PRIORITY_HIGH, and the fallback for
+// APRIL_THREAD_PRIORITY_REALTIME when SCHED_FIFO is not permitted
+#define HIGH_PRIORITY_NICE -10
+#define REALTIME_FIFO_PRIORITY 10
+
+void thread_options_from_config(ThreadOptions *opts, const AprilConfig *config) {
+    memset(opts, 0, sizeof(ThreadOptions));
+    if(g_client_version < 2) return;
+
+    size_t count = config->affinity_cpu_count;
+    if(config->affinity_cpus == NULL) count = 0;
+
+    if(count > MAX_AFFINITY_CPUS) {
+        LOG_WARNING("Too many CPUs given for affinity (%zu), only using the first %d", count, MAX_AFFINITY_CPUS);
+        count = MAX_AFFINITY_CPUS;
+    }
+
+    if(count > 0) memcpy(opts->cpus, config->affinity_cpus, count * sizeof(int));
+    opts->cpu_count = count;
+    opts->priority = config->thread_priority;
+}
+
+#ifdef __linux__
+static bool make_cpu_set(const ThreadOptions *opts, cpu_set_t *set) {
+    CPU_ZERO(set);
+
+    bool any = false;
+    for(size_t i=0; i<opts->cpu_count; i++) {
+        int cpu = opts->cpus[i];
+        if((cpu < 0) || (cpu >= CPU_SETSIZE)) {
+            LOG_WARNING("Ignoring invalid CPU %d for affinity", cpu);
+            continue;
+        }
+
+        CPU_SET(cpu, set);
+        any = true;
+    }
+
+    return any;
+}
+
+void thread_apply_options(const ThreadOptions *opts) {
+    cpu_set_t set;
+    if(make_cpu_set(opts, &set)) {
+        int res = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &set);
+        if(res != 0) LOG_WARNING("Failed to set thread affinity: %s", strerror(res));
+    }
+
+    if(opts->priority == APRIL_THREAD_PRIORITY_REALTIME) {
+        struct sched_param param = { .sched_priority = REALTIME_FIFO_PRIORITY };
+        int res = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if(res == 0) return;
+
+        LOG_WARNING("Failed to use SCHED_FIFO (%s), raising nice level instead", strerror(res));
+    }
+
+    if(opts->priority != APRIL_THREAD_PRIORITY_NORMAL) {
+        // On Linux the nice level is per thread, given the thread id
+        pid_t tid = (pid_t)syscall(SYS_gettid);
+        if(setpriority(PRIO_PROCESS, tid, HIGH_PRIORITY_NICE) != 0) {
+            LOG_WARNING("Failed to raise thread priority, this may need CAP_SYS_NICE");
+        }
+    }
+}
+
+#elif defined(_WIN32)
+void thread_apply_options(const ThreadOptions *opts) {
+    DWORD_PTR mask = 0;
+    for(size_t i=0; i<opts->cpu_count; i++) {
+        int cpu = opts->cpus[i];
+        if((cpu < 0) || (cpu >= (int)(sizeof(DWORD_PTR) * 8))) {
+            LOG_WARNING("Ignoring CPU %d for affinity, only the first processor group is supported", cpu);
+            continue;
+        }
+
+        mask |= ((DWORD_PTR)1) << cpu;
+    }
+
+    if((mask != 0) && (SetThreadAffinityMask(GetCurrentThread(), mask) == 0)) {
+        LOG_WARNING("Failed to set thread affinity");
+    }
+
+    int priority = THREAD_PRIORITY_NORMAL;
+    if(opts->priority == APRIL_THREAD_PRIORITY_HIGH) priority = THREAD_PRIORITY_HIGHEST;
+    else if(opts->priority == APRIL_THREAD_PRIORITY_REALTIME) priority = THREAD_PRIORITY_TIME_CRITICAL;
+
+    if((priority != THREAD_PRIORITY_NORMAL) && !SetThreadPriority(GetCurrentThread(), priority)) {
+        LOG_WARNING("Failed to raise thread priority");
+    }
+}
+
+#else
+void thread_apply_options(const ThreadOptions *opts) {
+    if((opts->cpu_count > 0) || (opts->priority != APRIL_THREAD_PRIORITY_NORMAL)) {
+        LOG_WARNING("Thread affinity and priority are not supported on this platform");
+    }
+}
+#endif
@@ -0,0 +1,42 @@
+/*
+ * Copyright (C) 2022 abb128
+ * 
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, version 3.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef _APRIL_THREAD_OPTS
+#define _APRIL_THREAD_OPTS
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "common.h"
+#include "april_api.h"
+
+#define MAX_AFFINITY_CPUS 256
+
+// Placement and priority for the threads of a session. Zero-initialized
+// means no change from the OS defaults
+typedef struct ThreadOptions {
+    int cpus[MAX_AFFINITY_CPUS];
+    size_t cpu_count;
+
+    AprilThreadPriority priority;
+} ThreadOptions;
+
+void thread_options_from_config(ThreadOptions *opts, const AprilConfig *config);
+
+// Applies the options to the calling thread. Failures are logged, and the
+// thread keeps running with whatever did succeed
+void thread_apply_options(const ThreadOptions *opts);
+
+#endif
@@ -0,0 +1,501 @@
+// Transcribes a list of files in parallel with one shared model, for
+// offline jobs over many files:
+// $ ./april_batch /path/to/model.april manifest.txt -j 8 --out-dir results --format srt,json
+//
+// The manifest lists one input file per line. A line may give the output
+// path (without extension) after a tab, otherwise the outputs are named
+// after the input, in --out-dir or next to the input. Empty lines and lines
+// starting with # are skipped.
+//
+// Inputs are 16 bit mono PCM wav files, or raw PCM16 files, at the model's
+// sample rate. Each worker transcribes one file at a time, and only a few
+// seconds of it are resident at once, so memory use stays flat no matter
+// how many or how long the files are.
+
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <ctime>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <sys/stat.h>
+#include "april_api.h"
+#include "tool_util.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#else
+#include <direct.h>
+#define mkdir(path, mode) _mkdir(path)
+#endif
+
+// Audio fed to the session at once. Pages before it are dropped again
+#define FEED_SECONDS 10
+
+// Longest subtitle line before it's split at a word
+#define MAX_CUE_CHARS 84
+
+struct BatchOptions {
+    const char *model_path = NULL;
+    const char *manifest_path = NULL;
+    const char *out_dir = NULL;
+    size_t jobs = 0;
+    bool write_srt = false;
+    bool write_json = true;
+};
+
+struct Job {
+    std::string input;
+    std::string output;
+};
+
+struct Token {
+    const char *text;
+    size_t time_ms;
+    float logprob;
+    bool word_start;
+};
+
+// Everything known about the file being transcribed
+struct FileResult {
+    std::vector<Token> tokens;
+
+    // Index into tokens where each FINAL result starts
+    std::vector<size_t> sentence_starts;
+};
+
+typedef std::chrono::steady_clock batch_clock;
+
+static std::atomic<size_t> g_next_job(0);
+static std::atomic<size_t> g_done(0);
+static std::atomic<size_t> g_failed(0);
+static std::atomic<uint64_t> g_audio_samples(0);
+
+static std::mutex g_print_mutex;
+
+
+// A read-only view of a whole file. Mapped where possible, so the kernel
+// can drop pages that have been processed
+class FileView {
+public:
+    ~FileView() {
+#ifndef _WIN32
+        if(data != NULL) munmap(data, size);
+        if(fd >= 0) close(fd);
+#else
+        free(data);
+#endif
+    }
+
+    bool open(const char *path) {
+#ifndef _WIN32
+        fd = ::open(path, O_RDONLY | O_CLOEXEC);
+        if(fd < 0) return false;
+
+        struct stat st;
+        if((fstat(fd, &st) != 0) || (st.st_size == 0)) return false;
+        size = (size_t)st.st_size;
+
+        void *mapped = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(mapped == MAP_FAILED) return false;
+
+        data = (uint8_t *)mapped;
+        madvise(data, size, MADV_SEQUENTIAL);
+        return true;
+#else
+        FILE *file = fopen(path, "rb");
+        if(file == NULL) return false;
+
+        fseek(file, 0L, SEEK_END);
+        size = (size_t)ftell(file);
+        fseek(file, 0L, SEEK_SET);
+
+        data = (uint8_t *)malloc(size);
+        bool ok = (data != NULL) && (fread(data, 1, size, file) == size);
+        fclose(file);
+        return ok && (size > 0);
+#endif
+    }
+
+    // Tells the kernel the bytes before end won't be needed again
+    void release_before(size_t end) {
+#ifndef _WIN32
+        size_t page = (size_t)sysconf(_SC_PAGESIZE);
+        size_t length = (end / page) * page;
+        if(length > released) {
+            madvise(data + released, length - released, MADV_DONTNEED);
+            released = length;
+        }
+#endif
+    }
+
+    uint8_t *data = NULL;
+    size_t size = 0;
+
+private:
+    int fd = -1;
+    size_t released = 0;
+};
+
+static bool ends_with(const std::string &str, const char *suffix) {
+    size_t length = strlen(suffix);
+    return (str.size() >= length) && (str.compare(str.size() - length, length, suffix) == 0);
+}
+
+
+static void handler(void *userdata, AprilResultType result, size_t count, const AprilToken *tokens) {
+    if(result != APRIL_RESULT_RECOGNITION_FINAL) return;
+
+    FileResult *file = (FileResult *)userdata;
+    file->sentence_starts.push_back(file->tokens.size());
+
+    for(size_t t=0; t<count; t++) {
+        Token token;
+        token.text = tokens[t].token;
+        token.time_ms = tokens[t].time_ms;
+        token.logprob = tokens[t].logprob;
+        token.word_start = (tokens[t].flags & APRIL_TOKEN_FLAG_WORD_BOUNDARY_BIT) != 0;
+        file->tokens.push_back(token);
+    }
+}
+
+static std::string trimmed(const std::string &text) {
+    size_t start = text.find_first_not_of(' ');
+    if(start == std::string::npos) return "";
+    return text.substr(start, text.find_last_not_of(' ') - start + 1);
+}
+
+struct Cue {
+    size_t start_ms;
+    size_t end_ms;
+    std::string text;
+};
+
+// One cue per final result, split at words when too long for a subtitle
+static std::vector<Cue> make_cues(const FileResult &file) {
+    std::vector<Cue> cues;
+
+    for(size_t s=0; s<file.sentence_starts.size(); s++) {
+        size_t begin = file.sentence_starts[s];
+        size_t end = (s + 1 < file.sentence_starts.size()) ? file.sentence_starts[s + 1] : file.tokens.size();
+
+        Cue cue = { 0, 0, "" };
+        for(size_t t=begin; t<end; t++) {
+            const Token &token = file.tokens[t];
+
+            if(!cue.text.empty() && token.word_start && (cue.text.size() + strlen(token.text) > MAX_CUE_CHARS)) {
+                cue.end_ms = token.time_ms;
+                cues.push_back(cue);
+                cue.text.clear();
+            }
+
+            if(cue.text.empty()) cue.start_ms = token.time_ms;
+            cue.text += token.text;
+            cue.end_ms = token.time_ms + 500;
+        }
+
+        if(!trimmed(cue.text).empty()) cues.push_back(cue);
+    }
+
+    for(Cue &cue : cues) cue.text = trimmed(cue.text);
+    return cues;
+}
+
+static void format_srt_time(char *out, size_t size, size_t ms) {
+    snprintf(out, size, "%02zu:%02zu:%02zu,%03zu", ms / 3600000, (ms / 60000) % 60, (ms / 1000) % 60, ms % 1000);
+}
+
+static bool write_srt(const std::string &path, const std::vector<Cue> &cues) {
+    FILE *fd = fopen(path.c_str(), "wb");
+    if(fd == NULL) return false;
+
+    for(size_t i=0; i<cues.size(); i++) {
+        char start[32], end[32];
+        format_srt_time(start, sizeof(start), cues[i].start_ms);
+        format_srt_time(end, sizeof(end), cues[i].end_ms);
+
+        fprintf(fd, "%zu\n%s --> %s\n%s\n\n", i + 1, start, end, cues[i].text.c_str());
+    }
+
+    return fclose(fd) == 0;
+}
+
+static bool write_json(const std::string &path, const Job &job, const FileResult &file, const std::vector<Cue> &cues, double audio_seconds, double processing_seconds) {
+    std::string json = "{\n  \"file\": \"";
+    json_escape(json, job.input.c_str());
+
+    char numbers[256];
+    snprintf(numbers, sizeof(numbers), "\",\n  \"duration_s\": %.3f,\n  \"processing_s\": %.3f,\n  \"rtf\": %.4f,\n  \"text\": \"",
+        audio_seconds, processing_seconds, audio_seconds > 0.0 ? processing_seconds / audio_seconds : 0.0);
+    json += numbers;
+
+    std::string text;
+    for(const Cue &cue : cues) {
+        if(!text.empty()) text += ' ';
+        text += cue.text;
+    }
+    json_escape(json, text.c_str());
+
+    json += "\",\n  \"segments\": [";
+    for(size_t i=0; i<cues.size(); i++) {
+        snprintf(numbers, sizeof(numbers), "%s\n    {\"start_ms\": %zu, \"end_ms\": %zu, \"text\": \"", i > 0 ? "," : "", cues[i].start_ms, cues[i].end_ms);
+        json += numbers;
+        json_escape(json, cues[i].text.c_str());
+        json += "\"}";
+    }
+
+    json += "\n  ],\n  \"tokens\": [";
+    for(size_t i=0; i<file.tokens.size(); i++) {
+        json += i > 0 ? ",\n    {\"token\": \"" : "\n    {\"token\": \"";
+        json_escape(json, file.tokens[i].text);
+        snprintf(numbers, sizeof(numbers), "\", \"time_ms\": %zu, \"logprob\": %.3f}", file.tokens[i].time_ms, file.tokens[i].logprob);
+        json += numbers;
+    }
+    json += "\n  ]\n}\n";
+
+    FILE *fd = fopen(path.c_str(), "wb");
+    if(fd == NULL) return false;
+
+    bool ok = fwrite(json.data(), 1, json.size(), fd) == json.size();
+    return (fclose(fd) == 0) && ok;
+}
+
+
+// Returns false and sets error if the file couldn't be transcribed
+static bool transcribe(AprilASRModel model, const BatchOptions &opts, const Job &job, std::string &error) {
+    size_t sample_rate = aam_get_sample_rate(model);
+
+    FileView file;
+    if(!file.open(job.input.c_str())) {
+        error = "can't read file";
+        return false;
+    }
+
+    size_t offset = 0, size = file.size;
+    if(ends_with(job.input, ".wav") || ((file.size >= 4) && (memcmp(file.data, "RIFF", 4) == 0))) {
+        if(!find_wav_data(file.data, file.size, sample_rate, &offset, &size, error)) return false;
+    }
+
+    // A session per file, since token times keep counting across flushes
+    FileResult result;
+    AprilConfig config = { 0 };
+    config.handler = handler;
+    config.userdata = &result;
+    config.flags = APRIL_CONFIG_FLAG_ZERO_BIT;
+
+    AprilASRSession session = aas_create_session(model, config);
+    if(session == NULL) {
+        error = "failed to create session";
+        return false;
+    }
+
+    batch_clock::time_point start = batch_clock::now();
+
+    size_t num_shorts = size / 2;
+    size_t feed_shorts = FEED_SECONDS * sample_rate;
+    short *samples = (short *)(file.data + offset);
+
+    for(size_t head = 0; head < num_shorts; head += feed_shorts) {
+        size_t count = std::min(feed_shorts, num_shorts - head);
+        aas_feed_pcm16(session, &samples[head], count);
+
+        file.release_before(offset + (head + count) * 2);
+    }
+
+    aas_flush(session);
+    aas_free(session);
+
+    double processing_seconds = std::chrono::duration<double>(batch_clock::now() - start).count();
+    double audio_seconds = (double)num_shorts / (double)sample_rate;
+    g_audio_samples += num_shorts;
+
+    std::vector<Cue> cues = make_cues(result);
+
+    if(opts.write_srt && !write_srt(job.output + ".srt", cues)) {
+        error = "failed to write " + job.output + ".srt";
+        return false;
+    }
+
+    if(opts.write_json && !write_json(job.output + ".json", job, result, cues, audio_seconds, processing_seconds)) {
+        error = "failed to write " + job.output + ".json";
+        return false;
+    }
+
+    return true;
+}
+
+static void worker_main(AprilASRModel model, const BatchOptions *opts, const std::vector<Job> *jobs) {
+    for(;;) {
+        size_t index = g_next_job++;
+        if(index >= jobs->size()) return;
+
+        const Job &job = (*jobs)[index];
+
+        std::string error;
+        bool ok = transcribe(model, *opts, job, error);
+        if(!ok) g_failed++;
+
+        size_t done = ++g_done;
+
+        std::lock_guard<std::mutex> lock(g_print_mutex);
+        if(!ok) fprintf(stderr, "Failed %s: %s\n", job.input.c_str(), error.c_str());
+        if((done % 100 == 0) || (done == jobs->size())) {
+            fprintf(stderr, "%zu/%zu files done\n", done, jobs->size());
+        }
+    }
+}
+
+// Output path for an input without an explicit one: the input's name
+// without its extension, in out_dir if given
+static std::string default_output(const std::string &input, const char *out_dir) {
+    size_t slash = input.find_last_of("/\\");
+    size_t dot = input.find_last_of('.');
+    std::string base = (dot != std::string::npos) && ((slash == std::string::npos) || (dot > slash)) ? input.substr(0, dot) : input;
+
+    if(out_dir == NULL) return base;
+
+    std::string name = (slash != std::string::npos) ? base.substr(slash + 1) : base;
+    return std::string(out_dir) + "/" + name;
+}
+
+static bool read_manifest(const BatchOptions &opts, std::vector<Job> &jobs) {
+    FILE *fd = fopen(opts.manifest_path, "rb");
+    if(fd == NULL) return false;
+
+    char line[4096];
+    while(fgets(line, sizeof(line), fd) != NULL) {
+        std::string entry(line);
+        while(!entry.empty() && ((entry.back() == '\n') || (entry.back() == '\r'))) entry.pop_back();
+        if(entry.empty() || (entry[0] == '#')) continue;
+
+        Job job;
+        size_t tab = entry.find('\t');
+        if(tab != std::string::npos) {
+            job.input = entry.substr(0, tab);
+            job.output = entry.substr(tab + 1);
+        } else {
+            job.input = entry;
+            job.output = default_output(entry, opts.out_dir);
+        }
+
+        jobs.push_back(job);
+    }
+
+    fclose(fd);
+    return true;
+}
+
+static double cpu_seconds() {
+#ifndef _WIN32
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) return 0.0;
+    return (double)usage.ru_utime.tv_sec + (double)usage.ru_utime.tv_usec / 1e6
+         + (double)usage.ru_stime.tv_sec + (double)usage.ru_stime.tv_usec / 1e6;
+#else
+    return (double)std::clock() / (double)CLOCKS_PER_SEC;
+#endif
+}
+
+// Peak resident set size in kilobytes, 0 if unknown
+static long peak_rss_kb() {
+#ifndef _WIN32
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+static void print_usage(const char *name) {
+    printf("Usage: %s [modelpath] [manifest] [options]\n", name);
+    printf(" -j N                files transcribed at once (default: CPU count)\n");
+    printf(" --out-dir DIR       where to write outputs (default: next to each input)\n");
+    printf(" --format LIST       srt, json or srt,json (default json)\n");
+}
+
+int main(int argc, char *argv[]) {
+    BatchOptions opts;
+
+    for(int i=1; i<argc; i++) {
+        bool has_value = (i + 1) < argc;
+        if((strcmp(argv[i], "-j") == 0) && has_value) opts.jobs = (size_t)atoi(argv[++i]);
+        else if((strncmp(argv[i], "-j", 2) == 0) && (argv[i][2] != 0)) opts.jobs = (size_t)atoi(argv[i] + 2);
+        else if((strcmp(argv[i], "--out-dir") == 0) && has_value) opts.out_dir = argv[++i];
+        else if((strcmp(argv[i], "--format") == 0) && has_value) {
+            const char *format = argv[++i];
+            opts.write_srt = strstr(format, "srt") != NULL;
+            opts.write_json = strstr(format, "json") != NULL;
+        }
+        else if((argv[i][0] != '-') && (opts.model_path == NULL)) opts.model_path = argv[i];
+        else if((argv[i][0] != '-') && (opts.manifest_path == NULL)) opts.manifest_path = argv[i];
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if((opts.model_path == NULL) || (opts.manifest_path == NULL) || (!opts.write_srt && !opts.write_json)) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if(opts.jobs == 0) opts.jobs = std::thread::hardware_concurrency();
+    if(opts.jobs == 0) opts.jobs = 1;
+
+    std::vector<Job> jobs;
+    if(!read_manifest(opts, jobs)) {
+        printf("Failed to read manifest %s\n", opts.manifest_path);
+        return 1;
+    }
+
+    if(opts.out_dir != NULL) mkdir(opts.out_dir, 0755);
+
+    aam_api_init(APRIL_VERSION);
+
+    AprilASRModel model = aam_create_model(opts.model_path);
+    if(model == NULL) {
+        printf("Loading model %s failed!\n", opts.model_path);
+        return 1;
+    }
+
+    size_t workers_count = std::min(opts.jobs, std::max(jobs.size(), (size_t)1));
+
+    batch_clock::time_point start = batch_clock::now();
+    double cpu_start = cpu_seconds();
+
+    std::vector<std::thread> workers;
+    for(size_t i=0; i<workers_count; i++) workers.emplace_back(worker_main, model, &opts, &jobs);
+    for(std::thread &worker : workers) worker.join();
+
+    double wall_seconds = std::chrono::duration<double>(batch_clock::now() - start).count();
+    double cpu_used = cpu_seconds() - cpu_start;
+    double audio_seconds = (double)g_audio_samples.load() / (double)aam_get_sample_rate(model);
+
+    printf("Files:          %zu done, %zu failed\n", jobs.size() - g_failed.load(), g_failed.load());
+    printf("Audio:          %.1f s\n", audio_seconds);
+    printf("Wall time:      %.1f s with %zu workers\n", wall_seconds, workers_count);
+    if(audio_seconds > 0.0) {
+        printf("RTF:            %.4f (%.1fx real time)\n", wall_seconds / audio_seconds, audio_seconds / wall_seconds);
+        printf("CPU RTF:        %.4f\n", cpu_used / audio_seconds);
+    }
+    printf("Peak RSS:       %ld KB\n", peak_rss_kb());
+
+    aam_free(model);
+
+    return g_failed > 0 ? 3 : 0;
+}
@@ -0,0 +1,638 @@
+// Benchmarks a model end to end and prints the results as JSON, to be
+// tracked across releases. Without --audio it uses synthetic audio, so it
+// runs offline with nothing but a model:
+// $ ./april_bench /path/to/model.april > results.json
+// $ ./april_bench fp32.april int8.april --audio test.wav --ref "the reference text"
+
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <ctime>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "april_api.h"
+#include "tool_util.h"
+
+extern "C" {
+#include "april_session.h"
+#include "fbank.h"
+}
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#endif
+
+// Bumped whenever the JSON layout changes
+#define BENCH_FORMAT_VERSION 1
+
+typedef std::chrono::steady_clock bench_clock;
+
+static double seconds_since(bench_clock::time_point start) {
+    return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+static double cpu_seconds() {
+    return (double)std::clock() / (double)CLOCKS_PER_SEC;
+}
+
+// Peak resident set size in kilobytes, 0 if unknown
+static long peak_rss_kb() {
+#ifndef _WIN32
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024;
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+static std::string temp_path(const char *name) {
+    const char *dir = getenv("TMPDIR");
+    if(dir == NULL) dir = getenv("TEMP");
+    if(dir == NULL) dir = "/tmp";
+
+    return std::string(dir) + "/" + name;
+}
+
+
+struct BenchOptions {
+    std::vector<const char *> models;
+    const char *audio_path = NULL;
+    const char *reference = NULL;
+    const char *json_path = NULL;
+    size_t streams = 4;
+    double latency_seconds = 10.0;
+    std::vector<size_t> beam_widths;
+    std::vector<int> affinity_cpus;
+};
+
+
+// Collects the text and the emission latency of one session's results
+struct StreamResults {
+    std::mutex mutex;
+    std::string text;
+    std::vector<double> partial_latency_ms;
+    std::vector<double> final_latency_ms;
+
+    // Only set when feeding in realtime. Audio up to time_ms was fed at
+    // feed_start + time_ms, so that is when a token at time_ms could at the
+    // earliest have been emitted
+    bool measure_latency = false;
+    bench_clock::time_point feed_start;
+    size_t last_token_ms = 0;
+
+    void handle(AprilResultType result, size_t count, const AprilToken *tokens) {
+        if((result != APRIL_RESULT_RECOGNITION_PARTIAL) && (result != APRIL_RESULT_RECOGNITION_FINAL)) return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        size_t token_ms = 0;
+        for(size_t i=0; i<count; i++) token_ms = std::max(token_ms, tokens[i].time_ms);
+
+        if(measure_latency && (count > 0)) {
+            double latency = seconds_since(feed_start) * 1000.0 - (double)token_ms;
+            if(result == APRIL_RESULT_RECOGNITION_FINAL) {
+                final_latency_ms.push_back(latency);
+            } else if(token_ms > last_token_ms) {
+                // Only partials that add a new token
+                partial_latency_ms.push_back(latency);
+            }
+        }
+        last_token_ms = std::max(last_token_ms, token_ms);
+
+        if(result == APRIL_RESULT_RECOGNITION_FINAL) {
+            for(size_t i=0; i<count; i++) text += tokens[i].token;
+        }
+    }
+};
+
+static void bench_handler(void *userdata, AprilResultType result, size_t count, const AprilToken *tokens) {
+    ((StreamResults *)userdata)->handle(result, count, tokens);
+}
+
+static std::vector<std::string> split_words(const std::string &text) {
+    std::vector<std::string> words;
+    std::istringstream stream(text);
+    std::string word;
+    while(stream >> word) {
+        std::string clean;
+        for(char c : word) {
+            if(isalnum((unsigned char)c) || (c == '\'')) clean += (char)tolower((unsigned char)c);
+        }
+        if(!clean.empty()) words.push_back(clean);
+    }
+    return words;
+}
+
+// Word error rate of hypothesis against reference, from the word-level
+// edit distance
+static double word_error_rate(const std::string &reference, const std::string &hypothesis) {
+    std::vector<std::string> ref = split_words(reference);
+    std::vector<std::string> hyp = split_words(hypothesis);
+    if(ref.empty()) return 0.0;
+
+    std::vector<size_t> prev(hyp.size() + 1), curr(hyp.size() + 1);
+    for(size_t j=0; j<=hyp.size(); j++) prev[j] = j;
+
+    for(size_t i=1; i<=ref.size(); i++) {
+        curr[0] = i;
+        for(size_t j=1; j<=hyp.size(); j++) {
+            size_t substitution = prev[j - 1] + (ref[i - 1] == hyp[j - 1] ? 0 : 1);
+            curr[j] = std::min(substitution, std::min(prev[j], curr[j - 1]) + 1);
+        }
+        std::swap(prev, curr);
+    }
+
+    return (double)prev[hyp.size()] / (double)ref.size();
+}
+
+
+// Minimal JSON writer, values are written as they come
+struct Json {
+    std::string out;
+    bool need_comma = false;
+
+    void key(const char *name) {
+        if(need_comma) out += ",";
+        out += "\"";
+        out += name;
+        out += "\":";
+        need_comma = false;
+    }
+
+    void open(const char *name, char bracket) {
+        if(name != NULL) key(name);
+        else if(need_comma) out += ",";
+        out += bracket;
+        need_comma = false;
+    }
+
+    void close(char bracket) {
+        out += bracket;
+        need_comma = true;
+    }
+
+    void number(const char *name, double value) {
+        key(name);
+        char buf[64];
+        snprintf(buf, sizeof(buf), "%.6g", std::isfinite(value) ? value : 0.0);
+        out += buf;
+        need_comma = true;
+    }
+
+    void string(const char *name, const std::string &value) {
+        key(name);
+        out += "\"";
+        json_escape(out, value.c_str());
+        out += "\"";
+        need_comma = true;
+    }
+
+    void percentiles(const char *name, const std::vector<double> &values) {
+        open(name, '{');
+        number("count", (double)values.size());
+        number("p50", percentile(values, 50.0));
+        number("p90", percentile(values, 90.0));
+        number("p99", percentile(values, 99.0));
+        number("max", percentile(values, 100.0));
+        close('}');
+    }
+};
+
+
+struct RunResult {
+    double wall_s = 0.0;
+    double cpu_s = 0.0;
+    std::string text;
+    size_t encoder_runs = 0;
+    size_t decoder_runs = 0;
+    size_t joiner_runs = 0;
+};
+
+static AprilConfig make_config(StreamResults *results, const BenchOptions &opts) {
+    AprilConfig config = { 0 };
+    config.handler = bench_handler;
+    config.userdata = results;
+
+    if(!opts.affinity_cpus.empty()) {
+        config.affinity_cpus = opts.affinity_cpus.data();
+        config.affinity_cpu_count = opts.affinity_cpus.size();
+    }
+
+    return config;
+}
+
+// Feeds all audio to one synchronous session as fast as possible
+static RunResult run_sync(AprilASRModel model, const std::vector<short> &audio, AprilConfig config) {
+    RunResult result;
+    StreamResults *results = (StreamResults *)config.userdata;
+
+    AprilASRSession session = aas_create_session(model, config);
+    if(session == NULL) return result;
+
+    const size_t chunk = 1600;
+
+    double cpu_start = cpu_seconds();
+    bench_clock::time_point start = bench_clock::now();
+    for(size_t i=0; i<audio.size(); i+=chunk) {
+        aas_feed_pcm16(session, (short *)&audio[i], std::min(chunk, audio.size() - i));
+    }
+    aas_flush(session);
+    result.wall_s = seconds_since(start);
+    result.cpu_s = cpu_seconds() - cpu_start;
+
+    result.encoder_runs = session->encoder_runs;
+    result.decoder_runs = session->decoder_runs;
+    result.joiner_runs = session->joiner_runs;
+    result.text = results->text;
+
+    aas_free(session);
+    return result;
+}
+
+// Feeds audio to an async session in realtime, 100ms at a time, for up to
+// max_seconds, then waits for processing to finish
+static void run_realtime(AprilASRModel model, const std::vector<short> &audio, AprilConfig config, double max_seconds) {
+    StreamResults *results = (StreamResults *)config.userdata;
+
+    AprilASRSession session = aas_create_session(model, config);
+    if(session == NULL) return;
+
+    size_t sample_rate = aam_get_sample_rate(model);
+    size_t chunk = sample_rate / 10;
+    size_t total = std::min(audio.size(), (size_t)(max_seconds * sample_rate));
+
+    results->measure_latency = true;
+    results->feed_start = bench_clock::now();
+    for(size_t i=0; i<total; i+=chunk) {
+        size_t count = std::min(chunk, total - i);
+
+        // Audio becomes available once all of it would have been captured
+        std::this_thread::sleep_until(results->feed_start
+            + std::chrono::milliseconds((i + count) * 1000 / sample_rate));
+
+        aas_feed_pcm16(session, (short *)&audio[i], count);
+    }
+    aas_flush(session);
+
+    while(aas_get_queued_ms(session) > 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    aas_free(session);
+}
+
+
+static void bench_load(Json &json, const char *path, AprilASRModel *model) {
+    bench_clock::time_point start = bench_clock::now();
+    *model = aam_create_model(path);
+    double load_s = seconds_since(start);
+
+    json.open("load", '{');
+    json.number("load_ms", load_s * 1000.0);
+    json.number("rss_kb", (double)peak_rss_kb());
+    json.close('}');
+}
+
+static void bench_single_stream(Json &json, AprilASRModel model, const std::vector<short> &audio, const BenchOptions &opts) {
+    double audio_s = (double)audio.size() / (double)aam_get_sample_rate(model);
+
+    StreamResults results;
+    RunResult run = run_sync(model, audio, make_config(&results, opts));
+
+    json.open("single_stream", '{');
+    json.number("audio_s", audio_s);
+    json.number("rtf", run.wall_s / audio_s);
+    json.number("cpu_rtf", run.cpu_s / audio_s);
+    json.number("encoder_runs_per_s", (double)run.encoder_runs / audio_s);
+    json.number("decoder_runs_per_s", (double)run.decoder_runs / audio_s);
+    json.number("joiner_runs_per_s", (double)run.joiner_runs / audio_s);
+    if(opts.reference != NULL) json.number("wer", word_error_rate(opts.reference, run.text));
+    json.string("text", run.text);
+    json.close('}');
+}
+
+// Splits the time spent into stages. The fbank is timed on its own, the
+// encoder and decoder by replaying dumps of their inputs
+static void bench_stages(Json &json, AprilASRModel model, const std::vector<short> &audio, const BenchOptions &opts) {
+    double audio_s = (double)audio.size() / (double)aam_get_sample_rate(model);
+
+    OnlineFBank fbank = make_fbank(model->fbank_opts);
+    std::vector<float> wave(3200);
+    std::vector<float> segment(SHAPE_PRODUCT3(model->x_dim));
+
+    bench_clock::time_point start = bench_clock::now();
+    for(size_t i=0; i<audio.size(); i+=wave.size()) {
+        size_t count = std::min(wave.size(), audio.size() - i);
+        for(size_t j=0; j<count; j++) wave[j] = (float)audio[i + j] / 32768.0f;
+
+        fbank_accept_waveform(fbank, wave.data(), count);
+        while(fbank_pull_segments(fbank, segment.data(), segment.size() * sizeof(float))) {}
+    }
+    double fbank_s = seconds_since(start);
+    free_fbank(fbank);
+
+    std::string feature_dump = temp_path("april_bench_features.dmp");
+    std::string encoder_dump = temp_path("april_bench_encoder.dmp");
+
+    StreamResults dump_results;
+    AprilConfig config = make_config(&dump_results, opts);
+    config.feature_dump_path = feature_dump.c_str();
+    config.encoder_dump_path = encoder_dump.c_str();
+    RunResult full = run_sync(model, audio, config);
+
+    double replay_s[2] = { 0.0, 0.0 };
+    size_t decode_calls = 0;
+    const std::string *dumps[2] = { &feature_dump, &encoder_dump };
+    for(int i=0; i<2; i++) {
+        StreamResults results;
+        AprilASRSession session = aas_create_session(model, make_config(&results, opts));
+        if(session == NULL) continue;
+
+        start = bench_clock::now();
+        aas_replay_dump(session, dumps[i]->c_str());
+        replay_s[i] = seconds_since(start);
+
+        if(i == 1) decode_calls = session->decoder_runs + session->joiner_runs;
+        aas_free(session);
+    }
+
+    remove(feature_dump.c_str());
+    remove(encoder_dump.c_str());
+
+    double encoder_s = std::max(replay_s[0] - replay_s[1], 0.0);
+    double decode_s = replay_s[1];
+
+    json.open("stages", '{');
+    json.number("fbank_rtf", fbank_s / audio_s);
+    json.number("encoder_rtf", encoder_s / audio_s);
+    json.number("decode_rtf", decode_s / audio_s);
+    json.number("total_rtf", full.wall_s / audio_s);
+    json.number("decode_us_per_call", decode_calls > 0 ? decode_s * 1e6 / (double)decode_calls : 0.0);
+    json.close('}');
+}
+
+static void bench_beam_widths(Json &json, AprilASRModel model, const std::vector<short> &audio, const BenchOptions &opts) {
+    if(opts.beam_widths.empty()) return;
+
+    double audio_s = (double)audio.size() / (double)aam_get_sample_rate(model);
+
+    json.open("beam_search", '[');
+    for(size_t width : opts.beam_widths) {
+        StreamResults results;
+        AprilConfig config = make_config(&results, opts);
+        if(width > 0) {
+            config.decoding_mode = APRIL_DECODING_MODIFIED_BEAM_SEARCH;
+            config.beam_width = width;
+        }
+
+        RunResult run = run_sync(model, audio, config);
+
+        json.open(NULL, '{');
+        json.number("beam_width", (double)width);
+        json.number("rtf", run.wall_s / audio_s);
+        json.number("joiner_runs_per_s", (double)run.joiner_runs / audio_s);
+        if(opts.reference != NULL) json.number("wer", word_error_rate(opts.reference, run.text));
+        json.close('}');
+    }
+    json.close(']');
+}
+
+// Aggregate throughput of N streams. In sync mode each stream gets its own
+// thread, in async mode all of them are fed from one thread as fast as
+// their buffers allow
+static void bench_throughput(Json &json, AprilASRModel model, const std::vector<short> &audio, const BenchOptions &opts) {
+    double audio_s = (double)audio.size() / (double)aam_get_sample_rate(model);
+    size_t n = opts.streams;
+
+    json.open("throughput", '{');
+    json.number("streams", (double)n);
+
+    {
+        std::vector<StreamResults> results(n);
+        std::vector<std::thread> threads;
+
+        bench_clock::time_point start = bench_clock::now();
+        for(size_t i=0; i<n; i++) {
+            AprilConfig config = make_config(&results[i], opts);
+            threads.emplace_back([&, config]() { run_sync(model, audio, config); });
+        }
+        for(std::thread &thread : threads) thread.join();
+
+        json.number("sync_audio_s_per_s", audio_s * (double)n / seconds_since(start));
+    }
+
+    {
+        std::vector<StreamResults> results(n);
+        std::vector<AprilASRSession> sessions(n);
+        for(size_t i=0; i<n; i++) {
+            AprilConfig config = make_config(&results[i], opts);
+            config.flags = APRIL_CONFIG_FLAG_ASYNC_NO_RT_BIT;
+            sessions[i] = aas_create_session(model, config);
+        }
+
+        const size_t chunk = 1600;
+        std::vector<size_t> fed(n, 0);
+
+        bench_clock::time_point start = bench_clock::now();
+        for(bool done = false; !done; ) {
+            done = true;
+            for(size_t i=0; i<n; i++) {
+                if((sessions[i] == NULL) || (fed[i] >= audio.size())) continue;
+
+                size_t count = std::min(chunk, audio.size() - fed[i]);
+                fed[i] += aas_feed_pcm16_ex(sessions[i], (short *)&audio[fed[i]], count, 0);
+                done = false;
+            }
+
+            if(!done) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+
+        for(size_t i=0; i<n; i++) {
+            if(sessions[i] == NULL) continue;
+
+            aas_flush(sessions[i]);
+            while(aas_get_queued_ms(sessions[i]) > 0) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+        }
+        double wall_s = seconds_since(start);
+
+        for(AprilASRSession session : sessions) aas_free(session);
+
+        json.number("async_audio_s_per_s", audio_s * (double)n / wall_s);
+    }
+
+    json.close('}');
+}
+
+// Feed-to-emission latency of realtime streams, for each mode that may
+// affect it. All streams of a mode run at once
+static void bench_latency(Json &json, AprilASRModel model, const std::vector<short> &audio, const BenchOptions &opts) {
+    struct Mode {
+        const char *name;
+        AprilConfigFlagBits flags;
+        AprilSpeedupMethod speedup;
+    };
+
+    const Mode modes[] = {
+        { "async_no_rt", APRIL_CONFIG_FLAG_ASYNC_NO_RT_BIT, APRIL_SPEEDUP_SONIC },
+        { "async_no_rt_pipelined", (AprilConfigFlagBits)(APRIL_CONFIG_FLAG_ASYNC_NO_RT_BIT | APRIL_CONFIG_FLAG_PIPELINED_BIT), APRIL_SPEEDUP_SONIC },
+        { "async_rt_sonic", APRIL_CONFIG_FLAG_ASYNC_RT_BIT, APRIL_SPEEDUP_SONIC },
+        { "async_rt_drop_frames", APRIL_CONFIG_FLAG_ASYNC_RT_BIT, APRIL_SPEEDUP_DROP_FRAMES },
+    };
+
+    json.open("latency", '[');
+    for(const Mode &mode : modes) {
+        std::vector<StreamResults> results(opts.streams);
+        std::vector<std::thread> threads;
+
+        double cpu_start = cpu_seconds();
+        for(size_t i=0; i<opts.streams; i++) {
+            AprilConfig config = make_config(&results[i], opts);
+            config.flags = mode.flags;
+            config.speedup_method = mode.speedup;
+            threads.emplace_back([&, config]() { run_realtime(model, audio, config, opts.latency_seconds); });
+        }
+        for(std::thread &thread : threads) thread.join();
+        double cpu_s = cpu_seconds() - cpu_start;
+
+        std::vector<double> partial, final;
+        double wer = 0.0;
+        for(StreamResults &result : results) {
+            partial.insert(partial.end(), result.partial_latency_ms.begin(), result.partial_latency_ms.end());
+            final.insert(final.end(), result.final_latency_ms.begin(), result.final_latency_ms.end());
+            if(opts.reference != NULL) wer += word_error_rate(opts.reference, result.text);
+        }
+
+        json.open(NULL, '{');
+        json.string("mode", mode.name);
+        json.number("streams", (double)opts.streams);
+        json.number("cpu_s", cpu_s);
+        json.percentiles("feed_to_partial_ms", partial);
+        json.percentiles("feed_to_final_ms", final);
+        if(opts.reference != NULL) json.number("wer", wer / (double)opts.streams);
+        json.close('}');
+    }
+    json.close(']');
+}
+
+
+static void print_usage(const char *name) {
+    printf("Usage: %s [modelpath...] [options]\n", name);
+    printf(" --audio FILE        16-bit mono wav or raw PCM16 at the model's sample\n");
+    printf("                     rate. Default: 30s of synthetic audio\n");
+    printf(" --ref TEXT          reference transcript of the audio, to report WER\n");
+    printf(" --streams N         concurrent streams for throughput and latency (4)\n");
+    printf(" --latency-seconds S audio fed in realtime per latency run (10)\n");
+    printf(" --beam-widths LIST  comma separated widths to compare, 0 is greedy\n");
+    printf(" --affinity LIST     comma separated CPUs to pin session threads to\n");
+    printf(" --json FILE         write results to FILE instead of stdout\n");
+}
+
+template<typename T>
+static std::vector<T> parse_list(const char *list) {
+    std::vector<T> values;
+    std::istringstream stream(list);
+    std::string item;
+    while(std::getline(stream, item, ',')) values.push_back((T)atol(item.c_str()));
+    return values;
+}
+
+int main(int argc, char *argv[]) {
+    BenchOptions opts;
+
+    for(int i=1; i<argc; i++) {
+        bool has_value = (i + 1) < argc;
+        if((strcmp(argv[i], "--audio") == 0) && has_value) opts.audio_path = argv[++i];
+        else if((strcmp(argv[i], "--ref") == 0) && has_value) opts.reference = argv[++i];
+        else if((strcmp(argv[i], "--json") == 0) && has_value) opts.json_path = argv[++i];
+        else if((strcmp(argv[i], "--streams") == 0) && has_value) opts.streams = std::max(1L, atol(argv[++i]));
+        else if((strcmp(argv[i], "--latency-seconds") == 0) && has_value) opts.latency_seconds = atof(argv[++i]);
+        else if((strcmp(argv[i], "--beam-widths") == 0) && has_value) opts.beam_widths = parse_list<size_t>(argv[++i]);
+        else if((strcmp(argv[i], "--affinity") == 0) && has_value) opts.affinity_cpus = parse_list<int>(argv[++i]);
+        else if(argv[i][0] == '-') {
+            print_usage(argv[0]);
+            return 1;
+        }
+        else opts.models.push_back(argv[i]);
+    }
+
+    if(opts.models.empty()) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    aam_api_init(APRIL_VERSION);
+
+    Json json;
+    json.open(NULL, '{');
+    json.number("format_version", BENCH_FORMAT_VERSION);
+    json.open("models", '[');
+
+    for(const char *path : opts.models) {
+        json.open(NULL, '{');
+        json.string("path", path);
+
+        AprilASRModel model = NULL;
+        bench_load(json, path, &model);
+        if(model == NULL) {
+            fprintf(stderr, "Loading model %s failed!\n", path);
+            json.close('}');
+            continue;
+        }
+
+        json.string("name", aam_get_name(model));
+        json.string("precision", aam_get_precision(model) == APRIL_MODEL_PRECISION_INT8 ? "int8" : "fp32");
+
+        std::vector<short> audio;
+        if(opts.audio_path != NULL) {
+            std::string error;
+            if(!load_audio(opts.audio_path, aam_get_sample_rate(model), audio, error)) {
+                fprintf(stderr, "Loading audio %s failed: %s\n", opts.audio_path, error.c_str());
+                return 1;
+            }
+        } else {
+            make_synthetic_audio(audio, aam_get_sample_rate(model), 30.0);
+        }
+
+        fprintf(stderr, "Benchmarking %s\n", path);
+        bench_single_stream(json, model, audio, opts);
+        bench_stages(json, model, audio, opts);
+        bench_beam_widths(json, model, audio, opts);
+        bench_throughput(json, model, audio, opts);
+        bench_latency(json, model, audio, opts);
+
+        json.number("peak_rss_kb", (double)peak_rss_kb());
+        json.close('}');
+
+        aam_free(model);
+    }
+
+    json.close(']');
+    json.close('}');
+    json.out += "\n";
+
+    FILE *out = opts.json_path != NULL ? fopen(opts.json_path, "w") : stdout;
+    if(out == NULL) {
+        fprintf(stderr, "Can't write to %s\n", opts.json_path);
+        return 1;
+    }
+
+    fputs(json.out.c_str(), out);
+    if(out != stdout) fclose(out);
+
+    return 0;
+}
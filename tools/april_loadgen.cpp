@@ -0,0 +1,474 @@
+// Opens many concurrent streams to april_server, sends audio at real-time
+// pace and measures how far behind the results fall, to find how many
+// streams a machine can serve:
+// $ ./april_loadgen --unix /tmp/april.sock --audio test.wav --streams 1,2,4,8,16
+// $ ./april_loadgen --ws-port 2700 --audio test.wav --streams 32 --fast
+//
+// For each level of concurrency it reports:
+// - lag: time from sending the audio a result covers to receiving it, from
+//   the time_ms of the last token in each partial/final result.
+// - finish: time from the end of the audio to the "done" message.
+// The audio should contain speech, since silence gives no results to time.
+// Without --audio, synthetic audio is used and only finish is meaningful.
+
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "tool_util.h"
+
+#define DEFAULT_SAMPLE_RATE 16000
+
+// How long to wait for the server before giving up on a stream
+#define STREAM_TIMEOUT_MS 60000
+
+typedef std::chrono::steady_clock load_clock;
+
+struct LoadOptions {
+    const char *unix_path = NULL;
+    int ws_port = 0;
+    const char *audio_path = NULL;
+    double seconds = 10.0;
+    std::vector<size_t> levels;
+    size_t chunk_ms = 100;
+    bool fast = false;
+    double max_lag_ms = 1000.0;
+};
+
+struct StreamResult {
+    bool ok = false;
+    std::string error;
+    std::vector<double> lags_ms;
+    double finish_ms = 0.0;
+    size_t results = 0;
+};
+
+static double ms_since(load_clock::time_point start) {
+    return std::chrono::duration<double, std::milli>(load_clock::now() - start).count();
+}
+
+// Finds "key":value in a flat JSON object
+static bool json_find(const std::string &json, const char *key, std::string &value) {
+    std::string pattern = std::string("\"") + key + "\":";
+    size_t start = json.find(pattern);
+    if(start == std::string::npos) return false;
+
+    start += pattern.size();
+    if((start < json.size()) && (json[start] == '"')) {
+        size_t end = json.find('"', start + 1);
+        if(end == std::string::npos) return false;
+        value = json.substr(start + 1, end - start - 1);
+    } else {
+        size_t end = json.find_first_of(",}", start);
+        value = json.substr(start, end - start);
+    }
+
+    return true;
+}
+
+
+// One client connection, speaking either protocol
+class Client {
+public:
+    ~Client() {
+        if(fd >= 0) close(fd);
+    }
+
+    bool connect_to(const LoadOptions &opts, std::string &error) {
+        websocket = opts.unix_path == NULL;
+
+        if(!websocket) {
+            struct sockaddr_un addr = { 0 };
+            addr.sun_family = AF_UNIX;
+            strncpy(addr.sun_path, opts.unix_path, sizeof(addr.sun_path) - 1);
+
+            fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            if((fd < 0) || (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+                error = std::string("connect: ") + strerror(errno);
+                return false;
+            }
+
+            return true;
+        }
+
+        struct sockaddr_in addr = { 0 };
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons((uint16_t)opts.ws_port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if((fd < 0) || (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)) {
+            error = std::string("connect: ") + strerror(errno);
+            return false;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        uint8_t key[16];
+        for(int i=0; i<16; i++) key[i] = (uint8_t)next_random();
+
+        std::string request = "GET / HTTP/1.1\r\n"
+            "Host: 127.0.0.1\r\n"
+            "Upgrade: websocket\r\n"
+            "Connection: Upgrade\r\n"
+            "Sec-WebSocket-Key: " + base64(key, 16) + "\r\n"
+            "Sec-WebSocket-Version: 13\r\n\r\n";
+
+        if(!send_all(request.data(), request.size())) {
+            error = "failed to send handshake";
+            return false;
+        }
+
+        while(input.find("\r\n\r\n") == std::string::npos) {
+            if(!receive(STREAM_TIMEOUT_MS)) {
+                error = "no handshake response";
+                return false;
+            }
+        }
+
+        size_t end = input.find("\r\n\r\n");
+        bool upgraded = input.compare(0, 12, "HTTP/1.1 101") == 0;
+        input.erase(0, end + 4);
+
+        if(!upgraded) {
+            error = "handshake rejected";
+            return false;
+        }
+
+        return true;
+    }
+
+    bool send_audio(const short *samples, size_t count) {
+        if(!websocket) return send_all(samples, count * sizeof(short));
+
+        return send_frame(0x2, samples, count * sizeof(short));
+    }
+
+    bool send_eof() {
+        if(!websocket) return shutdown(fd, SHUT_WR) == 0;
+
+        return send_frame(0x1, "eof", 3);
+    }
+
+    // Waits up to timeout_ms for data. Returns false on timeout or when
+    // the connection is closed
+    bool receive(int timeout_ms) {
+        struct pollfd pfd = { fd, POLLIN, 0 };
+        int ready = poll(&pfd, 1, timeout_ms);
+        if(ready <= 0) return false;
+
+        char buffer[16384];
+        ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+        if(count <= 0) return false;
+
+        input.append(buffer, (size_t)count);
+        return true;
+    }
+
+    // Takes the next complete message out of the input, if any
+    bool next_message(std::string &message) {
+        if(!websocket) {
+            size_t end = input.find('\n');
+            if(end == std::string::npos) return false;
+
+            message = input.substr(0, end);
+            input.erase(0, end + 1);
+            return true;
+        }
+
+        for(;;) {
+            if(input.size() < 2) return false;
+
+            const uint8_t *p = (const uint8_t *)input.data();
+            uint8_t opcode = p[0] & 0x0F;
+            uint64_t size = p[1] & 0x7F;
+            size_t header_size = 2;
+
+            if(size == 126) {
+                if(input.size() < 4) return false;
+                size = ((uint64_t)p[2] << 8) | p[3];
+                header_size = 4;
+            } else if(size == 127) {
+                if(input.size() < 10) return false;
+                size = 0;
+                for(int i=0; i<8; i++) size = (size << 8) | p[2 + i];
+                header_size = 10;
+            }
+
+            if(input.size() < header_size + size) return false;
+
+            std::string payload = input.substr(header_size, size);
+            input.erase(0, header_size + size);
+
+            // Only text messages carry results
+            if(opcode == 0x1) {
+                message = payload;
+                return true;
+            }
+        }
+    }
+
+private:
+    int fd = -1;
+    bool websocket = false;
+    std::string input;
+    uint32_t random_state = (uint32_t)std::chrono::steady_clock::now().time_since_epoch().count();
+
+    uint32_t next_random() {
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        return random_state;
+    }
+
+    bool send_all(const void *data, size_t size) {
+        const char *p = (const char *)data;
+        while(size > 0) {
+            ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+            if(sent < 0) {
+                if(errno == EINTR) continue;
+                return false;
+            }
+
+            p += sent;
+            size -= (size_t)sent;
+        }
+
+        return true;
+    }
+
+    // Client frames must be masked
+    bool send_frame(uint8_t opcode, const void *data, size_t size) {
+        std::string frame;
+        frame += (char)(0x80 | opcode);
+        if(size < 126) {
+            frame += (char)(0x80 | size);
+        } else if(size <= 0xFFFF) {
+            frame += (char)(0x80 | 126);
+            frame += (char)(size >> 8);
+            frame += (char)(size & 0xFF);
+        } else {
+            frame += (char)(0x80 | 127);
+            for(int i=7; i>=0; i--) frame += (char)((uint64_t)size >> (i * 8));
+        }
+
+        uint8_t mask[4];
+        for(int i=0; i<4; i++) mask[i] = (uint8_t)next_random();
+        frame.append((const char *)mask, 4);
+
+        const uint8_t *payload = (const uint8_t *)data;
+        size_t start = frame.size();
+        frame.resize(start + size);
+        for(size_t i=0; i<size; i++) frame[start + i] = (char)(payload[i] ^ mask[i % 4]);
+
+        return send_all(frame.data(), frame.size());
+    }
+};
+
+
+static void handle_message(const std::string &message, load_clock::time_point start, bool realtime, StreamResult &result, bool &done) {
+    std::string type;
+    if(!json_find(message, "type", type)) return;
+
+    if(type == "done") {
+        done = true;
+    } else if(type == "error") {
+        std::string text;
+        json_find(message, "message", text);
+        result.error = text;
+    } else if((type == "partial") || (type == "final")) {
+        result.results++;
+
+        std::string time_ms;
+        if(realtime && json_find(message, "time_ms", time_ms)) {
+            double lag = ms_since(start) - atof(time_ms.c_str());
+            result.lags_ms.push_back(lag > 0.0 ? lag : 0.0);
+        }
+    }
+}
+
+static void run_stream(const LoadOptions &opts, const std::vector<short> *file_audio, StreamResult &result) {
+    Client client;
+    if(!client.connect_to(opts, result.error)) return;
+
+    // The first message tells the sample rate
+    std::string message;
+    while(!client.next_message(message)) {
+        if(!client.receive(STREAM_TIMEOUT_MS)) {
+            result.error = "no ready message";
+            return;
+        }
+    }
+
+    std::string value;
+    if(!json_find(message, "type", value) || (value != "ready")) {
+        json_find(message, "message", value);
+        result.error = "not ready: " + value;
+        return;
+    }
+
+    size_t sample_rate = DEFAULT_SAMPLE_RATE;
+    if(json_find(message, "sample_rate", value)) sample_rate = (size_t)atol(value.c_str());
+
+    std::vector<short> synthetic;
+    if(file_audio == NULL) make_synthetic_audio(synthetic, sample_rate, opts.seconds);
+    const std::vector<short> &audio = file_audio != NULL ? *file_audio : synthetic;
+
+    size_t chunk = std::max((size_t)1, sample_rate * opts.chunk_ms / 1000);
+    bool realtime = !opts.fast;
+    bool done = false;
+
+    load_clock::time_point start = load_clock::now();
+    for(size_t head = 0; head < audio.size(); ) {
+        size_t count = std::min(chunk, audio.size() - head);
+        if(!client.send_audio(&audio[head], count)) {
+            result.error = "failed to send audio";
+            return;
+        }
+        head += count;
+
+        // Read results until this audio is due in real time
+        double due_ms = realtime ? (double)head * 1000.0 / (double)sample_rate : 0.0;
+        do {
+            double wait_ms = due_ms - ms_since(start);
+            if(!client.receive(wait_ms > 0.0 ? (int)wait_ms : 0)) break;
+
+            while(client.next_message(message)) handle_message(message, start, realtime, result, done);
+        } while(ms_since(start) < due_ms);
+    }
+
+    load_clock::time_point end_of_audio = load_clock::now();
+    if(!client.send_eof()) {
+        result.error = "failed to send eof";
+        return;
+    }
+
+    while(!done) {
+        while(client.next_message(message)) handle_message(message, start, realtime, result, done);
+        if(done) break;
+
+        if(!client.receive(STREAM_TIMEOUT_MS)) {
+            result.error = "closed before done";
+            return;
+        }
+    }
+
+    result.finish_ms = ms_since(end_of_audio);
+    result.ok = result.error.empty();
+}
+
+static std::vector<size_t> parse_levels(const char *list) {
+    std::vector<size_t> levels;
+    for(const char *p = list; *p != 0; ) {
+        levels.push_back((size_t)atol(p));
+        p = strchr(p, ',');
+        if(p == NULL) break;
+        p++;
+    }
+
+    return levels;
+}
+
+int main(int argc, char *argv[]) {
+    LoadOptions opts;
+
+    for(int i=1; i<argc; i++) {
+        bool has_value = (i + 1) < argc;
+        if((strcmp(argv[i], "--unix") == 0) && has_value) opts.unix_path = argv[++i];
+        else if((strcmp(argv[i], "--ws-port") == 0) && has_value) opts.ws_port = atoi(argv[++i]);
+        else if((strcmp(argv[i], "--audio") == 0) && has_value) opts.audio_path = argv[++i];
+        else if((strcmp(argv[i], "--seconds") == 0) && has_value) opts.seconds = atof(argv[++i]);
+        else if((strcmp(argv[i], "--streams") == 0) && has_value) opts.levels = parse_levels(argv[++i]);
+        else if((strcmp(argv[i], "--chunk-ms") == 0) && has_value) opts.chunk_ms = (size_t)atol(argv[++i]);
+        else if((strcmp(argv[i], "--max-lag-ms") == 0) && has_value) opts.max_lag_ms = atof(argv[++i]);
+        else if(strcmp(argv[i], "--fast") == 0) opts.fast = true;
+        else {
+            printf("Usage: %s (--unix PATH | --ws-port PORT) [options]\n", argv[0]);
+            printf(" --audio FILE        16 bit mono wav or raw PCM16 at the model's sample rate\n");
+            printf(" --seconds S         length of the synthetic audio if no file (default 10)\n");
+            printf(" --streams N,N,...   concurrent streams for each run (default 1,2,4,8)\n");
+            printf(" --chunk-ms MS       audio sent per write (default 100)\n");
+            printf(" --max-lag-ms MS     p99 lag at which a level counts as overloaded (default 1000)\n");
+            printf(" --fast              send audio as fast as possible instead of in real time\n");
+            return 1;
+        }
+    }
+
+    if((opts.unix_path == NULL) && (opts.ws_port <= 0)) {
+        printf("Either --unix or --ws-port is required\n");
+        return 1;
+    }
+
+    if(opts.levels.empty()) opts.levels = { 1, 2, 4, 8 };
+    if(opts.chunk_ms == 0) opts.chunk_ms = 1;
+
+    std::vector<short> file_audio;
+    std::string error;
+    if((opts.audio_path != NULL) && !load_audio(opts.audio_path, 0, file_audio, error)) {
+        printf("Failed to load audio %s: %s\n", opts.audio_path, error.c_str());
+        return 1;
+    }
+
+    if(opts.fast) printf("Sending as fast as possible, lag is not measured\n");
+
+    printf("%8s %6s %6s %8s %10s %10s %10s %10s %10s\n",
+        "streams", "ok", "failed", "results", "lag_p50", "lag_p90", "lag_p99", "finish_p50", "finish_p99");
+
+    size_t highest_ok = 0;
+    for(size_t level : opts.levels) {
+        std::vector<StreamResult> results(level);
+        std::vector<std::thread> threads;
+        for(size_t i=0; i<level; i++) {
+            threads.emplace_back(run_stream, std::cref(opts), file_audio.empty() ? NULL : &file_audio, std::ref(results[i]));
+        }
+        for(std::thread &thread : threads) thread.join();
+
+        std::vector<double> lags, finishes;
+        size_t ok = 0, total_results = 0;
+        std::string first_error;
+        for(StreamResult &result : results) {
+            if(result.ok) {
+                ok++;
+                finishes.push_back(result.finish_ms);
+            } else if(first_error.empty()) {
+                first_error = result.error;
+            }
+
+            total_results += result.results;
+            lags.insert(lags.end(), result.lags_ms.begin(), result.lags_ms.end());
+        }
+
+        double lag_p99 = percentile(lags, 99.0);
+        printf("%8zu %6zu %6zu %8zu %10.1f %10.1f %10.1f %10.1f %10.1f\n",
+            level, ok, level - ok, total_results,
+            percentile(lags, 50.0), percentile(lags, 90.0), lag_p99,
+            percentile(finishes, 50.0), percentile(finishes, 99.0));
+
+        if(!first_error.empty()) printf("         first error: %s\n", first_error.c_str());
+        fflush(stdout);
+
+        if((ok == level) && (opts.fast || (lag_p99 <= opts.max_lag_ms))) highest_ok = std::max(highest_ok, level);
+    }
+
+    if(!opts.fast) {
+        printf("\nHighest level with every stream done and p99 lag under %.0f ms: %zu\n", opts.max_lag_ms, highest_ok);
+    }
+
+    return 0;
+}
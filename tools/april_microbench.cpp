@@ -0,0 +1,416 @@
+// Benchmarks the C kernels on their own, without needing a model or
+// ONNXRuntime to run. Use it to check optimizations to fbank, the FFT, Sonic,
+// the audio ring buffer and the logits processing:
+// $ ./april_microbench
+// $ ./april_microbench --reps 50 fbank rfft
+//
+// Given a model, it also compares the per-call cost of the decoder and
+// joiner networks through plain Run and through the session's IoBindings:
+// $ ./april_microbench --model /path/to/model.april networks
+
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+#include "april_api.h"
+
+extern "C" {
+#include "april_session.h"
+#include "audio_provider.h"
+#include "fbank.h"
+#include "logits.h"
+#include "fft/pocketfft.h"
+#include "sonic/sonic.h"
+
+bool aas_process_logits(AprilASRSession aas, float early_emit);
+void aas_run_decoder(AprilASRSession aas);
+void aas_run_joiner(AprilASRSession aas);
+}
+
+typedef std::chrono::steady_clock bench_clock;
+
+#define SAMPLE_RATE 16000
+
+static int g_warmup = 3;
+static int g_reps = 20;
+static const char *g_model_path = NULL;
+
+// Runs fn warmup + reps times. Each call returns how many units it
+// processed, and the statistics are in nanoseconds per unit
+static void measure(const char *name, const char *unit, const std::function<size_t()> &fn) {
+    for(int i=0; i<g_warmup; i++) fn();
+
+    std::vector<double> samples;
+    for(int i=0; i<g_reps; i++) {
+        bench_clock::time_point start = bench_clock::now();
+        size_t units = fn();
+        double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+
+        samples.push_back(ns / (double)std::max(units, (size_t)1));
+    }
+
+    std::sort(samples.begin(), samples.end());
+
+    double mean = 0.0;
+    for(double s : samples) mean += s;
+    mean /= (double)samples.size();
+
+    double variance = 0.0;
+    for(double s : samples) variance += (s - mean) * (s - mean);
+    double stddev = sqrt(variance / (double)samples.size());
+
+    printf("%-36s %12.1f %12.1f %10.1f %12.1f  ns/%s\n",
+        name, samples[samples.size() / 2], mean, stddev, samples[0], unit);
+}
+
+static void print_header(const char *group) {
+    printf("\n%-36s %12s %12s %10s %12s\n", group, "median", "mean", "stddev", "min");
+}
+
+static std::vector<float> make_wave(size_t count) {
+    std::vector<float> wave(count);
+    for(size_t i=0; i<count; i++) {
+        wave[i] = 0.3f * sinf((float)i * 0.05f) + 0.05f * sinf((float)i * 1.3f);
+    }
+    return wave;
+}
+
+static FBankOptions default_fbank_options() {
+    FBankOptions opts = { 0 };
+    opts.sample_freq = SAMPLE_RATE;
+    opts.frame_shift_ms = 10;
+    opts.frame_length_ms = 25;
+    opts.num_bins = 80;
+    opts.round_pow2 = true;
+    opts.mel_low = 20;
+    opts.snip_edges = true;
+    opts.pull_segment_count = 9;
+    opts.pull_segment_step = 4;
+    opts.remove_dc_offset = true;
+    opts.preemph_coeff = 0.97f;
+    return opts;
+}
+
+
+// Feeds one second of audio in chunks of the given size, pulling segments
+// as they become ready, as aas_feed_pcm16 does
+static void bench_fbank() {
+    print_header("fbank_accept_waveform");
+
+    FBankOptions opts = default_fbank_options();
+    std::vector<float> wave = make_wave(SAMPLE_RATE);
+    std::vector<float> segment(opts.pull_segment_count * opts.num_bins);
+
+    const size_t chunk_sizes[] = { 160, 480, 1600, 3200 };
+    for(size_t chunk : chunk_sizes) {
+        OnlineFBank fbank = make_fbank(opts);
+        std::vector<float> buffer(chunk);
+
+        char name[64];
+        snprintf(name, sizeof(name), "chunk %zu samples", chunk);
+        measure(name, "audio_s", [&]() {
+            for(size_t i=0; i+chunk<=wave.size(); i+=chunk) {
+                // fbank may modify the wave in place when sped up
+                memcpy(buffer.data(), &wave[i], chunk * sizeof(float));
+                fbank_accept_waveform(fbank, buffer.data(), chunk);
+                while(fbank_pull_segments(fbank, segment.data(), segment.size() * sizeof(float))) {}
+            }
+            return (size_t)1;
+        });
+
+        free_fbank(fbank);
+    }
+}
+
+static void bench_rfft() {
+    print_header("rfft_forward");
+
+    const size_t sizes[] = { 256, 512, 1024 };
+    for(size_t size : sizes) {
+        rfft_plan plan = make_rfft_plan(size);
+        std::vector<double> input(size), data(size);
+        for(size_t i=0; i<size; i++) input[i] = sin((double)i * 0.1);
+
+        const size_t calls = 1000;
+
+        char name[64];
+        snprintf(name, sizeof(name), "size %zu", size);
+        measure(name, "call", [&]() {
+            for(size_t i=0; i<calls; i++) {
+                memcpy(data.data(), input.data(), size * sizeof(double));
+                rfft_forward(plan, data.data(), 1.0);
+            }
+            return calls;
+        });
+
+        destroy_rfft_plan(plan);
+    }
+}
+
+// Streams one second of audio through Sonic in 100ms chunks
+static void bench_sonic() {
+    print_header("sonic write + read");
+
+    std::vector<float> wave = make_wave(SAMPLE_RATE);
+    std::vector<float> output(SAMPLE_RATE);
+    const size_t chunk = SAMPLE_RATE / 10;
+
+    const float speeds[] = { 1.0f, 1.25f, 1.5f, 1.75f, 2.0f };
+    for(float speed : speeds) {
+        sonicStream stream = sonicCreateStream(SAMPLE_RATE, 1);
+        sonicSetSpeed(stream, speed);
+
+        char name[64];
+        snprintf(name, sizeof(name), "speed %.2f", speed);
+        measure(name, "audio_s", [&]() {
+            for(size_t i=0; i+chunk<=wave.size(); i+=chunk) {
+                sonicWriteFloatToStream(stream, &wave[i], (int)chunk);
+
+                int available = sonicSamplesAvailable(stream);
+                sonicReadFloatFromStream(stream, output.data(), std::min(available, (int)output.size()));
+            }
+            return (size_t)1;
+        });
+
+        sonicDestroyStream(stream);
+    }
+}
+
+// One thread pushes 10ms chunks while another pulls, like the caller and a
+// session thread. The producer spins when the buffer is full
+static void bench_audio_provider() {
+    print_header("ap_push_audio / ap_pull_audio");
+
+    std::vector<short> chunk(160, 1000);
+    const size_t total = SAMPLE_RATE * 10;
+
+    const size_t pull_sizes[] = { 160, 3200 };
+    for(size_t pull_size : pull_sizes) {
+        char name[64];
+        snprintf(name, sizeof(name), "contended, pull %zu", pull_size);
+        measure(name, "sample", [&]() {
+            AudioProvider ap = ap_create();
+            std::atomic<bool> done(false);
+
+            std::thread consumer([&]() {
+                size_t pulled = 0;
+                while(pulled < total) {
+                    size_t count = pull_size;
+                    ap_pull_audio(ap, &count);
+                    if(count == 0) {
+                        if(done) break;
+                        continue;
+                    }
+
+                    ap_pull_audio_finish(ap, count);
+                    pulled += count;
+                }
+            });
+
+            for(size_t pushed = 0; pushed < total; ) {
+                size_t count = std::min(chunk.size(), total - pushed);
+                pushed += ap_push_audio_partial(ap, chunk.data(), count);
+            }
+            done = true;
+
+            consumer.join();
+            ap_free(ap);
+            return total;
+        });
+    }
+}
+
+static void no_op_handler(void *userdata, AprilResultType result, size_t count, const AprilToken *tokens) {}
+
+// The greedy decoder's per-frame work, on the blank frames that make up
+// most of the audio. Frames that emit a token also run the decoder network,
+// which needs a model, so only blank frames are measured here
+static void bench_logits() {
+    print_header("logits");
+
+    const size_t vocab_sizes[] = { 500, 2000, 8000 };
+    for(size_t vocab : vocab_sizes) {
+        std::vector<float> logits(vocab);
+        for(size_t i=0; i<vocab; i++) logits[i] = -5.0f - 3.0f * sinf((float)i * 0.37f);
+        logits[0] = 10.0f;
+
+        const size_t calls = 10000;
+
+        char name[64];
+        snprintf(name, sizeof(name), "logits_argmax %zu", vocab);
+        measure(name, "call", [&]() {
+            float max_val;
+            volatile size_t sink = 0;
+            for(size_t i=0; i<calls; i++) sink = sink + logits_argmax(logits.data(), vocab, 0, &max_val);
+            return calls;
+        });
+
+        snprintf(name, sizeof(name), "logits_logsumexp %zu", vocab);
+        measure(name, "call", [&]() {
+            volatile float sink = 0.0f;
+            for(size_t i=0; i<calls; i++) sink = sink + logits_logsumexp(logits.data(), vocab, 10.0f);
+            return calls;
+        });
+
+        std::vector<char> pool(vocab * 2);
+        std::vector<uint32_t> offsets(vocab);
+        std::vector<uint8_t> classes(vocab, 0);
+        for(size_t i=0; i<vocab; i++) {
+            pool[i * 2] = 'a' + (char)(i % 26);
+            offsets[i] = (uint32_t)(i * 2);
+        }
+
+        struct AprilASRModel_i model = {};
+        model.params.blank_id = 0;
+        model.params.token_count = (int)vocab;
+        model.params.token_pool = pool.data();
+        model.params.token_offsets = offsets.data();
+        model.params.token_classes = classes.data();
+
+        int64_t context[2] = { 0, 0 };
+
+        struct AprilASRSession_i session = {};
+        session.model = &model;
+        session.handler = no_op_handler;
+        session.logits.data = logits.data();
+        session.context.data = context;
+        session.context_size = 2;
+        session.emitted_silence = true;
+
+        snprintf(name, sizeof(name), "aas_process_logits %zu", vocab);
+        measure(name, "call", [&]() {
+            for(size_t i=0; i<calls; i++) {
+                // Keep it from deciding there has been a long silence
+                session.last_emission_time_ms = session.current_time_ms;
+                aas_process_logits(&session, 0.0f);
+            }
+            return calls;
+        });
+    }
+}
+
+// The decoder and joiner run once or more per emitted token, on tiny inputs,
+// so per-call overhead matters. Run resolves the names and validates the
+// values on every call, RunWithBinding reuses what was bound at session
+// creation. Both write to the same preallocated output tensors
+static void bench_networks() {
+    print_header("networks");
+
+    if(g_model_path == NULL) {
+        printf("(skipped, needs --model)\n");
+        return;
+    }
+
+    aam_api_init(APRIL_VERSION);
+
+    AprilASRModel model = aam_create_model(g_model_path);
+    if(model == NULL) {
+        printf("(skipped, failed to load %s)\n", g_model_path);
+        return;
+    }
+
+    AprilConfig config = {};
+    config.handler = no_op_handler;
+    config.flags = APRIL_CONFIG_FLAG_ZERO_BIT;
+
+    AprilASRSession session = aas_create_session(model, config);
+    if(session == NULL) {
+        printf("(skipped, failed to create a session)\n");
+        aam_free(model);
+        return;
+    }
+
+    const size_t calls = 1000;
+
+    if(!model->fused) {
+        measure("decoder Run", "call", [&]() {
+            for(size_t i=0; i<calls; i++) {
+                ORT_ABORT_ON_ERROR(g_ort->Run(model->decoder, NULL,
+                    decoder_input_names, (const OrtValue* const*)&session->context.tensor, 1,
+                    decoder_output_names, 1, &session->dout.tensor));
+            }
+            return calls;
+        });
+
+        measure("decoder RunWithBinding", "call", [&]() {
+            for(size_t i=0; i<calls; i++) aas_run_decoder(session);
+            return calls;
+        });
+    }
+
+    const OrtValue *joiner_inputs[] = {
+        session->eout.tensor,
+        model->fused ? session->context.tensor : session->dout.tensor
+    };
+    const char **input_names = model->fused ? fused_joiner_input_names : joiner_input_names;
+
+    measure("joiner Run", "call", [&]() {
+        for(size_t i=0; i<calls; i++) {
+            ORT_ABORT_ON_ERROR(g_ort->Run(model->joiner, NULL,
+                input_names, joiner_inputs, 2,
+                joiner_output_names, 1, &session->logits.tensor));
+        }
+        return calls;
+    });
+
+    measure("joiner RunWithBinding", "call", [&]() {
+        for(size_t i=0; i<calls; i++) aas_run_joiner(session);
+        return calls;
+    });
+
+    aas_free(session);
+    aam_free(model);
+}
+
+
+struct Benchmark {
+    const char *name;
+    void (*run)();
+};
+
+static const Benchmark benchmarks[] = {
+    { "fbank", bench_fbank },
+    { "rfft", bench_rfft },
+    { "sonic", bench_sonic },
+    { "audio_provider", bench_audio_provider },
+    { "logits", bench_logits },
+    { "networks", bench_networks },
+};
+
+int main(int argc, char *argv[]) {
+    std::vector<std::string> selected;
+
+    for(int i=1; i<argc; i++) {
+        bool has_value = (i + 1) < argc;
+        if((strcmp(argv[i], "--reps") == 0) && has_value) g_reps = std::max(1, atoi(argv[++i]));
+        else if((strcmp(argv[i], "--warmup") == 0) && has_value) g_warmup = std::max(0, atoi(argv[++i]));
+        else if((strcmp(argv[i], "--model") == 0) && has_value) g_model_path = argv[++i];
+        else if(argv[i][0] == '-') {
+            printf("Usage: %s [--reps N] [--warmup N] [--model path] [benchmark...]\n", argv[0]);
+            printf("Benchmarks:");
+            for(const Benchmark &benchmark : benchmarks) printf(" %s", benchmark.name);
+            printf("\n");
+            return 1;
+        }
+        else selected.push_back(argv[i]);
+    }
+
+    printf("%d repetitions after %d warmup runs\n", g_reps, g_warmup);
+
+    for(const Benchmark &benchmark : benchmarks) {
+        if(!selected.empty() && (std::find(selected.begin(), selected.end(), benchmark.name) == selected.end())) {
+            continue;
+        }
+
+        benchmark.run();
+    }
+
+    return 0;
+}
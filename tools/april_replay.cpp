@@ -0,0 +1,127 @@
+// Replays a session recording made with AprilConfig.recording_path or
+// APRIL_RECORD_DIR, feeding the audio with the same timing it originally
+// arrived with. Useful to reproduce latency problems seen in production:
+// $ ./april_replay /tmp/recordings/aas_1684000000_0.rec /path/to/model.april
+
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <chrono>
+#include <thread>
+#include "april_api.h"
+
+extern "C" {
+#include "recorder.h"
+}
+
+typedef std::chrono::steady_clock replay_clock;
+
+static replay_clock::time_point start_time;
+
+// Prints every result with the time since replay began, so results can be
+// compared against the audio timing
+void handler(void *userdata, AprilResultType result, size_t count, const AprilToken *tokens) {
+    double elapsed = std::chrono::duration<double>(replay_clock::now() - start_time).count();
+
+    switch(result){
+        case APRIL_RESULT_RECOGNITION_FINAL:
+            printf("[%8.3f] @ ", elapsed);
+            break;
+        case APRIL_RESULT_RECOGNITION_PARTIAL:
+            printf("[%8.3f] - ", elapsed);
+            break;
+        case APRIL_RESULT_ERROR_CANT_KEEP_UP:
+            printf("[%8.3f] ! can't keep up\n", elapsed);
+            return;
+        case APRIL_RESULT_SILENCE:
+            printf("[%8.3f] . silence\n", elapsed);
+            return;
+        default:
+            return;
+    }
+
+    for(size_t t=0; t<count; t++){
+        printf("%s", tokens[t].token);
+    }
+    printf("\n");
+}
+
+int main(int argc, char *argv[]){
+    if(argc < 3){
+        printf("Usage: %s [recording] [modelpath] [--fast] [--sync]\n", argv[0]);
+        printf(" - [recording] is a recording made by a session\n");
+        printf(" - [modelpath] may be any model with the same sample rate\n");
+        printf(" - --fast feeds the audio as fast as possible, ignoring timing\n");
+        printf(" - --sync uses a synchronous session instead of the recorded flags\n");
+        return 1;
+    }
+
+    bool fast = false;
+    bool sync = false;
+    for(int i=3; i<argc; i++){
+        if(strcmp(argv[i], "--fast") == 0) fast = true;
+        else if(strcmp(argv[i], "--sync") == 0) sync = true;
+        else {
+            printf("Unknown option %s\n", argv[i]);
+            return 1;
+        }
+    }
+
+    aam_api_init(APRIL_VERSION);
+
+    RecordingReader reader = rec_open(argv[1]);
+    if(reader == NULL){
+        printf("Opening recording %s failed!\n", argv[1]);
+        return 1;
+    }
+
+    AprilASRModel model = aam_create_model(argv[2]);
+    if(model == NULL){
+        printf("Loading model %s failed!\n", argv[2]);
+        return 1;
+    }
+
+    if(aam_get_sample_rate(model) != rec_get_sample_rate(reader)){
+        printf("The model expects %zu Hz audio, but the recording is %zu Hz\n",
+            aam_get_sample_rate(model), rec_get_sample_rate(reader));
+        return 1;
+    }
+
+    AprilConfig config = { 0 };
+    config.handler = handler;
+    config.flags = sync ? APRIL_CONFIG_FLAG_ZERO_BIT : (AprilConfigFlagBits)rec_get_config_flags(reader);
+
+    AprilASRSession session = aas_create_session(model, config);
+    if(session == NULL){
+        printf("Creating session failed!\n");
+        return 1;
+    }
+
+    start_time = replay_clock::now();
+
+    RecordedEvent event;
+    while(rec_next(reader, &event)){
+        if(!fast){
+            std::this_thread::sleep_until(start_time + std::chrono::microseconds(event.time_us));
+        }
+
+        if(event.type == RECORDED_FEED){
+            aas_feed_pcm16(session, (short *)event.samples, event.sample_count);
+        }else if(event.type == RECORDED_FLUSH){
+            aas_flush(session);
+        }
+    }
+
+    // Async sessions process the last audio in the background
+    aas_flush(session);
+    while(aas_get_queued_ms(session) > 0){
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(500));
+
+    aas_free(session);
+    aam_free(model);
+    rec_close(reader);
+
+    return 0;
+}
@@ -0,0 +1,895 @@
+// Serves speech recognition for many concurrent streams over a Unix socket
+// and/or WebSocket on localhost, sharing one model between all of them:
+// $ ./april_server /path/to/model.april --unix /tmp/april.sock --ws-port 2700
+//
+// Audio is PCM16 mono at the model's sample rate.
+// - Unix socket: write the audio, then shut down the write side of the
+//   socket. Results come back as one JSON object per line.
+// - WebSocket (ws://127.0.0.1:PORT/): send audio in binary messages, then a
+//   text message "eof" or a close frame. Results come back as text messages.
+//
+// Messages sent to the client:
+//   {"type":"ready","sample_rate":16000}
+//   {"type":"partial","text":"...","time_ms":1240}
+//   {"type":"final","text":"...","time_ms":1240}
+//   {"type":"silence"}
+//   {"type":"error","message":"..."}
+//   {"type":"done"}, after which the server closes the connection
+//
+// A few I/O threads handle the sockets with epoll. Each stream has its own
+// synchronous session, run on a bounded pool of workers. A stream that
+// gets too far ahead of its worker stops being read from until it catches
+// up, so a fast client is throttled instead of growing memory. Use
+// april_loadgen to find how many streams a machine can serve.
+
+#include <stdio.h>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <strings.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "april_api.h"
+#include "tool_util.h"
+
+// Audio buffered per stream before its socket stops being read
+#define MAX_PENDING_SECONDS 2
+
+#define READ_BUFFER_SIZE 16384
+#define MAX_EVENTS 64
+
+// Largest WebSocket handshake and frame accepted
+#define MAX_HANDSHAKE_SIZE 8192
+#define MAX_FRAME_SIZE (1 << 20)
+
+// How often the I/O threads check for shutdown
+#define POLL_INTERVAL_MS 250
+
+enum Protocol {
+    PROTOCOL_UNIX,
+    PROTOCOL_WEBSOCKET
+};
+
+struct Listener {
+    int fd;
+    Protocol protocol;
+};
+
+struct IoThread {
+    int epoll_fd;
+    std::thread thread;
+};
+
+struct Connection {
+    int fd;
+    Protocol protocol;
+    IoThread *io;
+    AprilASRSession session = NULL;
+
+    // One reference for the I/O thread until the socket is closed, and one
+    // while queued for or owned by a worker
+    std::atomic<int> refs{1};
+
+    // Only used by the I/O thread
+    std::string input;
+    bool handshake_done = false;
+    bool binary_message = false;
+    int odd_byte = -1;
+
+    // The rest is shared with the workers
+    std::mutex mutex;
+    std::vector<short> pending;
+    uint32_t events = 0;
+
+    // The client is done sending, or its side was closed
+    bool eof = false;
+    bool read_done = false;
+
+    bool flushed = false;
+    bool queued = false;
+    bool paused = false;
+
+    // Close once the output has been sent
+    bool closing = false;
+    bool closed = false;
+    std::string out;
+};
+
+struct ServerOptions {
+    const char *model_path = NULL;
+    const char *unix_path = NULL;
+    int ws_port = 0;
+    size_t io_threads = 2;
+    size_t workers = 0;
+    size_t max_streams = 64;
+};
+
+static std::atomic<bool> g_stop(false);
+
+static AprilASRModel g_model = NULL;
+static size_t g_sample_rate = 0;
+static size_t g_max_streams = 0;
+
+static std::mutex g_queue_mutex;
+static std::condition_variable g_queue_cond;
+static std::deque<Connection *> g_queue;
+
+static std::mutex g_connections_mutex;
+static std::unordered_set<Connection *> g_connections;
+
+static std::atomic<size_t> g_streams_served(0);
+
+
+static void on_signal(int sig) {
+    g_stop = true;
+}
+
+static void release(Connection *c) {
+    if(--c->refs > 0) return;
+
+    {
+        std::lock_guard<std::mutex> lock(g_connections_mutex);
+        g_connections.erase(c);
+    }
+
+    aas_free(c->session);
+    delete c;
+}
+
+
+static uint32_t rotl32(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+static void sha1(const uint8_t *data, size_t size, uint8_t digest[20]) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+    std::vector<uint8_t> message(data, data + size);
+    message.push_back(0x80);
+    while((message.size() % 64) != 56) message.push_back(0);
+
+    uint64_t bits = (uint64_t)size * 8;
+    for(int i=7; i>=0; i--) message.push_back((uint8_t)(bits >> (i * 8)));
+
+    for(size_t block=0; block<message.size(); block+=64) {
+        uint32_t w[80];
+        for(int i=0; i<16; i++) {
+            const uint8_t *p = &message[block + i * 4];
+            w[i] = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | (uint32_t)p[3];
+        }
+        for(int i=16; i<80; i++) w[i] = rotl32(w[i-3] ^ w[i-8] ^ w[i-14] ^ w[i-16], 1);
+
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for(int i=0; i<80; i++) {
+            uint32_t f, k;
+            if(i < 20)      { f = (b & c) | (~b & d);          k = 0x5A827999; }
+            else if(i < 40) { f = b ^ c ^ d;                   k = 0x6ED9EBA1; }
+            else if(i < 60) { f = (b & c) | (b & d) | (c & d); k = 0x8F1BBCDC; }
+            else            { f = b ^ c ^ d;                   k = 0xCA62C1D6; }
+
+            uint32_t temp = rotl32(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotl32(b, 30);
+            b = a;
+            a = temp;
+        }
+
+        h[0] += a; h[1] += b; h[2] += c; h[3] += d; h[4] += e;
+    }
+
+    for(int i=0; i<20; i++) digest[i] = (uint8_t)(h[i / 4] >> (24 - (i % 4) * 8));
+}
+
+static void append_ws_header(std::string &out, uint8_t opcode, size_t size) {
+    out += (char)(0x80 | opcode);
+    if(size < 126) {
+        out += (char)size;
+    } else if(size <= 0xFFFF) {
+        out += (char)126;
+        out += (char)(size >> 8);
+        out += (char)(size & 0xFF);
+    } else {
+        out += (char)127;
+        for(int i=7; i>=0; i--) out += (char)((uint64_t)size >> (i * 8));
+    }
+}
+
+
+// Updates which events the I/O thread waits for. Called with the
+// connection's mutex held, from any thread
+static void update_events(Connection *c) {
+    if(c->closed) return;
+
+    uint32_t events = 0;
+    if(!c->paused && !c->read_done) events |= EPOLLIN;
+
+    // Closing also waits for EPOLLOUT, which comes right away once the
+    // output is sent, so that the I/O thread closes the socket
+    if(!c->out.empty() || c->closing) events |= EPOLLOUT;
+
+    if(events == c->events) return;
+
+    struct epoll_event ev = { 0 };
+    ev.events = events;
+    ev.data.ptr = c;
+    if(epoll_ctl(c->io->epoll_fd, EPOLL_CTL_MOD, c->fd, &ev) == 0) {
+        c->events = events;
+    }
+}
+
+// Sends as much of the output as the socket takes without blocking. Called
+// with the connection's mutex held
+static void send_output(Connection *c) {
+    while(!c->closed && !c->out.empty()) {
+        ssize_t sent = send(c->fd, c->out.data(), c->out.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+        if(sent > 0) {
+            c->out.erase(0, (size_t)sent);
+        } else if((sent < 0) && (errno == EINTR)) {
+            continue;
+        } else if((sent < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) {
+            break;
+        } else {
+            // The client is gone, nothing more can be sent
+            c->out.clear();
+            c->closing = true;
+        }
+    }
+
+    update_events(c);
+}
+
+static void send_message(Connection *c, const std::string &json) {
+    if(c->closed) return;
+
+    if(c->protocol == PROTOCOL_WEBSOCKET) {
+        append_ws_header(c->out, 0x1, json.size());
+        c->out += json;
+    } else {
+        c->out += json;
+        c->out += '\n';
+    }
+
+    send_output(c);
+}
+
+// Sends the last message and closes the connection once it's out
+static void finish(Connection *c, const std::string &json) {
+    send_message(c, json);
+
+    if((c->protocol == PROTOCOL_WEBSOCKET) && !c->closed) {
+        // Close frame with status 1000, normal closure
+        append_ws_header(c->out, 0x8, 2);
+        c->out += (char)0x03;
+        c->out += (char)0xE8;
+    }
+
+    c->closing = true;
+    send_output(c);
+}
+
+static std::string error_json(const char *message) {
+    std::string json = "{\"type\":\"error\",\"message\":\"";
+    json_escape(json, message);
+    json += "\"}";
+    return json;
+}
+
+// Called by the session on the worker that is feeding it
+static void handler(void *userdata, AprilResultType result, size_t count, const AprilToken *tokens) {
+    Connection *c = (Connection *)userdata;
+
+    std::string json;
+    switch(result) {
+        case APRIL_RESULT_RECOGNITION_PARTIAL:
+        case APRIL_RESULT_RECOGNITION_FINAL: {
+            json = (result == APRIL_RESULT_RECOGNITION_FINAL) ? "{\"type\":\"final\",\"text\":\"" : "{\"type\":\"partial\",\"text\":\"";
+            for(size_t t=0; t<count; t++) json_escape(json, tokens[t].token);
+
+            char time_ms[64];
+            snprintf(time_ms, sizeof(time_ms), "\",\"time_ms\":%zu}", count > 0 ? tokens[count - 1].time_ms : (size_t)0);
+            json += time_ms;
+            break;
+        }
+        case APRIL_RESULT_SILENCE:
+            json = "{\"type\":\"silence\"}";
+            break;
+        case APRIL_RESULT_ERROR_CANT_KEEP_UP:
+            json = error_json("can't keep up");
+            break;
+        default:
+            return;
+    }
+
+    std::lock_guard<std::mutex> lock(c->mutex);
+    send_message(c, json);
+}
+
+
+static void enqueue(Connection *c) {
+    {
+        std::lock_guard<std::mutex> lock(g_queue_mutex);
+        g_queue.push_back(c);
+    }
+    g_queue_cond.notify_one();
+}
+
+// Hands the connection to a worker unless one already has it. Called with
+// the connection's mutex held
+static bool mark_queued(Connection *c) {
+    if(c->queued) return false;
+
+    c->queued = true;
+    c->refs++;
+    return true;
+}
+
+static void add_audio(Connection *c, const uint8_t *data, size_t size) {
+    std::vector<short> samples;
+    samples.reserve(size / 2 + 1);
+
+    size_t i = 0;
+    if((c->odd_byte >= 0) && (size > 0)) {
+        samples.push_back((short)(uint16_t)((uint8_t)c->odd_byte | ((uint16_t)data[0] << 8)));
+        c->odd_byte = -1;
+        i = 1;
+    }
+
+    for(; i + 1 < size; i += 2) {
+        samples.push_back((short)(uint16_t)(data[i] | ((uint16_t)data[i + 1] << 8)));
+    }
+
+    if(i < size) c->odd_byte = data[i];
+
+    if(samples.empty()) return;
+
+    bool should_enqueue;
+    {
+        std::lock_guard<std::mutex> lock(c->mutex);
+        if(c->eof) return;
+
+        c->pending.insert(c->pending.end(), samples.begin(), samples.end());
+
+        if(c->pending.size() > MAX_PENDING_SECONDS * g_sample_rate) {
+            c->paused = true;
+            update_events(c);
+        }
+
+        should_enqueue = mark_queued(c);
+    }
+
+    if(should_enqueue) enqueue(c);
+}
+
+static void set_eof(Connection *c) {
+    bool should_enqueue;
+    {
+        std::lock_guard<std::mutex> lock(c->mutex);
+        c->read_done = true;
+        update_events(c);
+
+        if(c->eof) return;
+        c->eof = true;
+
+        should_enqueue = mark_queued(c);
+    }
+
+    if(should_enqueue) enqueue(c);
+}
+
+static void close_connection(Connection *c) {
+    {
+        std::lock_guard<std::mutex> lock(c->mutex);
+        if(c->closed) return;
+
+        c->closed = true;
+        close(c->fd);
+    }
+
+    release(c);
+}
+
+static void worker_main() {
+    std::vector<short> audio;
+
+    for(;;) {
+        Connection *c;
+        {
+            std::unique_lock<std::mutex> lock(g_queue_mutex);
+            g_queue_cond.wait(lock, []{ return g_stop || !g_queue.empty(); });
+            if(g_queue.empty()) return;
+
+            c = g_queue.front();
+            g_queue.pop_front();
+        }
+
+        for(;;) {
+            bool should_flush;
+            {
+                std::lock_guard<std::mutex> lock(c->mutex);
+                if(c->closed) {
+                    c->pending.clear();
+                    c->queued = false;
+                    break;
+                }
+
+                audio.swap(c->pending);
+                should_flush = c->eof && !c->flushed;
+
+                if(c->paused) {
+                    c->paused = false;
+                    update_events(c);
+                }
+            }
+
+            // The handler is called from here and takes the mutex itself
+            if(!audio.empty()) aas_feed_pcm16(c->session, audio.data(), audio.size());
+            audio.clear();
+
+            if(should_flush) {
+                aas_flush(c->session);
+
+                std::lock_guard<std::mutex> lock(c->mutex);
+                c->flushed = true;
+                finish(c, "{\"type\":\"done\"}");
+                g_streams_served++;
+            }
+
+            std::lock_guard<std::mutex> lock(c->mutex);
+            if(c->pending.empty() && (c->flushed || !c->eof)) {
+                c->queued = false;
+                break;
+            }
+        }
+
+        release(c);
+    }
+}
+
+
+// Returns false on a bad request
+static bool handle_handshake(Connection *c) {
+    size_t end = c->input.find("\r\n\r\n");
+    if(end == std::string::npos) return c->input.size() <= MAX_HANDSHAKE_SIZE;
+
+    std::string request = c->input.substr(0, end + 2);
+    c->input.erase(0, end + 4);
+
+    std::string key;
+    size_t line_start = 0;
+    while(line_start < request.size()) {
+        size_t line_end = request.find("\r\n", line_start);
+        std::string line = request.substr(line_start, line_end - line_start);
+        line_start = line_end + 2;
+
+        const char header[] = "sec-websocket-key:";
+        if((line.size() > sizeof(header)) && (strncasecmp(line.c_str(), header, sizeof(header) - 1) == 0)) {
+            key = line.substr(sizeof(header) - 1);
+            key.erase(0, key.find_first_not_of(" \t"));
+            key.erase(key.find_last_not_of(" \t") + 1);
+        }
+    }
+
+    if(key.empty()) {
+        const char bad_request[] = "HTTP/1.1 400 Bad Request\r\nConnection: close\r\n\r\n";
+        send(c->fd, bad_request, sizeof(bad_request) - 1, MSG_NOSIGNAL | MSG_DONTWAIT);
+        return false;
+    }
+
+    std::string accept_input = key + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+    uint8_t digest[20];
+    sha1((const uint8_t *)accept_input.data(), accept_input.size(), digest);
+
+    std::string response = "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: " + base64(digest, 20) + "\r\n\r\n";
+
+    c->handshake_done = true;
+
+    std::lock_guard<std::mutex> lock(c->mutex);
+    c->out += response;
+
+    char ready[64];
+    snprintf(ready, sizeof(ready), "{\"type\":\"ready\",\"sample_rate\":%zu}", g_sample_rate);
+    send_message(c, ready);
+    return true;
+}
+
+// Returns false on a protocol error
+static bool handle_frames(Connection *c) {
+    size_t offset = 0;
+    std::string &in = c->input;
+
+    while(in.size() - offset >= 2) {
+        const uint8_t *p = (const uint8_t *)in.data() + offset;
+        size_t available = in.size() - offset;
+
+        uint8_t opcode = p[0] & 0x0F;
+        bool masked = (p[1] & 0x80) != 0;
+        uint64_t size = p[1] & 0x7F;
+        size_t header_size = 2;
+
+        if(size == 126) {
+            if(available < 4) break;
+            size = ((uint64_t)p[2] << 8) | p[3];
+            header_size = 4;
+        } else if(size == 127) {
+            if(available < 10) break;
+            size = 0;
+            for(int i=0; i<8; i++) size = (size << 8) | p[2 + i];
+            header_size = 10;
+        }
+
+        // Clients must mask their frames
+        if(!masked || (size > MAX_FRAME_SIZE)) return false;
+
+        if(available < header_size + 4 + size) break;
+
+        const uint8_t *mask = p + header_size;
+        uint8_t *payload = (uint8_t *)in.data() + offset + header_size + 4;
+        for(size_t i=0; i<size; i++) payload[i] ^= mask[i % 4];
+
+        offset += header_size + 4 + size;
+
+        if(opcode == 0x0) opcode = c->binary_message ? 0x2 : 0x1;
+
+        switch(opcode) {
+            case 0x2:
+                c->binary_message = true;
+                add_audio(c, payload, size);
+                break;
+            case 0x1:
+                c->binary_message = false;
+                if(std::string((const char *)payload, size).find("eof") != std::string::npos) set_eof(c);
+                break;
+            case 0x8:
+                set_eof(c);
+                break;
+            case 0x9: {
+                std::lock_guard<std::mutex> lock(c->mutex);
+                if(c->closing) break;
+
+                append_ws_header(c->out, 0xA, size);
+                c->out.append((const char *)payload, size);
+                send_output(c);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    in.erase(0, offset);
+    return true;
+}
+
+// Returns false if the connection was closed, it may be gone then
+static bool handle_read(Connection *c) {
+    uint8_t buffer[READ_BUFFER_SIZE];
+
+    for(;;) {
+        {
+            std::lock_guard<std::mutex> lock(c->mutex);
+            if(c->paused || c->read_done) return true;
+        }
+
+        ssize_t count = recv(c->fd, buffer, sizeof(buffer), 0);
+        if(count < 0) {
+            if(errno == EINTR) continue;
+            if((errno == EAGAIN) || (errno == EWOULDBLOCK)) return true;
+
+            close_connection(c);
+            return false;
+        }
+
+        if(count == 0) {
+            set_eof(c);
+            return true;
+        }
+
+        if(c->protocol == PROTOCOL_UNIX) {
+            add_audio(c, buffer, (size_t)count);
+            continue;
+        }
+
+        c->input.append((const char *)buffer, (size_t)count);
+
+        bool ok = c->handshake_done || handle_handshake(c);
+        if(ok && c->handshake_done) ok = handle_frames(c);
+
+        if(!ok) {
+            close_connection(c);
+            return false;
+        }
+    }
+}
+
+static void accept_connections(IoThread *io, Listener *listener) {
+    for(;;) {
+        int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) {
+            if(errno == EINTR) continue;
+            if((errno != EAGAIN) && (errno != EWOULDBLOCK)) perror("accept");
+            return;
+        }
+
+        Connection *c = new Connection();
+        c->fd = fd;
+        c->protocol = listener->protocol;
+        c->io = io;
+
+        size_t active;
+        {
+            std::lock_guard<std::mutex> lock(g_connections_mutex);
+            active = g_connections.size();
+            if(active < g_max_streams) g_connections.insert(c);
+        }
+
+        if(active >= g_max_streams) {
+            std::string message = (c->protocol == PROTOCOL_UNIX)
+                ? error_json("too many streams") + "\n"
+                : "HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\n\r\n";
+            send(fd, message.data(), message.size(), MSG_NOSIGNAL | MSG_DONTWAIT);
+
+            printf("Rejected a stream, %zu are already active\n", active);
+            close(fd);
+            delete c;
+            continue;
+        }
+
+        if(c->protocol == PROTOCOL_WEBSOCKET) {
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        }
+
+        AprilConfig config = { 0 };
+        config.handler = handler;
+        config.userdata = c;
+        config.flags = APRIL_CONFIG_FLAG_ZERO_BIT;
+
+        c->session = aas_create_session(g_model, config);
+
+        c->events = EPOLLIN;
+        struct epoll_event ev = { 0 };
+        ev.events = c->events;
+        ev.data.ptr = c;
+
+        if((c->session == NULL) || (epoll_ctl(io->epoll_fd, EPOLL_CTL_ADD, fd, &ev) != 0)) {
+            printf("Failed to set up a stream\n");
+            c->closed = true;
+            close(fd);
+            release(c);
+            continue;
+        }
+
+        if(c->protocol == PROTOCOL_UNIX) {
+            char ready[64];
+            snprintf(ready, sizeof(ready), "{\"type\":\"ready\",\"sample_rate\":%zu}", g_sample_rate);
+
+            std::lock_guard<std::mutex> lock(c->mutex);
+            send_message(c, ready);
+        }
+    }
+}
+
+static void io_main(IoThread *io, std::vector<Listener> *listeners) {
+    struct epoll_event events[MAX_EVENTS];
+
+    while(!g_stop) {
+        int count = epoll_wait(io->epoll_fd, events, MAX_EVENTS, POLL_INTERVAL_MS);
+        if(count < 0) {
+            if(errno == EINTR) continue;
+            perror("epoll_wait");
+            return;
+        }
+
+        for(int i=0; i<count; i++) {
+            void *ptr = events[i].data.ptr;
+
+            bool is_listener = false;
+            for(Listener &listener : *listeners) {
+                if(ptr == &listener) {
+                    accept_connections(io, &listener);
+                    is_listener = true;
+                }
+            }
+            if(is_listener) continue;
+
+            Connection *c = (Connection *)ptr;
+            uint32_t flags = events[i].events;
+
+            if((flags & EPOLLIN) && !handle_read(c)) continue;
+
+            if(flags & (EPOLLERR | EPOLLHUP)) {
+                close_connection(c);
+                continue;
+            }
+
+            if(flags & EPOLLOUT) {
+                bool should_close;
+                {
+                    std::lock_guard<std::mutex> lock(c->mutex);
+                    send_output(c);
+                    should_close = c->closing && c->out.empty();
+                }
+
+                if(should_close) close_connection(c);
+            }
+        }
+    }
+}
+
+
+static int listen_unix(const char *path) {
+    struct sockaddr_un addr = { 0 };
+    if(strlen(path) >= sizeof(addr.sun_path)) {
+        printf("Unix socket path %s is too long\n", path);
+        return -1;
+    }
+
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) return -1;
+
+    if((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(fd, SOMAXCONN) != 0)) {
+        perror(path);
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+// Only on the loopback interface, this is not meant to face a network
+static int listen_tcp(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd < 0) return -1;
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons((uint16_t)port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if((bind(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) || (listen(fd, SOMAXCONN) != 0)) {
+        perror("WebSocket port");
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void print_usage(const char *name) {
+    printf("Usage: %s [modelpath] [options]\n", name);
+    printf(" --unix PATH         listen on a Unix socket\n");
+    printf(" --ws-port PORT      listen for WebSocket connections on 127.0.0.1\n");
+    printf(" --io-threads N      threads handling sockets (default 2)\n");
+    printf(" --workers N         threads running recognition (default: CPU count)\n");
+    printf(" --max-streams N     concurrent streams before rejecting (default 64)\n");
+}
+
+int main(int argc, char *argv[]) {
+    ServerOptions opts;
+
+    for(int i=1; i<argc; i++) {
+        bool has_value = (i + 1) < argc;
+        if((strcmp(argv[i], "--unix") == 0) && has_value) opts.unix_path = argv[++i];
+        else if((strcmp(argv[i], "--ws-port") == 0) && has_value) opts.ws_port = atoi(argv[++i]);
+        else if((strcmp(argv[i], "--io-threads") == 0) && has_value) opts.io_threads = (size_t)atoi(argv[++i]);
+        else if((strcmp(argv[i], "--workers") == 0) && has_value) opts.workers = (size_t)atoi(argv[++i]);
+        else if((strcmp(argv[i], "--max-streams") == 0) && has_value) opts.max_streams = (size_t)atoi(argv[++i]);
+        else if((argv[i][0] != '-') && (opts.model_path == NULL)) opts.model_path = argv[i];
+        else {
+            print_usage(argv[0]);
+            return 1;
+        }
+    }
+
+    if((opts.model_path == NULL) || ((opts.unix_path == NULL) && (opts.ws_port <= 0))) {
+        print_usage(argv[0]);
+        return 1;
+    }
+
+    if(opts.io_threads == 0) opts.io_threads = 1;
+    if(opts.workers == 0) opts.workers = std::thread::hardware_concurrency();
+    if(opts.workers == 0) opts.workers = 1;
+    g_max_streams = opts.max_streams;
+
+    aam_api_init(APRIL_VERSION);
+
+    g_model = aam_create_model(opts.model_path);
+    if(g_model == NULL) {
+        printf("Loading model %s failed!\n", opts.model_path);
+        return 1;
+    }
+    g_sample_rate = aam_get_sample_rate(g_model);
+
+    std::vector<Listener> listeners;
+    if(opts.unix_path != NULL) {
+        int fd = listen_unix(opts.unix_path);
+        if(fd < 0) return 2;
+        listeners.push_back({ fd, PROTOCOL_UNIX });
+        printf("Listening on unix:%s\n", opts.unix_path);
+    }
+
+    if(opts.ws_port > 0) {
+        int fd = listen_tcp(opts.ws_port);
+        if(fd < 0) return 2;
+        listeners.push_back({ fd, PROTOCOL_WEBSOCKET });
+        printf("Listening on ws://127.0.0.1:%d/\n", opts.ws_port);
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<std::thread> workers;
+    for(size_t i=0; i<opts.workers; i++) workers.emplace_back(worker_main);
+
+    // Every I/O thread waits on the listeners, EPOLLEXCLUSIVE wakes only
+    // one of them per new connection
+    std::vector<IoThread> io_threads(opts.io_threads);
+    for(IoThread &io : io_threads) {
+        io.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+
+        for(Listener &listener : listeners) {
+            struct epoll_event ev = { 0 };
+            ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+            ev.data.ptr = &listener;
+            epoll_ctl(io.epoll_fd, EPOLL_CTL_ADD, listener.fd, &ev);
+        }
+    }
+
+    for(IoThread &io : io_threads) io.thread = std::thread(io_main, &io, &listeners);
+
+    printf("Serving %s with %zu workers and %zu I/O threads\n", aam_get_name(g_model), opts.workers, opts.io_threads);
+    fflush(stdout);
+
+    for(IoThread &io : io_threads) io.thread.join();
+
+    g_queue_cond.notify_all();
+    for(std::thread &worker : workers) worker.join();
+
+    // Streams still open when stopped
+    std::vector<Connection *> remaining;
+    {
+        std::lock_guard<std::mutex> lock(g_connections_mutex);
+        remaining.assign(g_connections.begin(), g_connections.end());
+    }
+    for(Connection *c : remaining) {
+        if(c->queued) release(c);
+        close_connection(c);
+    }
+
+    for(IoThread &io : io_threads) close(io.epoll_fd);
+    for(Listener &listener : listeners) close(listener.fd);
+    if(opts.unix_path != NULL) unlink(opts.unix_path);
+
+    printf("Served %zu streams\n", g_streams_served.load());
+
+    aam_free(g_model);
+    return 0;
+}
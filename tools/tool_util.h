@@ -0,0 +1,191 @@
+// Helpers shared by the tools: audio loading, synthetic audio, percentiles
+// and JSON/base64 encoding. Header only, as each tool is a single file
+
+#ifndef _APRIL_TOOL_UTIL
+#define _APRIL_TOOL_UTIL
+
+#include <stdio.h>
+#include <cstdint>
+#include <cstring>
+#include <cmath>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "wav_header.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Finds the PCM data of a wav file. The RIFF header is checked with
+// wav_header, then the chunks are walked, since the data doesn't always
+// start at byte 44 (for example when there's a LIST chunk). The sample
+// rate is not checked if it is 0
+static inline bool find_wav_data(const uint8_t *data, size_t file_size, size_t sample_rate, size_t *offset, size_t *size, std::string &error) {
+    if(file_size < sizeof(wav_header)) {
+        error = "too small to be a wav file";
+        return false;
+    }
+
+    wav_header header;
+    memcpy(&header, data, sizeof(header));
+
+    if((memcmp(header.riff_header, "RIFF", 4) != 0) || (memcmp(header.wave_header, "WAVE", 4) != 0)) {
+        error = "not a RIFF/WAVE file";
+        return false;
+    }
+
+    bool have_format = false;
+    size_t position = 12;
+    while(position + 8 <= file_size) {
+        const uint8_t *chunk = data + position;
+        uint32_t chunk_size;
+        memcpy(&chunk_size, chunk + 4, 4);
+
+        if(memcmp(chunk, "fmt ", 4) == 0) {
+            if((chunk_size < 16) || (position + 8 + 16 > file_size)) break;
+
+            // The fields after fmt_chunk_size in wav_header match the chunk
+            memcpy(&header.audio_format, chunk + 8, 16);
+            have_format = true;
+        } else if(memcmp(chunk, "data", 4) == 0) {
+            if(!have_format) break;
+
+            bool is_valid_wav = (header.audio_format == 1)
+                             && (header.bit_depth == 16)
+                             && (header.num_channels == 1)
+                             && ((sample_rate == 0) || ((size_t)header.sample_rate == sample_rate));
+
+            if(!is_valid_wav) {
+                char message[128];
+                if(sample_rate == 0) snprintf(message, sizeof(message), "must be single-channel 16-bit PCM");
+                else snprintf(message, sizeof(message), "must be single-channel 16-bit PCM sampled in %zu Hz", sample_rate);
+                error = message;
+                return false;
+            }
+
+            *offset = position + 8;
+            *size = std::min((size_t)chunk_size, file_size - *offset);
+            return true;
+        }
+
+        // Chunks are padded to an even size
+        position += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    error = "no fmt or data chunk";
+    return false;
+}
+
+// Loads a 16 bit mono wav or raw PCM16 file. Returns false and sets error
+// if it couldn't be loaded
+static inline bool load_audio(const char *path, size_t sample_rate, std::vector<short> &audio, std::string &error) {
+    FILE *fd = fopen(path, "rb");
+    if(fd == NULL) {
+        error = "can't open file";
+        return false;
+    }
+
+    std::vector<uint8_t> data;
+    uint8_t buffer[8192];
+    size_t count;
+    while((count = fread(buffer, 1, sizeof(buffer), fd)) > 0) {
+        data.insert(data.end(), buffer, buffer + count);
+    }
+    fclose(fd);
+
+    size_t offset = 0, size = data.size();
+    if((data.size() >= 4) && (memcmp(data.data(), "RIFF", 4) == 0)) {
+        if(!find_wav_data(data.data(), data.size(), sample_rate, &offset, &size, error)) return false;
+    }
+
+    audio.resize(size / 2);
+    if(!audio.empty()) memcpy(audio.data(), data.data() + offset, audio.size() * sizeof(short));
+
+    if(audio.empty()) {
+        error = "no audio";
+        return false;
+    }
+
+    return true;
+}
+
+// Deterministic speech-like audio: voiced bursts of a few harmonics with a
+// wandering pitch, separated by pauses, over a low noise floor. Enough to
+// exercise every stage, but won't give meaningful text
+static inline void make_synthetic_audio(std::vector<short> &audio, size_t sample_rate, double seconds) {
+    size_t count = (size_t)(sample_rate * seconds);
+    audio.resize(count);
+
+    uint32_t noise = 12345;
+    double phase = 0.0;
+    for(size_t i=0; i<count; i++) {
+        double t = (double)i / (double)sample_rate;
+
+        // 250ms syllables, with a pause every 2 seconds
+        double syllable = fmod(t, 0.25) / 0.25;
+        double envelope = sin(M_PI * syllable) * (fmod(t, 2.0) < 1.6 ? 1.0 : 0.0);
+
+        double pitch = 120.0 + 40.0 * sin(2.0 * M_PI * 0.7 * t);
+        phase += 2.0 * M_PI * pitch / (double)sample_rate;
+
+        double voiced = 0.0;
+        for(int h=1; h<=6; h++) voiced += sin(phase * h) / h;
+
+        noise = noise * 1664525 + 1013904223;
+        double white = ((double)(noise >> 16) / 32768.0) - 1.0;
+
+        audio[i] = (short)(4000.0 * envelope * voiced + 200.0 * white);
+    }
+}
+
+// Nearest-rank percentile, p in [0, 100]. 0 if there are no values
+static inline double percentile(std::vector<double> values, double p) {
+    if(values.empty()) return 0.0;
+
+    std::sort(values.begin(), values.end());
+    size_t index = (size_t)(p / 100.0 * (double)(values.size() - 1) + 0.5);
+    return values[std::min(index, values.size() - 1)];
+}
+
+// Appends text to out as the inside of a JSON string
+static inline void json_escape(std::string &out, const char *text) {
+    for(const char *p = text; *p != 0; p++) {
+        unsigned char ch = (unsigned char)*p;
+        switch(ch) {
+            case '"':  out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if(ch < 0x20) {
+                    char escaped[8];
+                    snprintf(escaped, sizeof(escaped), "\\u%04x", ch);
+                    out += escaped;
+                } else {
+                    out += (char)ch;
+                }
+        }
+    }
+}
+
+static inline std::string base64(const uint8_t *data, size_t size) {
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string result;
+    for(size_t i=0; i<size; i+=3) {
+        uint32_t n = (uint32_t)data[i] << 16;
+        if(i + 1 < size) n |= (uint32_t)data[i + 1] << 8;
+        if(i + 2 < size) n |= (uint32_t)data[i + 2];
+
+        result += alphabet[(n >> 18) & 63];
+        result += alphabet[(n >> 12) & 63];
+        result += (i + 1 < size) ? alphabet[(n >> 6) & 63] : '=';
+        result += (i + 2 < size) ? alphabet[n & 63] : '=';
+    }
+
+    return result;
+}
+
+#endif
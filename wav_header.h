@@ -0,0 +1,34 @@
+// Header of a canonical 44 byte PCM wav file, shared by the examples and
+// tools. Files with extra chunks before the data (LIST and such) don't
+// match it past fmt, see find_wav_data in tools/tool_util.h for walking
+// the chunks instead
+
+#ifndef _APRIL_WAV_HEADER
+#define _APRIL_WAV_HEADER
+
+#include <stdint.h>
+
+struct wav_header {
+    // RIFF Header
+    char riff_header[4]; // Contains "RIFF"
+    uint32_t wav_size; // Size of the wav portion of the file, which follows the first 8 bytes. File size - 8
+    char wave_header[4]; // Contains "WAVE"
+    
+    // Format Header
+    char fmt_header[4]; // Contains "fmt " (includes trailing space)
+    int32_t fmt_chunk_size; // Should be 16 for PCM
+    int16_t audio_format; // Should be 1 for PCM. 3 for IEEE Float
+    int16_t num_channels;
+    int32_t sample_rate;
+    int32_t byte_rate; // Number of bytes per second. sample_rate * num_channels * Bytes Per Sample
+    int16_t sample_alignment; // num_channels * Bytes Per Sample
+    int16_t bit_depth; // Number of bits per sample
+    
+    // Data
+    char data_header[4]; // Contains "data"
+    uint32_t data_bytes; // Number of bytes in data. Number of samples * num_channels * sample byte size
+};
+
+static_assert(sizeof(wav_header) == 44L, "wav header must be 44 bytes");
+
+#endif